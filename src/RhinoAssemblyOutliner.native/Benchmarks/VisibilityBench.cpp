@@ -0,0 +1,289 @@
+// VisibilityBench.cpp : Micro-benchmarks for the visibility store hot paths
+//
+// Console app built from the plug-in's own headers and VisibilityPersistence.cpp.
+// Every managed instance of a synthetic assembly gets HIDDEN_PER_INSTANCE
+// hidden paths of a fixed depth. Instance counts follow the ADR-004 scale
+// tiers and assume the worst case, where every instance is managed. Depths
+// are 1, 4 and 8.
+//
+// SetDefinitionState edits one definition rule on the populated store.
+// ActivateStateTable alternates between two saved variants of the assembly.
+//
+// Reported per benchmark: ns/op and heap allocations per op, counted by the
+// global operator new replacement below. It only sees C++ allocations of
+// this module: buffers opennurbs.dll allocates through onmalloc (ON_wString,
+// ON_String, ON_SimpleArray) are not counted, so Serialize / Deserialize
+// report fewer allocations than they make. Run from a directory where
+// opennurbs.dll resolves (the Rhino 8 System folder on PATH).
+//
+//   RhinoAssemblyOutliner.Native.Bench.exe [maxInstances]
+
+#include "../stdafx.h"
+#include "../VisibilityData.h"
+#include "../VisibilityPersistence.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+// --- Allocation counting ---
+
+static std::atomic<uint64_t> g_allocations{ 0 };
+
+void* operator new(size_t size)
+{
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+	std::free(p);
+}
+
+// --- Synthetic assemblies ---
+
+static const int HIDDEN_PER_INSTANCE = 8;
+static const int CHILDREN_PER_LEVEL = 64;
+
+struct CTier
+{
+	const char* name;
+	int instances;
+};
+
+// ADR-004 scale targets (every instance managed)
+static const CTier TIERS[] = {
+	{ "Small", 100 },
+	{ "Medium", 1000 },
+	{ "Large", 10000 },
+	{ "XL", 25000 },
+};
+
+static const int DEPTHS[] = { 1, 4, 8 };
+
+/// Deterministic xorshift generator so runs are comparable
+class CRandom
+{
+public:
+	explicit CRandom(uint32_t seed) : m_state(seed ? seed : 1) {}
+
+	int Next(int bound)
+	{
+		m_state ^= m_state << 13;
+		m_state ^= m_state >> 17;
+		m_state ^= m_state << 5;
+		return static_cast<int>(m_state % static_cast<uint32_t>(bound));
+	}
+
+private:
+	uint32_t m_state;
+};
+
+static ON_UUID InstanceId(int index)
+{
+	ON_UUID id = ON_nil_uuid;
+	id.Data1 = static_cast<uint32_t>(index) * 2654435761u;
+	id.Data2 = 0x5241;
+	id.Data3 = 0x4f56;
+	id.Data4[0] = static_cast<unsigned char>(index);
+	id.Data4[7] = 1;
+	return id;
+}
+
+static CComponentPath RandomPath(CRandom& random, int depth)
+{
+	CComponentPath path;
+	for (int level = 0; level < depth; level++)
+		path.Push(random.Next(CHILDREN_PER_LEVEL));
+	return path;
+}
+
+/// All hidden paths of an assembly, instance by instance
+static std::vector<CComponentStateChange> MakeAssembly(int instances, int depth)
+{
+	CRandom random(static_cast<uint32_t>(instances * 31 + depth));
+	std::vector<CComponentStateChange> changes;
+	changes.reserve(static_cast<size_t>(instances) * HIDDEN_PER_INSTANCE);
+	for (int i = 0; i < instances; i++)
+	{
+		const ON_UUID id = InstanceId(i);
+		for (int h = 0; h < HIDDEN_PER_INSTANCE; h++)
+			changes.push_back({ id, RandomPath(random, depth), CS_HIDDEN });
+	}
+	return changes;
+}
+
+// --- Measurement ---
+
+class CMeasure
+{
+public:
+	CMeasure() : m_allocations(g_allocations.load(std::memory_order_relaxed))
+	{
+		::QueryPerformanceCounter(&m_start);
+	}
+
+	/// Print one result row for ops operations since construction
+	void Report(const char* tier, int depth, const char* benchmark, uint64_t ops) const
+	{
+		LARGE_INTEGER now;
+		LARGE_INTEGER frequency;
+		::QueryPerformanceCounter(&now);
+		::QueryPerformanceFrequency(&frequency);
+
+		const double ns = static_cast<double>(now.QuadPart - m_start.QuadPart) * 1.0e9
+			/ static_cast<double>(frequency.QuadPart);
+		const uint64_t allocations = g_allocations.load(std::memory_order_relaxed) - m_allocations;
+		const double perOp = ops ? 1.0 / static_cast<double>(ops) : 0.0;
+
+		std::printf("%-7s %5d  %-22s %10llu %14.1f %12.2f\n", tier, depth, benchmark,
+			static_cast<unsigned long long>(ops), ns * perOp, static_cast<double>(allocations) * perOp);
+	}
+
+private:
+	LARGE_INTEGER m_start;
+	uint64_t m_allocations;
+};
+
+static void RunTier(const CTier& tier, int depth)
+{
+	const std::vector<CComponentStateChange> assembly = MakeAssembly(tier.instances, depth);
+
+	CVisibilityData data;
+	{
+		CMeasure measure;
+		data.SetStates(assembly.data(), assembly.size());
+		measure.Report(tier.name, depth, "SetStates (batch)", assembly.size());
+	}
+
+	// Single changes on the populated store: each one copies its path and publishes
+	{
+		const int ops = 2000;
+		CRandom random(7);
+		CMeasure measure;
+		for (int i = 0; i < ops; i++)
+		{
+			const CComponentStateChange& change = assembly[random.Next(static_cast<int>(assembly.size()))];
+			data.SetState(change.instanceId, change.path, (i & 1) ? CS_HIDDEN : CS_TRANSPARENT);
+		}
+		measure.Report(tier.name, depth, "SetState", ops);
+	}
+
+	// Definition rules: one trie per definition, however many instances it has
+	{
+		const int ops = 2000;
+		const ON_UUID definitionId = InstanceId(tier.instances);
+		CRandom random(13);
+		CMeasure measure;
+		for (int i = 0; i < ops; i++)
+			data.SetDefinitionState(definitionId, RandomPath(random, depth), (i & 1) ? CS_HIDDEN : CS_TRANSPARENT);
+		measure.Report(tier.name, depth, "SetDefinitionState", ops);
+	}
+
+	// Variant switching: two saved tables, the second with every path transparent
+	{
+		std::vector<CComponentStateChange> service = assembly;
+		for (CComponentStateChange& change : service)
+			change.state = CS_TRANSPARENT;
+		data.SaveStateTable(L"installation");
+		data.SetStateTableStates(L"service", service.data(), service.size());
+
+		const int ops = 1000;
+		CMeasure measure;
+		for (int i = 0; i < ops; i++)
+			data.ActivateStateTable((i & 1) ? L"installation" : L"service");
+		measure.Report(tier.name, depth, "ActivateStateTable", ops);
+	}
+
+	{
+		const int ops = 100000;
+		uint64_t generations = 0;
+		CMeasure measure;
+		for (int i = 0; i < ops; i++)
+			generations += data.AcquireSnapshot()->Generation();
+		measure.Report(tier.name, depth, "AcquireSnapshot", ops);
+		if (generations == 0)
+			std::printf("(no snapshot)\n");
+	}
+
+	// Half of the lookups hit a stored path prefix, half are random paths
+	{
+		const int ops = 100000;
+		std::shared_ptr<const CVisibilitySnapshot> snap = data.AcquireSnapshot();
+		CRandom random(11);
+		std::vector<std::pair<ON_UUID, CComponentPath>> queries;
+		queries.reserve(ops);
+		for (int i = 0; i < ops; i++)
+		{
+			const CComponentStateChange& change = assembly[random.Next(static_cast<int>(assembly.size()))];
+			queries.emplace_back(change.instanceId, (i & 1) ? change.path.Prefix(1 + random.Next(depth)) : RandomPath(random, depth));
+		}
+
+		int hits = 0;
+		CMeasure measure;
+		for (const auto& query : queries)
+			hits += snap->HasHiddenDescendants(query.first, query.second) ? 1 : 0;
+		measure.Report(tier.name, depth, "HasHiddenDescendants", ops);
+		if (hits == 0)
+			std::printf("(no hits)\n");
+	}
+
+	{
+		const int ops = 5;
+		ON_wString serialized;
+		{
+			CMeasure measure;
+			for (int i = 0; i < ops; i++)
+				serialized = SerializeVisibilityState(data);
+			measure.Report(tier.name, depth, "Serialize", ops);
+		}
+		{
+			CMeasure measure;
+			for (int i = 0; i < ops; i++)
+			{
+				CVisibilityData loaded;
+				DeserializeVisibilityState(serialized, loaded);
+			}
+			measure.Report(tier.name, depth, "Deserialize", ops);
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const int maxInstances = argc > 1 ? std::atoi(argv[1]) : 0;
+
+	std::printf("%-7s %5s  %-22s %10s %14s %12s\n", "Tier", "Depth", "Benchmark", "Ops", "ns/op", "allocs/op");
+	for (const CTier& tier : TIERS)
+	{
+		if (maxInstances > 0 && tier.instances > maxInstances)
+			continue;
+		for (int depth : DEPTHS)
+			RunTier(tier, depth);
+	}
+	return 0;
+}
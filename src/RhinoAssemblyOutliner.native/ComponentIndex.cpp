@@ -0,0 +1,91 @@
+// ComponentIndex.cpp : Flattened component table implementation
+
+#include "stdafx.h"
+#include "ComponentIndex.h"
+
+std::shared_ptr<const CComponentIndex> CComponentIndex::Build(const CRhinoInstanceDefinition* pDef)
+{
+	if (!pDef)
+		return nullptr;
+
+	std::shared_ptr<CComponentIndex> index(new CComponentIndex());
+	index->m_pDefinition = pDef;
+	index->m_objectCount = pDef->ObjectCount();
+	index->m_xforms.push_back(ON_Xform::IdentityTransformation);
+	index->m_complete = index->Append(pDef, -1, 0, 0);
+
+	// Oversized trees keep no rows
+	if (!index->m_complete)
+	{
+		*index = CComponentIndex();
+		index->m_pDefinition = pDef;
+		index->m_objectCount = pDef->ObjectCount();
+	}
+	return index;
+}
+
+bool CComponentIndex::Append(const CRhinoInstanceDefinition* pDef, int parent, int space, int depth)
+{
+	const int componentCount = pDef->ObjectCount();
+	if (RowCount() + componentCount > MAX_ROWS)
+		return false;
+
+	for (int i = 0; i < componentCount; i++)
+	{
+		const CRhinoObject* pComponent = pDef->Object(i);
+		const int row = RowCount();
+
+		uint8_t flags = 0;
+		ON_BoundingBox bbox;
+		if (pComponent)
+		{
+			if (pComponent->IsVisible())
+				flags |= ROW_VISIBLE;
+			if (pComponent->ObjectType() == ON::instance_reference)
+				flags |= ROW_INSTANCE;
+
+			bbox = pComponent->BoundingBox();
+			if (space != 0)
+				bbox.Transform(m_xforms[space]);
+		}
+
+		m_objects.push_back(pComponent);
+		m_depths.push_back(static_cast<uint8_t>(depth));
+		m_parents.push_back(parent);
+		m_indices.push_back(i);
+		m_ends.push_back(row + 1);
+		m_spaces.push_back(space);
+		m_bboxes.push_back(bbox);
+
+		// Only visible blocks are expanded: every pass skips hidden objects
+		const CRhinoInstanceDefinition* pNestedDef = nullptr;
+		if ((flags & ROW_VISIBLE) && (flags & ROW_INSTANCE) && depth < CComponentPath::MAX_NESTING_DEPTH)
+			pNestedDef = static_cast<const CRhinoInstanceObject*>(pComponent)->InstanceDefinition();
+
+		if (pNestedDef)
+			flags |= ROW_EXPANDED;
+		m_flags.push_back(flags);
+
+		if (pNestedDef)
+		{
+			m_xforms.push_back(m_xforms[space] * static_cast<const CRhinoInstanceObject*>(pComponent)->InstanceXform());
+			if (!Append(pNestedDef, row, static_cast<int>(m_xforms.size()) - 1, depth + 1))
+				return false;
+			m_ends[row] = RowCount();
+		}
+	}
+	return true;
+}
+
+CComponentPath CComponentIndex::Path(int row) const
+{
+	int indices[CComponentPath::MAX_DEPTH];
+	int depth = 0;
+	for (int r = row; r >= 0 && depth < CComponentPath::MAX_DEPTH; r = m_parents[r])
+		indices[depth++] = m_indices[r];
+
+	CComponentPath path;
+	while (depth > 0)
+		path.Push(indices[--depth]);
+	return path;
+}
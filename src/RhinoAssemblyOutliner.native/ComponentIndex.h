@@ -0,0 +1,100 @@
+// ComponentIndex.h : Flattened component table of one instance definition
+//
+// Walking a definition tree means a virtual Object(i), IsVisible() and
+// ObjectType() per component and an ON_Xform product per nested block, at
+// every level and for every walk. CComponentIndex does that walk once and
+// stores the whole expanded tree in depth-first order as parallel arrays
+// (struct of arrays): object, depth, parent row, index within the parent
+// definition, subtree end, transform into top-level definition space, bbox in
+// that space and type flags.
+//
+// A nested block's components directly follow its row and end at its
+// SubtreeEnd, so passes over the tree are linear scans that skip a whole
+// subtree by jumping to SubtreeEnd. Transforms are stored once per expanded
+// nested block and shared by its direct components.
+//
+// Definitions expanding to more than MAX_ROWS rows are not flattened
+// (IsComplete() is false) and keep the recursive walk. Rows hold raw pointers
+// into definition geometry and follow the draw list cache's invalidation
+// (CDrawListCache owns the indexes).
+
+#pragma once
+
+#include "ComponentPath.h"
+#include <memory>
+#include <vector>
+
+class CComponentIndex
+{
+public:
+	/// Type flags of a row
+	enum RowFlags : uint8_t
+	{
+		ROW_VISIBLE = 1,    ///< Component exists and IsVisible()
+		ROW_INSTANCE = 2,   ///< Component is a block instance
+		ROW_EXPANDED = 4,   ///< Its nested definition's components follow (within MAX_NESTING_DEPTH)
+	};
+
+	/// Largest expanded tree flattened (about 80 bytes per row)
+	static const int MAX_ROWS = 1 << 18;
+
+	/// Flatten pDef and every nested definition of its visible blocks
+	static std::shared_ptr<const CComponentIndex> Build(const CRhinoInstanceDefinition* pDef);
+
+	/// Whether the whole tree fit in MAX_ROWS (otherwise the index has no rows)
+	bool IsComplete() const { return m_complete; }
+
+	/// Definition and its ObjectCount() the index was built from
+	const CRhinoInstanceDefinition* Definition() const { return m_pDefinition; }
+	int ObjectCount() const { return m_objectCount; }
+
+	int RowCount() const { return static_cast<int>(m_objects.size()); }
+
+	/// Component of a row (nullptr if the definition slot is empty)
+	const CRhinoObject* Object(int row) const { return m_objects[row]; }
+
+	/// Nesting level (0 = component of the indexed definition)
+	int Depth(int row) const { return m_depths[row]; }
+
+	/// Row of the nested block a row belongs to, -1 at depth 0
+	int Parent(int row) const { return m_parents[row]; }
+
+	/// Index of the component within its parent definition (one path level)
+	int Index(int row) const { return m_indices[row]; }
+
+	/// Row after the last component nested below a row
+	int SubtreeEnd(int row) const { return m_ends[row]; }
+
+	/// Component -> top-level definition space
+	const ON_Xform& Xform(int row) const { return m_xforms[m_spaces[row]]; }
+
+	/// Xform(row) is the identity (top-level component)
+	bool Identity(int row) const { return m_spaces[row] == 0; }
+
+	/// Component bbox in top-level definition space
+	const ON_BoundingBox& BBox(int row) const { return m_bboxes[row]; }
+
+	uint8_t Flags(int row) const { return m_flags[row]; }
+
+	/// Path of a row from the indexed definition
+	CComponentPath Path(int row) const;
+
+private:
+	CComponentIndex() = default;
+
+	/// Append the rows of pDef below parent. Returns false once MAX_ROWS is exceeded.
+	bool Append(const CRhinoInstanceDefinition* pDef, int parent, int space, int depth);
+
+	std::vector<const CRhinoObject*> m_objects;
+	std::vector<uint8_t> m_depths;
+	std::vector<uint8_t> m_flags;
+	std::vector<int> m_parents;
+	std::vector<int> m_indices;
+	std::vector<int> m_ends;
+	std::vector<int> m_spaces;           ///< Per row: index into m_xforms
+	std::vector<ON_BoundingBox> m_bboxes;
+	std::vector<ON_Xform> m_xforms;      ///< One per expanded nested block; [0] is the identity
+	const CRhinoInstanceDefinition* m_pDefinition = nullptr;
+	int m_objectCount = 0;
+	bool m_complete = false;
+};
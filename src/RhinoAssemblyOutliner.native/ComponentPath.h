@@ -0,0 +1,189 @@
+// ComponentPath.h : Compact component path (packed child-index sequence)
+//
+// Replaces dot-separated path strings as the key shared by the C API,
+// CVisibilityData and the conduit. The text form ("0", "1.0", "1.0.2") is
+// parsed once at the API boundary and only formatted again for persistence
+// and debug output.
+//
+// Indices live inline and the hash is maintained incrementally, so building
+// a child path (Child), hashing and comparing never allocate.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+class CComponentPath
+{
+public:
+	/// Deepest nested block level the conduit walks into
+	static const int MAX_NESTING_DEPTH = 32;
+
+	/// One top-level index plus MAX_NESTING_DEPTH nested levels
+	static const int MAX_DEPTH = MAX_NESTING_DEPTH + 1;
+
+	/// Largest accepted child index. State tries keep a dense byte per child,
+	/// so unbounded indices from bad input could force huge allocations.
+	static const int MAX_CHILD_INDEX = (1 << 24) - 1;
+
+	CComponentPath() = default;
+
+	/// Parse a dot-separated index string, e.g. "1.0.2".
+	/// Returns false for empty, malformed or too deeply nested paths.
+	static bool Parse(const char* text, CComponentPath& out)
+	{
+		out = CComponentPath();
+		if (!text)
+			return false;
+		return Parse(text, text + std::strlen(text), out);
+	}
+
+	/// Parse the dot-separated index string in [begin, end) (not NUL-terminated)
+	static bool Parse(const char* begin, const char* end, CComponentPath& out)
+	{
+		out = CComponentPath();
+		if (!begin || begin >= end)
+			return false;
+
+		const char* p = begin;
+		for (;;)
+		{
+			if (p == end || *p < '0' || *p > '9')
+				return false;
+
+			uint64_t value = 0;
+			while (p != end && *p >= '0' && *p <= '9')
+			{
+				value = value * 10 + static_cast<uint64_t>(*p - '0');
+				if (value > static_cast<uint64_t>(MAX_CHILD_INDEX))
+					return false;
+				p++;
+			}
+
+			if (!out.Push(static_cast<int>(value)))
+				return false;
+
+			if (p == end)
+				return true;
+			if (*p != '.')
+				return false;
+			p++;
+		}
+	}
+
+	/// Build a path from an index array (root first)
+	static bool FromIndices(const int* indices, int depth, CComponentPath& out)
+	{
+		out = CComponentPath();
+		if (!indices || depth <= 0)
+			return false;
+		for (int i = 0; i < depth; i++)
+		{
+			if (indices[i] < 0 || !out.Push(indices[i]))
+				return false;
+		}
+		return true;
+	}
+
+	/// Number of levels (0 = empty path)
+	int Depth() const { return m_depth; }
+	bool IsEmpty() const { return m_depth == 0; }
+
+	/// Child index at the given level (0 = top-level component)
+	int At(int level) const { return static_cast<int>(m_indices[level]); }
+
+	/// Index of the last level (the component within its parent definition)
+	int Leaf() const { return static_cast<int>(m_indices[m_depth - 1]); }
+
+	/// Append a level. Returns false if the path is already MAX_DEPTH deep
+	/// or childIndex is outside [0, MAX_CHILD_INDEX].
+	bool Push(int childIndex)
+	{
+		if (m_depth >= MAX_DEPTH || childIndex < 0 || childIndex > MAX_CHILD_INDEX)
+			return false;
+		m_indices[m_depth++] = static_cast<uint32_t>(childIndex);
+		m_hash = Mix(m_hash, static_cast<uint32_t>(childIndex));
+		return true;
+	}
+
+	/// Copy of this path extended by one level (no allocation)
+	CComponentPath Child(int childIndex) const
+	{
+		CComponentPath child(*this);
+		child.Push(childIndex);
+		return child;
+	}
+
+	/// Copy of the first `depth` levels of this path
+	CComponentPath Prefix(int depth) const
+	{
+		CComponentPath prefix;
+		for (int i = 0; i < depth && i < m_depth; i++)
+			prefix.Push(static_cast<int>(m_indices[i]));
+		return prefix;
+	}
+
+	size_t Hash() const { return static_cast<size_t>(m_hash); }
+
+	bool operator==(const CComponentPath& other) const
+	{
+		return m_hash == other.m_hash
+			&& m_depth == other.m_depth
+			&& std::memcmp(m_indices, other.m_indices, sizeof(uint32_t) * m_depth) == 0;
+	}
+
+	bool operator!=(const CComponentPath& other) const { return !(*this == other); }
+
+	/// Dot-separated text form (allocates — persistence and logging only)
+	std::string ToString() const
+	{
+		std::string result;
+		AppendTo(result);
+		return result;
+	}
+
+	/// Append the dot-separated text form without temporary strings
+	void AppendTo(std::string& out) const
+	{
+		for (int i = 0; i < m_depth; i++)
+		{
+			if (i > 0)
+				out += '.';
+
+			char digits[10];
+			int count = 0;
+			uint32_t value = m_indices[i];
+			do
+			{
+				digits[count++] = static_cast<char>('0' + value % 10);
+				value /= 10;
+			} while (value != 0);
+
+			while (count > 0)
+				out += digits[--count];
+		}
+	}
+
+private:
+	/// FNV-1a style step over one 32-bit index
+	static uint64_t Mix(uint64_t hash, uint32_t value)
+	{
+		hash ^= value;
+		hash *= 0x100000001b3ULL;
+		return hash;
+	}
+
+	uint32_t m_indices[MAX_DEPTH] = {};
+	int m_depth = 0;
+	uint64_t m_hash = 0xcbf29ce484222325ULL;
+};
+
+/// Hash functor for CComponentPath in std containers
+struct CComponentPathHash
+{
+	size_t operator()(const CComponentPath& path) const noexcept
+	{
+		return path.Hash();
+	}
+};
@@ -0,0 +1,179 @@
+// ComponentPick.cpp : Component hit tests
+
+#include "stdafx.h"
+#include "ComponentPick.h"
+#include <algorithm>
+#include <cmath>
+
+bool PickBBox(const ON_BoundingBox& bbox, const ON_Line& line, double tolerance, double& parameter)
+{
+	if (!bbox.IsValid())
+		return false;
+
+	// Slab test of the segment against each widened axis interval
+	double enter = 0.0;
+	double leave = 1.0;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		const double start = line.from[axis];
+		const double delta = line.to[axis] - start;
+		const double low = bbox.m_min[axis] - tolerance;
+		const double high = bbox.m_max[axis] + tolerance;
+
+		if (delta == 0.0)
+		{
+			if (start < low || start > high)
+				return false;
+			continue;
+		}
+
+		double t0 = (low - start) / delta;
+		double t1 = (high - start) / delta;
+		if (t0 > t1)
+			std::swap(t0, t1);
+		enter = std::max(enter, t0);
+		leave = std::min(leave, t1);
+		if (enter > leave)
+			return false;
+	}
+
+	parameter = enter;
+	return true;
+}
+
+/// Parameter at which the segment from + s * (to - from), s in [0, 1],
+/// crosses triangle (a, b, c); false if it misses
+static bool PickTriangle(
+	const ON_3dPoint& from,
+	const ON_3dVector& direction,
+	const ON_3dPoint& a,
+	const ON_3dPoint& b,
+	const ON_3dPoint& c,
+	double& parameter)
+{
+	const ON_3dVector edge1 = b - a;
+	const ON_3dVector edge2 = c - a;
+	const ON_3dVector p = ON_CrossProduct(direction, edge2);
+	const double det = ON_DotProduct(edge1, p);
+	if (std::abs(det) < 1.0e-30)
+		return false; // Parallel to the triangle or degenerate
+
+	const double inverse = 1.0 / det;
+	const ON_3dVector s = from - a;
+	const double u = ON_DotProduct(s, p) * inverse;
+	if (u < 0.0 || u > 1.0)
+		return false;
+
+	const ON_3dVector q = ON_CrossProduct(s, edge1);
+	const double v = ON_DotProduct(direction, q) * inverse;
+	if (v < 0.0 || u + v > 1.0)
+		return false;
+
+	const double t = ON_DotProduct(edge2, q) * inverse;
+	if (t < 0.0 || t > 1.0)
+		return false;
+
+	parameter = t;
+	return true;
+}
+
+bool PickGeometry(
+	const CRhinoObject* pComponent,
+	const ON_Xform& componentToWorld,
+	const ON_Line& line,
+	double tolerance,
+	ON_SimpleArray<const ON_Mesh*>& meshes,
+	double& parameter)
+{
+	ON_Xform worldToComponent = componentToWorld;
+	meshes.Empty();
+	if (pComponent->GetMeshes(ON::render_mesh, meshes) <= 0 || !worldToComponent.Invert())
+	{
+		ON_BoundingBox bbox = pComponent->BoundingBox();
+		bbox.Transform(componentToWorld);
+		return PickBBox(bbox, line, tolerance, parameter);
+	}
+
+	// Test in component space: parameters along the line are kept by the transform
+	const ON_3dPoint from = worldToComponent * line.from;
+	const ON_3dVector direction = (worldToComponent * line.to) - from;
+
+	bool hit = false;
+	double nearest = 1.0;
+	for (int m = 0; m < meshes.Count(); m++)
+	{
+		const ON_Mesh* pMesh = meshes[m];
+		if (!pMesh)
+			continue;
+
+		const int vertexCount = pMesh->m_V.Count();
+		for (int f = 0; f < pMesh->m_F.Count(); f++)
+		{
+			const ON_MeshFace& face = pMesh->m_F[f];
+			if (face.vi[0] >= vertexCount || face.vi[1] >= vertexCount
+				|| face.vi[2] >= vertexCount || face.vi[3] >= vertexCount)
+				continue;
+
+			const ON_3dPoint a(pMesh->m_V[face.vi[0]]);
+			const ON_3dPoint c(pMesh->m_V[face.vi[2]]);
+			double t = 0.0;
+			if (PickTriangle(from, direction, a, ON_3dPoint(pMesh->m_V[face.vi[1]]), c, t) && t <= nearest)
+			{
+				nearest = t;
+				hit = true;
+			}
+			if (face.IsQuad() && PickTriangle(from, direction, a, c, ON_3dPoint(pMesh->m_V[face.vi[3]]), t) && t <= nearest)
+			{
+				nearest = t;
+				hit = true;
+			}
+		}
+	}
+
+	if (hit)
+		parameter = nearest;
+	return hit;
+}
+
+static bool FindComponentPath(
+	const CRhinoInstanceDefinition* pDef,
+	const CRhinoObject* pObject,
+	const ON_Xform& xform,
+	const ON_Xform& defToRoot,
+	int depth,
+	CComponentPath& path)
+{
+	const int componentCount = pDef->ObjectCount();
+	for (int i = 0; i < componentCount; i++)
+	{
+		const CRhinoObject* pComponent = pDef->Object(i);
+		if (!pComponent)
+			continue;
+
+		if (pComponent == pObject && defToRoot == xform)
+			return path.Push(i);
+
+		if (pComponent->ObjectType() != ON::instance_reference || depth >= CComponentPath::MAX_NESTING_DEPTH)
+			continue;
+
+		const CRhinoInstanceObject* pNested = static_cast<const CRhinoInstanceObject*>(pComponent);
+		const CRhinoInstanceDefinition* pNestedDef = pNested->InstanceDefinition();
+		if (!pNestedDef || !path.Push(i))
+			continue;
+
+		if (FindComponentPath(pNestedDef, pObject, xform, defToRoot * pNested->InstanceXform(), depth + 1, path))
+			return true;
+		path = path.Prefix(path.Depth() - 1);
+	}
+	return false;
+}
+
+bool FindComponentPath(
+	const CRhinoInstanceDefinition* pDef,
+	const CRhinoObject* pObject,
+	const ON_Xform& xform,
+	CComponentPath& path)
+{
+	path = CComponentPath();
+	return pDef && pObject && FindComponentPath(pDef, pObject, xform, ON_Xform::IdentityTransformation, 0, path);
+}
@@ -0,0 +1,48 @@
+// ComponentPick.h : Hit tests for picking block components along a line
+//
+// Picking walks the same draw lists the conduit draws from, so hidden and
+// suppressed components can never be hit. Each level rejects by bounding box
+// first: the instance, the BVH nodes of its draw list, then the entries.
+// Only entries whose bbox the line crosses have their geometry tested.
+//
+// Hits are ranked by their parameter on the pick line (0 = its start, nearest
+// to the camera for a view's frustum line), which transforms leave unchanged.
+// Surfaces and meshes are hit through their render meshes, exactly. Curves,
+// points, annotations and objects not meshed yet are hit where the line,
+// widened by the tolerance, enters their bbox.
+
+#pragma once
+
+#include "ComponentPath.h"
+
+/// Nearest component hit so far
+struct CComponentPick
+{
+	const CRhinoInstanceObject* pInstance = nullptr;   ///< Top-level instance hit (nullptr = nothing)
+	CComponentPath path;                               ///< Component within pInstance
+	double parameter = 2.0;                            ///< Parameter of the hit on the pick line
+};
+
+/// Parameter of line at which it enters bbox widened by tolerance (0 if it
+/// starts inside). Returns false if it misses bbox or bbox is invalid.
+bool PickBBox(const ON_BoundingBox& bbox, const ON_Line& line, double tolerance, double& parameter);
+
+/// Parameter of the first hit of line on pComponent, drawn with
+/// componentToWorld. meshes is render mesh lookup scratch.
+bool PickGeometry(
+	const CRhinoObject* pComponent,
+	const ON_Xform& componentToWorld,
+	const ON_Line& line,
+	double tolerance,
+	ON_SimpleArray<const ON_Mesh*>& meshes,
+	double& parameter
+);
+
+/// Path of the component of pDef that is drawn as pObject with xform into
+/// pDef space (recursive search, for draw lists built without an index)
+bool FindComponentPath(
+	const CRhinoInstanceDefinition* pDef,
+	const CRhinoObject* pObject,
+	const ON_Xform& xform,
+	CComponentPath& path
+);
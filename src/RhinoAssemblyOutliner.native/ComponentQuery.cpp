@@ -0,0 +1,79 @@
+// ComponentQuery.cpp : Attribute and layer queries over block components
+
+#include "stdafx.h"
+#include "ComponentQuery.h"
+
+CComponentQuery::CComponentQuery(const RAO_COMPONENT_QUERY& query)
+	: m_layerIndex(query.layerIndex)
+	, m_objectTypes(query.objectTypes)
+	, m_name(query.name)
+	, m_userKey(query.userKey)
+	, m_userValue(query.userValue)
+	, m_hasName(query.name && query.name[0])
+	, m_hasUserKey(query.userKey && query.userKey[0])
+	, m_hasUserValue(query.userValue != nullptr)
+{
+}
+
+bool CComponentQuery::Matches(const CRhinoObject& component) const
+{
+	const ON_3dmObjectAttributes& attrs = component.Attributes();
+
+	if (m_layerIndex >= 0 && attrs.m_layer_index != m_layerIndex)
+		return false;
+
+	if (m_objectTypes != 0 && (static_cast<uint32_t>(component.ObjectType()) & m_objectTypes) == 0)
+		return false;
+
+	if (m_hasName && !attrs.m_name.WildCardMatchNoCase(m_name))
+		return false;
+
+	if (m_hasUserKey)
+	{
+		ON_wString value;
+		if (!attrs.GetUserString(m_userKey, value))
+			return false;
+		if (m_hasUserValue && !value.WildCardMatchNoCase(m_userValue))
+			return false;
+	}
+	return true;
+}
+
+void CComponentQuery::Collect(const CRhinoInstanceDefinition* pDef, std::vector<CComponentPath>& outPaths) const
+{
+	Collect(pDef, CComponentPath(), 0, outPaths);
+}
+
+void CComponentQuery::Collect(
+	const CRhinoInstanceDefinition* pDef,
+	const CComponentPath& parent,
+	int depth,
+	std::vector<CComponentPath>& outPaths) const
+{
+	if (!pDef)
+		return;
+
+	const int componentCount = pDef->ObjectCount();
+	for (int i = 0; i < componentCount; i++)
+	{
+		const CRhinoObject* pComponent = pDef->Object(i);
+		if (!pComponent)
+			continue;
+
+		CComponentPath path = parent;
+		if (!path.Push(i))
+			continue;
+
+		if (Matches(*pComponent))
+		{
+			outPaths.push_back(path);
+			continue;
+		}
+
+		if (pComponent->ObjectType() == ON::instance_reference && depth < CComponentPath::MAX_NESTING_DEPTH)
+		{
+			const CRhinoInstanceObject* pNested = static_cast<const CRhinoInstanceObject*>(pComponent);
+			Collect(pNested->InstanceDefinition(), path, depth + 1, outPaths);
+		}
+	}
+}
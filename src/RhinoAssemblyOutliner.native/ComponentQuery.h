@@ -0,0 +1,47 @@
+// ComponentQuery.h : Attribute and layer queries over block components
+//
+// A query (RAO_COMPONENT_QUERY) tests the attributes of every component of a
+// definition tree: layer, object type, name and user text. The tree is walked
+// the way draw lists are built, through the definitions of nested blocks up
+// to CComponentPath::MAX_NESTING_DEPTH.
+//
+// A nested block that matches is reported as one path and not entered. A
+// state set on it already covers its contents. Matches depend only on the
+// definition, so callers collect them once per definition and reuse them for
+// all of its instances.
+
+#pragma once
+
+#include "ComponentPath.h"
+#include "NativeApi.h"
+#include <vector>
+
+class CComponentQuery
+{
+public:
+	/// Copy the criteria of query (its strings need not outlive the call)
+	explicit CComponentQuery(const RAO_COMPONENT_QUERY& query);
+
+	/// Whether one component meets every criterion that is set
+	bool Matches(const CRhinoObject& component) const;
+
+	/// Append the paths of the matching components of pDef, in definition order
+	void Collect(const CRhinoInstanceDefinition* pDef, std::vector<CComponentPath>& outPaths) const;
+
+private:
+	void Collect(
+		const CRhinoInstanceDefinition* pDef,
+		const CComponentPath& parent,
+		int depth,
+		std::vector<CComponentPath>& outPaths
+	) const;
+
+	int m_layerIndex;
+	uint32_t m_objectTypes;
+	ON_wString m_name;
+	ON_wString m_userKey;
+	ON_wString m_userValue;
+	bool m_hasName;
+	bool m_hasUserKey;
+	bool m_hasUserValue;
+};
@@ -0,0 +1,133 @@
+// ConduitStats.h : Low-overhead performance counters for the visibility conduit
+//
+// Counters are relaxed std::atomic increments made by the drawing thread and
+// read by GetConduitStats from any thread without locks. Timings are
+// accumulated in QueryPerformanceCounter ticks and converted to nanoseconds
+// only when read. No formatting or output happens on the hot path.
+
+#pragma once
+
+#include "NativeApi.h"
+#include <atomic>
+#include <cstdint>
+
+class CConduitStats
+{
+public:
+	typedef std::atomic<uint64_t> Counter;
+
+	CConduitStats() = default;
+
+	CConduitStats(const CConduitStats&) = delete;
+	CConduitStats& operator=(const CConduitStats&) = delete;
+
+	static void Add(Counter& counter, uint64_t value = 1)
+	{
+		counter.fetch_add(value, std::memory_order_relaxed);
+	}
+
+	/// Raise maxNestingDepth to depth if it is deeper
+	void NoteDepth(int depth)
+	{
+		int current = maxNestingDepth.load(std::memory_order_relaxed);
+		while (depth > current
+			&& !maxNestingDepth.compare_exchange_weak(current, depth, std::memory_order_relaxed))
+		{
+		}
+	}
+
+	/// Copy all counters into the exported struct (timings in nanoseconds)
+	void Read(RAO_CONDUIT_STATS& out) const
+	{
+		LARGE_INTEGER frequency;
+		::QueryPerformanceFrequency(&frequency);
+		const double nsPerTick = frequency.QuadPart > 0 ? 1.0e9 / static_cast<double>(frequency.QuadPart) : 0.0;
+
+		out.structSize = static_cast<int32_t>(sizeof(RAO_CONDUIT_STATS));
+		out.maxNestingDepth = maxNestingDepth.load(std::memory_order_relaxed);
+		out.frames = frames.load(std::memory_order_relaxed);
+		out.snapshotRefreshes = snapshotRefreshes.load(std::memory_order_relaxed);
+		out.snapshotNs = static_cast<uint64_t>(snapshotTicks.load(std::memory_order_relaxed) * nsPerTick);
+		out.drawNs = static_cast<uint64_t>(drawTicks.load(std::memory_order_relaxed) * nsPerTick);
+		out.bboxNs = static_cast<uint64_t>(bboxTicks.load(std::memory_order_relaxed) * nsPerTick);
+		out.transparentNs = static_cast<uint64_t>(transparentTicks.load(std::memory_order_relaxed) * nsPerTick);
+		out.highlightNs = static_cast<uint64_t>(highlightTicks.load(std::memory_order_relaxed) * nsPerTick);
+		out.instancesDrawn = instancesDrawn.load(std::memory_order_relaxed);
+		out.componentsDrawn = componentsDrawn.load(std::memory_order_relaxed);
+		out.componentsSkipped = componentsSkipped.load(std::memory_order_relaxed);
+		out.transparentDrawn = transparentDrawn.load(std::memory_order_relaxed);
+		out.drawListBuilds = drawListBuilds.load(std::memory_order_relaxed);
+		out.drawListHits = drawListHits.load(std::memory_order_relaxed);
+		out.cachedDrawLists = cachedDrawLists.load(std::memory_order_relaxed);
+		out.snapshotBytesPublished = 0;   // filled in by the conduit
+		out.componentsCulled = componentsCulled.load(std::memory_order_relaxed);
+		out.instancesProxied = instancesProxied.load(std::memory_order_relaxed);
+		out.instancesMerged = instancesMerged.load(std::memory_order_relaxed);
+		out.mergedMeshBuilds = mergedMeshBuilds.load(std::memory_order_relaxed);
+		out.redrawsCoalesced = redrawsCoalesced.load(std::memory_order_relaxed);
+		out.viewsRedrawn = viewsRedrawn.load(std::memory_order_relaxed);
+		out.viewsSkipped = viewsSkipped.load(std::memory_order_relaxed);
+	}
+
+	/// Zero all counters (gauges such as cachedDrawLists are kept)
+	void Reset()
+	{
+		Counter* counters[] = {
+			&frames, &snapshotRefreshes, &snapshotTicks, &drawTicks, &bboxTicks,
+			&transparentTicks, &highlightTicks, &instancesDrawn, &componentsDrawn,
+			&componentsSkipped, &transparentDrawn, &drawListBuilds, &drawListHits,
+			&componentsCulled, &instancesProxied, &instancesMerged, &mergedMeshBuilds,
+			&redrawsCoalesced, &viewsRedrawn, &viewsSkipped
+		};
+		for (Counter* counter : counters)
+			counter->store(0, std::memory_order_relaxed);
+		maxNestingDepth.store(0, std::memory_order_relaxed);
+	}
+
+	Counter frames{ 0 };              ///< SC_PREDRAWOBJECTS passes
+	Counter snapshotRefreshes{ 0 };   ///< new snapshot generations picked up
+	Counter snapshotTicks{ 0 };
+	Counter drawTicks{ 0 };           ///< SC_DRAWOBJECT, managed instances only
+	Counter bboxTicks{ 0 };
+	Counter transparentTicks{ 0 };
+	Counter highlightTicks{ 0 };
+	Counter instancesDrawn{ 0 };
+	Counter componentsDrawn{ 0 };     ///< opaque + transparent (after culling)
+	Counter componentsSkipped{ 0 };   ///< hidden or suppressed
+	Counter transparentDrawn{ 0 };
+	Counter drawListBuilds{ 0 };
+	Counter drawListHits{ 0 };
+	Counter cachedDrawLists{ 0 };     ///< gauge: lists in the draw list cache
+	Counter componentsCulled{ 0 };    ///< outside the view frustum
+	Counter instancesProxied{ 0 };    ///< drawn as their LOD proxy
+	Counter instancesMerged{ 0 };     ///< drawn from merged render meshes
+	Counter mergedMeshBuilds{ 0 };
+	Counter redrawsCoalesced{ 0 };    ///< changes made while a redraw was pending
+	Counter viewsRedrawn{ 0 };
+	Counter viewsSkipped{ 0 };        ///< no changed region in their frustum
+	std::atomic<int> maxNestingDepth{ 0 };
+};
+
+/// Adds the elapsed QueryPerformanceCounter ticks of its scope to a counter
+class CStatsTimer
+{
+public:
+	explicit CStatsTimer(CConduitStats::Counter& ticks) : m_ticks(ticks)
+	{
+		::QueryPerformanceCounter(&m_start);
+	}
+
+	~CStatsTimer()
+	{
+		LARGE_INTEGER now;
+		::QueryPerformanceCounter(&now);
+		CConduitStats::Add(m_ticks, static_cast<uint64_t>(now.QuadPart - m_start.QuadPart));
+	}
+
+	CStatsTimer(const CStatsTimer&) = delete;
+	CStatsTimer& operator=(const CStatsTimer&) = delete;
+
+private:
+	CConduitStats::Counter& m_ticks;
+	LARGE_INTEGER m_start;
+};
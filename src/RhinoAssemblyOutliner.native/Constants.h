@@ -3,3 +3,10 @@
 
 /// Document user-string key for persisting visibility state
 static const wchar_t* RAO_DOC_KEY = L"RAO_VisibilityState";
+
+/// Prefix of the base64 binary format stored under RAO_DOC_KEY.
+/// Values without it are the legacy "<uuid>|<path>:<state>" text format.
+static const wchar_t* RAO_DOC_BINARY_PREFIX = L"RAOB:";
+
+/// Id of the RhinoAssemblyOutliner plug-in, owner of the native event watchers
+static const ON_UUID RAO_PLUGIN_ID = { 0x68ee26ac, 0xd516, 0x4f50, { 0x9d, 0xe2, 0x46, 0xd1, 0x05, 0x70, 0x23, 0x23 } };
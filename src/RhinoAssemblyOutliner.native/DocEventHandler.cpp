@@ -1,45 +1,81 @@
 // DocEventHandler.cpp : Document event handler implementation
 // Uses document-level user strings (key: RAO_VisibilityState) for persistence.
-// Delegates serialization to NativeApi's PersistVisibilityState/LoadVisibilityState.
+// Delegates the format to VisibilityPersistence (binary, with legacy text read support).
 
 #include "stdafx.h"
 #include "DocEventHandler.h"
 #include "Constants.h"
+#include "VisibilityPersistence.h"
+#include <algorithm>
 
-// Forward declarations for serialization helpers in NativeApi.cpp
-extern ON_wString SerializeVisibilityState(CVisibilityData& visData);
-extern void DeserializeVisibilityState(const ON_wString& data, CVisibilityData& visData);
-
-CDocEventHandler::CDocEventHandler(CVisibilityData& visData)
-	: m_visData(visData)
+CDocEventHandler::CDocEventHandler(CDocVisibilityRegistry& registry)
+	: m_registry(registry)
 {
 	Register();
 	Enable(TRUE);
 }
 
+CDocVisibility* CDocEventHandler::FindDoc(const CRhinoDoc& doc)
+{
+	return m_registry.Find(doc.RuntimeSerialNumber());
+}
+
+CVisibilityData* CDocEventHandler::FindData(const CRhinoDoc& doc)
+{
+	CDocVisibility* pDoc = FindDoc(doc);
+	return pDoc ? &pDoc->Data() : nullptr;
+}
+
 void CDocEventHandler::OnEndOpenDocument(CRhinoDoc& doc, const wchar_t* filename, BOOL bMerge, BOOL bReference)
 {
 	AFX_MANAGE_STATE(AfxGetStaticModuleState());
 
-	// Read visibility state from document user strings
+	// Read visibility state from document user strings; documents without
+	// any get no state (and no conduit) until it is first set or picked
 	ON_wString serialized;
 	doc.GetUserString(RAO_DOC_KEY, serialized);
-	DeserializeVisibilityState(serialized, m_visData);
+	if (serialized.IsEmpty())
+		return;
+
+	CDocVisibility& docVis = m_registry.Get(doc.RuntimeSerialNumber());
+	DeserializeVisibilityState(serialized, docVis.Data());
+	BindManagedInstances(doc, docVis);
 }
 
 void CDocEventHandler::OnBeginSaveDocument(CRhinoDoc& doc, const wchar_t* filename, BOOL bExportSelected)
 {
 	AFX_MANAGE_STATE(AfxGetStaticModuleState());
 
-	// Serialize visibility state to document user strings
-	ON_wString serialized = SerializeVisibilityState(m_visData);
+	// Serialize visibility state to document user strings (an empty string
+	// removes stale state of a document that no longer has any)
+	CVisibilityData* pData = FindData(doc);
+	ON_wString serialized = pData ? SerializeVisibilityState(*pData) : ON_wString();
 	doc.SetUserString(RAO_DOC_KEY, serialized);
 }
 
 void CDocEventHandler::OnCloseDocument(CRhinoDoc& doc)
 {
 	AFX_MANAGE_STATE(AfxGetStaticModuleState());
-	m_visData.ClearAll();
+
+	// Drops the document's conduit with its cached draw lists, which point
+	// into its definitions; other documents keep their state
+	m_registry.Remove(doc.RuntimeSerialNumber());
+}
+
+void CDocEventHandler::OnAddObject(CRhinoDoc& doc, CRhinoObject& object)
+{
+	AFX_MANAGE_STATE(AfxGetStaticModuleState());
+
+	// Second half of a replace (e.g. a transform): same UUID as the deleted object
+	if (object.ObjectType() != ON::instance_reference)
+		return;
+
+	CDocVisibility* pDocVis = FindDoc(doc);
+	if (pDocVis && pDocVis->Data().ReattachInstance(object.Attributes().m_uuid))
+	{
+		const CRhinoInstanceObject* pInstance = static_cast<const CRhinoInstanceObject*>(&object);
+		pDocVis->BindInstances(&pInstance, 1);
+	}
 }
 
 void CDocEventHandler::OnDeleteObject(CRhinoDoc& doc, CRhinoObject& object)
@@ -49,9 +85,259 @@ void CDocEventHandler::OnDeleteObject(CRhinoDoc& doc, CRhinoObject& object)
 	if (object.ObjectType() != ON::instance_reference)
 		return;
 
+	// Keep the state for undo and for the add that completes a replace
 	const ON_UUID instanceId = object.Attributes().m_uuid;
-	if (m_visData.IsManaged(instanceId))
+	CVisibilityData* pData = FindData(doc);
+	if (pData && pData->IsManaged(instanceId))
+	{
+		const CRhinoInstanceDefinition* pDef = static_cast<const CRhinoInstanceObject&>(object).InstanceDefinition();
+		pData->DetachInstance(instanceId, pDef ? pDef->Id() : ON_nil_uuid, object.RuntimeSerialNumber());
+		if (pData->PruneDetachedDue())
+			PruneDetached(doc, *pData);
+	}
+}
+
+void CDocEventHandler::OnUnDeleteObject(CRhinoDoc& doc, CRhinoObject& object)
+{
+	AFX_MANAGE_STATE(AfxGetStaticModuleState());
+
+	if (object.ObjectType() != ON::instance_reference)
+		return;
+
+	CDocVisibility* pDocVis = FindDoc(doc);
+	if (pDocVis && pDocVis->Data().ReattachInstance(object.Attributes().m_uuid))
+	{
+		const CRhinoInstanceObject* pInstance = static_cast<const CRhinoInstanceObject*>(&object);
+		pDocVis->BindInstances(&pInstance, 1);
+	}
+}
+
+void CDocEventHandler::OnReplaceObject(CRhinoDoc& doc, CRhinoObject& old_object, CRhinoObject& new_object)
+{
+	AFX_MANAGE_STATE(AfxGetStaticModuleState());
+
+	// Rhino follows this with OnDeleteObject(old) and OnAddObject(new), which
+	// carry the state over. It is only dropped here if the paths no longer
+	// address the same components (the replacement is not an instance of the
+	// same definition).
+	if (old_object.ObjectType() != ON::instance_reference)
+		return;
+
+	const ON_UUID instanceId = old_object.Attributes().m_uuid;
+	CVisibilityData* pData = FindData(doc);
+	if (!pData || !pData->IsManaged(instanceId))
+		return;
+
+	const CRhinoInstanceDefinition* pOldDef =
+		static_cast<const CRhinoInstanceObject&>(old_object).InstanceDefinition();
+	const CRhinoInstanceDefinition* pNewDef = new_object.ObjectType() == ON::instance_reference
+		? static_cast<const CRhinoInstanceObject&>(new_object).InstanceDefinition()
+		: nullptr;
+
+	if (!pOldDef || !pNewDef || ON_UuidCompare(pOldDef->Id(), pNewDef->Id()) != 0)
+		pData->ResetInstance(instanceId);
+}
+
+void CDocEventHandler::OnInstanceDefinitionTableEvent(
+	CRhinoEventWatcher::idef_event event,
+	const CRhinoInstanceDefinitionTable& idef_table,
+	int idef_index,
+	const ON_InstanceDefinition* old_settings)
+{
+	AFX_MANAGE_STATE(AfxGetStaticModuleState());
+
+	// Reordering the table changes no geometry
+	if (event == CRhinoEventWatcher::idef_sorted)
+		return;
+
+	CDocVisibility* pDocVis = FindDoc(idef_table.Document());
+	if (!pDocVis)
+		return;
+	CVisibilityData* pData = &pDocVis->Data();
+
+	const int definitionCount = idef_table.InstanceDefinitionCount();
+	const CRhinoInstanceDefinition* pChanged =
+		(idef_index >= 0 && idef_index < definitionCount) ? idef_table[idef_index] : nullptr;
+	if (!pChanged)
+	{
+		pData->NotifyDefinitionsChanged();
+		return;
+	}
+
+	// An add/delete/modify may replace component objects that cached draw
+	// lists and bboxes point to: those of the definition itself and of every
+	// definition nesting it at any depth. Other definitions keep their caches.
+	std::vector<ON_UUID> affected;
+	affected.push_back(pChanged->Id());
+	for (int i = 0; i < definitionCount; i++)
+	{
+		const CRhinoInstanceDefinition* pDef = idef_table[i];
+		if (pDef && i != idef_index && pDef->UsesDefinition(idef_index) > 0)
+			affected.push_back(pDef->Id());
+	}
+
+	// Stored paths are indices into the components: remap them to where the
+	// same components are now, together with the cache invalidation
+	CVisibilitySnapshot::InstanceMap remapped;
+	CVisibilitySnapshot::RuleMap remappedRules;
+	if (event == CRhinoEventWatcher::idef_modified)
+	{
+		RemapEditedDefinition(idef_table.Document(), *pDocVis, pChanged, affected, remapped, remappedRules);
+	}
+	else if (event == CRhinoEventWatcher::idef_deleted)
+	{
+		pDocVis->Layouts().Forget(pChanged->Id());
+		if (pData->AcquireSnapshot()->FindDefinitionRules(pChanged->Id()))
+			remappedRules[pChanged->Id()] = CVisibilityTrieNode::Ptr();
+
+		// Deleted instances of it can no longer come back with their paths
+		CVisibilityData::DetachedMap detached;
+		pData->GetDetachedInstances(detached);
+		CVisibilitySnapshot::InstanceMap dropped;
+		for (const auto& pair : detached)
+		{
+			if (ON_UuidCompare(pair.second.definitionId, pChanged->Id()) == 0)
+				dropped[pair.first] = CVisibilityTrieNode::Ptr();
+		}
+		pData->ReplaceDetachedInstances(dropped);
+	}
+
+	pData->ApplyDefinitionEdit(remapped, remappedRules, affected);
+}
+
+void CDocEventHandler::RemapEditedDefinition(
+	const CRhinoDoc& doc,
+	CDocVisibility& docVis,
+	const CRhinoInstanceDefinition* pEdited,
+	const std::vector<ON_UUID>& affected,
+	CVisibilitySnapshot::InstanceMap& remapped,
+	CVisibilitySnapshot::RuleMap& remappedRules)
+{
+	CDefinitionLayouts& layouts = docVis.Layouts();
+	std::vector<int> oldToNew;
+	const bool moved = layouts.IndexMap(pEdited, oldToNew);
+	if (layouts.Find(pEdited->Id()))
+		layouts.Update(pEdited);
+	if (!moved)
+		return;
+
+	CVisibilityData& visData = docVis.Data();
+	std::shared_ptr<const CVisibilitySnapshot> snap = visData.AcquireSnapshot();
+	RemapInstances(doc, snap->Instances(), *snap->m_bindings, pEdited, oldToNew, affected, remapped);
+
+	// Rules are rooted at their own definition
+	for (const ON_UUID& definitionId : affected)
+	{
+		const CVisibilityTrieNode::Ptr* pRules = snap->FindDefinitionRules(definitionId);
+		const CRhinoInstanceDefinition* pRoot = pRules ? FindDefinition(doc, definitionId) : nullptr;
+		CVisibilityTrieNode::Ptr updated;
+		if (pRoot && RemapInstancePaths(*pRules, pRoot, pEdited->Id(), oldToNew, updated))
+			remappedRules[definitionId] = updated;
+	}
+
+	// Saved state tables address the same components
+	std::vector<std::pair<std::wstring, CStateTable>> tables;
+	visData.GetStateTables(tables);
+	for (const auto& table : tables)
+	{
+		CVisibilitySnapshot::InstanceMap remappedTable;
+		RemapInstances(doc, *table.second.instances, *table.second.bindings, pEdited, oldToNew, affected, remappedTable);
+		visData.ReplaceStateTableInstances(table.first, remappedTable);
+	}
+
+	// So do the states of deleted instances, for their undo
+	CVisibilityData::DetachedMap detached;
+	visData.GetDetachedInstances(detached);
+	CVisibilitySnapshot::InstanceMap remappedDetached;
+	for (const auto& pair : detached)
+	{
+		const ON_UUID& definitionId = pair.second.definitionId;
+		if (std::none_of(affected.begin(), affected.end(),
+			[&](const ON_UUID& id) { return ON_UuidCompare(id, definitionId) == 0; }))
+			continue;
+
+		const CRhinoInstanceDefinition* pRoot = FindDefinition(doc, definitionId);
+		CVisibilityTrieNode::Ptr updated;
+		if (!pRoot)
+			remappedDetached[pair.first] = CVisibilityTrieNode::Ptr();
+		else if (RemapInstancePaths(pair.second.root, pRoot, pEdited->Id(), oldToNew, updated))
+			remappedDetached[pair.first] = updated;
+	}
+	visData.ReplaceDetachedInstances(remappedDetached);
+}
+
+void CDocEventHandler::PruneDetached(const CRhinoDoc& doc, CVisibilityData& data)
+{
+	// Objects purged from the undo stack are destroyed: their states can
+	// never be reattached
+	CVisibilityData::DetachedMap detached;
+	data.GetDetachedInstances(detached);
+	CVisibilitySnapshot::InstanceMap dropped;
+	for (const auto& pair : detached)
 	{
-		m_visData.ResetInstance(instanceId);
+		if (!doc.LookupObjectByRuntimeSerialNumber(pair.second.objectSerial))
+			dropped[pair.first] = CVisibilityTrieNode::Ptr();
 	}
+	data.ReplaceDetachedInstances(dropped);
+}
+
+void CDocEventHandler::RemapInstances(
+	const CRhinoDoc& doc,
+	const CVisibilitySnapshot::InstanceMap& instances,
+	const CInstanceBindings& bindings,
+	const CRhinoInstanceDefinition* pEdited,
+	const std::vector<int>& oldToNew,
+	const std::vector<ON_UUID>& affected,
+	CVisibilitySnapshot::InstanceMap& remapped)
+{
+	// Only instances of the affected definitions can have paths through it;
+	// the binding index finds them without visiting other managed instances
+	for (const ON_UUID& definitionId : affected)
+	{
+		auto dit = bindings.definitions.find(definitionId);
+		if (dit == bindings.definitions.end())
+			continue;
+
+		for (const ON_UUID& instanceId : dit->second)
+		{
+			auto it = instances.find(instanceId);
+			const CRhinoObject* pObj = doc.LookupObject(instanceId);
+			if (it == instances.end() || !pObj || pObj->ObjectType() != ON::instance_reference)
+				continue;
+
+			const CRhinoInstanceDefinition* pRoot = static_cast<const CRhinoInstanceObject*>(pObj)->InstanceDefinition();
+			CVisibilityTrieNode::Ptr updated;
+			if (pRoot && RemapInstancePaths(it->second, pRoot, pEdited->Id(), oldToNew, updated))
+				remapped[instanceId] = updated;
+		}
+	}
+}
+
+void CDocEventHandler::BindManagedInstances(CRhinoDoc& doc, CDocVisibility& docVis)
+{
+	std::vector<ON_UUID> ids;
+	docVis.Data().GetManagedInstanceIds(ids);
+
+	std::vector<const CRhinoInstanceObject*> objects;
+	objects.reserve(ids.size());
+	for (const ON_UUID& id : ids)
+	{
+		const CRhinoObject* pObj = doc.LookupObject(id);
+		if (pObj && pObj->ObjectType() == ON::instance_reference)
+			objects.push_back(static_cast<const CRhinoInstanceObject*>(pObj));
+	}
+
+	if (!objects.empty())
+		docVis.BindInstances(objects.data(), objects.size());
+
+	std::shared_ptr<const CVisibilitySnapshot> snap = docVis.Data().AcquireSnapshot();
+	for (const auto& pair : snap->Rules())
+		docVis.Layouts().Capture(FindDefinition(doc, pair.first));
+}
+
+const CRhinoInstanceDefinition* CDocEventHandler::FindDefinition(const CRhinoDoc& doc, const ON_UUID& definitionId)
+{
+	const CRhinoInstanceDefinitionTable& table = doc.m_instance_definition_table;
+	const int index = table.FindInstanceDefinition(definitionId, true);
+	return (index >= 0 && index < table.InstanceDefinitionCount()) ? table[index] : nullptr;
 }
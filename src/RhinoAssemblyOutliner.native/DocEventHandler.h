@@ -1,22 +1,72 @@
 // DocEventHandler.h : CRhinoEventWatcher for document lifecycle events
-// Handles persistence sync on open/save/close and cleanup on object delete.
+// Handles persistence sync on open/save/close, keeps state across delete/undo
+// and replace (transforms), remaps stored paths across definition edits and
+// invalidates cached geometry of changed instance definitions only. Every
+// event acts on the state of the document it was raised for.
 
 #pragma once
 
+#include "DocVisibilityRegistry.h"
 #include "VisibilityData.h"
 
 class CDocEventHandler : public CRhinoEventWatcher
 {
 public:
-	explicit CDocEventHandler(CVisibilityData& visData);
+	explicit CDocEventHandler(CDocVisibilityRegistry& registry);
 	~CDocEventHandler() override = default;
 
 	// CRhinoEventWatcher overrides
 	void OnEndOpenDocument(CRhinoDoc& doc, const wchar_t* filename, BOOL bMerge, BOOL bReference) override;
 	void OnBeginSaveDocument(CRhinoDoc& doc, const wchar_t* filename, BOOL bExportSelected) override;
 	void OnCloseDocument(CRhinoDoc& doc) override;
+	void OnAddObject(CRhinoDoc& doc, CRhinoObject& object) override;
 	void OnDeleteObject(CRhinoDoc& doc, CRhinoObject& object) override;
+	void OnUnDeleteObject(CRhinoDoc& doc, CRhinoObject& object) override;
+	void OnReplaceObject(CRhinoDoc& doc, CRhinoObject& old_object, CRhinoObject& new_object) override;
+	void OnInstanceDefinitionTableEvent(
+		CRhinoEventWatcher::idef_event event,
+		const CRhinoInstanceDefinitionTable& idef_table,
+		int idef_index,
+		const ON_InstanceDefinition* old_settings) override;
+
+	/// Bind every managed instance to its object in doc (after bulk loads)
+	/// and record the layouts of the definitions with rules
+	static void BindManagedInstances(CRhinoDoc& doc, CDocVisibility& docVis);
+
+	/// Definition of doc with the given id, or nullptr
+	static const CRhinoInstanceDefinition* FindDefinition(const CRhinoDoc& doc, const ON_UUID& definitionId);
 
 private:
-	CVisibilityData& m_visData;
+	/// State of doc, or nullptr if it has no managed instances
+	CDocVisibility* FindDoc(const CRhinoDoc& doc);
+	CVisibilityData* FindData(const CRhinoDoc& doc);
+
+	/// Remap the paths of managed instances and definition rules drawn
+	/// through pEdited after its components changed. affected lists pEdited
+	/// and every definition nesting it; instances and rules whose paths
+	/// changed are added to remapped and remappedRules. Saved state tables
+	/// and the states of deleted instances are remapped in place.
+	static void RemapEditedDefinition(
+		const CRhinoDoc& doc,
+		CDocVisibility& docVis,
+		const CRhinoInstanceDefinition* pEdited,
+		const std::vector<ON_UUID>& affected,
+		CVisibilitySnapshot::InstanceMap& remapped,
+		CVisibilitySnapshot::RuleMap& remappedRules);
+
+	/// RemapEditedDefinition for one instance map and its bindings
+	static void RemapInstances(
+		const CRhinoDoc& doc,
+		const CVisibilitySnapshot::InstanceMap& instances,
+		const CInstanceBindings& bindings,
+		const CRhinoInstanceDefinition* pEdited,
+		const std::vector<int>& oldToNew,
+		const std::vector<ON_UUID>& affected,
+		CVisibilitySnapshot::InstanceMap& remapped);
+
+	/// Drop the set-aside states of deleted instances whose objects are gone
+	/// from doc (purged from the undo stack)
+	static void PruneDetached(const CRhinoDoc& doc, CVisibilityData& data);
+
+	CDocVisibilityRegistry& m_registry;
 };
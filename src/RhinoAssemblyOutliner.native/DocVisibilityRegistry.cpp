@@ -0,0 +1,120 @@
+// DocVisibilityRegistry.cpp : Per-document visibility state and conduits
+
+#include "stdafx.h"
+#include "DocVisibilityRegistry.h"
+
+CDocVisibility::CDocVisibility(unsigned int docSerial, CConduitStats& stats, bool debugLogging)
+	: m_docSerial(docSerial)
+	, m_conduit(m_data, stats, docSerial)
+	, m_redraws(m_conduit, stats)
+{
+	m_conduit.SetDebugLogging(debugLogging);
+	m_conduit.Enable(docSerial);
+}
+
+CDocVisibility::~CDocVisibility()
+{
+	m_conduit.Disable();
+}
+
+void CDocVisibility::BindInstances(const CRhinoInstanceObject* const* objects, size_t count)
+{
+	m_data.BindInstances(objects, count);
+
+	// Consecutive instances usually share a definition
+	const CRhinoInstanceDefinition* pPrevious = nullptr;
+	for (size_t i = 0; i < count; i++)
+	{
+		const CRhinoInstanceDefinition* pDef = objects[i] ? objects[i]->InstanceDefinition() : nullptr;
+		if (!pDef || pDef == pPrevious || !m_data.IsManaged(objects[i]->Attributes().m_uuid))
+			continue;
+		m_layouts.Capture(pDef);
+		pPrevious = pDef;
+	}
+}
+
+CDocVisibility* CDocVisibilityRegistry::Find(unsigned int docSerial)
+{
+	auto it = m_docs.find(docSerial);
+	return it != m_docs.end() ? it->second.get() : nullptr;
+}
+
+CDocVisibility& CDocVisibilityRegistry::Get(unsigned int docSerial)
+{
+	std::unique_ptr<CDocVisibility>& pDoc = m_docs[docSerial];
+	if (!pDoc)
+	{
+		pDoc.reset(new CDocVisibility(docSerial, m_stats, m_debugLogging));
+		pDoc->Conduit().SetLodThreshold(m_lodPixels);
+		pDoc->Conduit().SetMergeJobs(m_mergeJobs);
+	}
+	return *pDoc;
+}
+
+void CDocVisibilityRegistry::Remove(unsigned int docSerial)
+{
+	auto it = m_docs.find(docSerial);
+	if (it == m_docs.end())
+		return;
+
+	m_removedBytes += it->second->Data().GetPublishedBytes();
+	m_docs.erase(it);
+}
+
+void CDocVisibilityRegistry::FlushRedraws()
+{
+	for (auto& pair : m_docs)
+	{
+		CRedrawScheduler& redraws = pair.second->Redraws();
+		if (!redraws.IsPending())
+			continue;
+
+		CRhinoDoc* pDoc = CRhinoDoc::FromRuntimeSerialNumber(pair.first);
+		if (pDoc)
+			redraws.Flush(*pDoc);
+	}
+}
+
+void CDocVisibilityRegistry::SetDebugLogging(bool enabled)
+{
+	m_debugLogging = enabled;
+	for (auto& pair : m_docs)
+		pair.second->Conduit().SetDebugLogging(enabled);
+}
+
+void CDocVisibilityRegistry::SetLodThreshold(double pixels)
+{
+	m_lodPixels = pixels;
+	for (auto& pair : m_docs)
+		pair.second->Conduit().SetLodThreshold(pixels);
+}
+
+void CDocVisibilityRegistry::SetMergedMeshes(bool enabled)
+{
+	if (enabled && !m_jobs)
+		m_jobs.reset(new CJobSystem(CJobSystem::DefaultWorkerCount()));
+
+	m_mergeJobs = enabled ? m_jobs.get() : nullptr;
+	for (auto& pair : m_docs)
+		pair.second->Conduit().SetMergeJobs(m_mergeJobs);
+}
+
+void CDocVisibilityRegistry::GetStats(RAO_CONDUIT_STATS& stats) const
+{
+	m_stats.Read(stats);
+	stats.snapshotBytesPublished = PublishedBytes() - m_publishedBytesAtReset;
+}
+
+void CDocVisibilityRegistry::ResetStats()
+{
+	m_stats.Reset();
+	m_publishedBytesAtReset = PublishedBytes();
+}
+
+uint64_t CDocVisibilityRegistry::PublishedBytes() const
+{
+	uint64_t bytes = m_removedBytes;
+	for (const auto& pair : m_docs)
+		bytes += pair.second->Data().GetPublishedBytes();
+	return bytes;
+}
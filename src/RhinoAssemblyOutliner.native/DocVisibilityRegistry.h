@@ -0,0 +1,107 @@
+// DocVisibilityRegistry.h : Visibility state partitioned per document
+//
+// Every document with managed instances gets its own CVisibilityData (and so
+// its own published snapshots) and its own conduit, enabled for that
+// document's runtime serial number only. A conduit's snapshot, draw lists and
+// bbox caches are shared by all viewports of its document: the first viewport
+// drawn after a change picks up the new snapshot, the others see an unchanged
+// generation and reuse it. Closing a document drops only its own entry.
+//
+// All conduits count into one CConduitStats owned by the registry and share
+// its CJobSystem, started when merged meshes are first turned on.
+//
+// Each document also records the component layouts of the definitions its
+// managed instances are drawn through (PathRemap.h), and the redraws its
+// state changes are waiting for (RedrawScheduler.h).
+//
+// The registry is only used from the UI thread (exports, document events).
+
+#pragma once
+
+#include "ConduitStats.h"
+#include "JobSystem.h"
+#include "PathRemap.h"
+#include "RedrawScheduler.h"
+#include "VisibilityConduit.h"
+#include "VisibilityData.h"
+#include <memory>
+#include <unordered_map>
+
+/// Visibility state and conduit of one document
+class CDocVisibility
+{
+public:
+	CDocVisibility(unsigned int docSerial, CConduitStats& stats, bool debugLogging);
+	~CDocVisibility();
+
+	CDocVisibility(const CDocVisibility&) = delete;
+	CDocVisibility& operator=(const CDocVisibility&) = delete;
+
+	unsigned int DocSerial() const { return m_docSerial; }
+	CVisibilityData& Data() { return m_data; }
+	CVisibilityConduit& Conduit() { return m_conduit; }
+	CDefinitionLayouts& Layouts() { return m_layouts; }
+	CRedrawScheduler& Redraws() { return m_redraws; }
+
+	/// Bind managed instances to their objects and record the layouts of the
+	/// definitions they are drawn through, for remapping after edits
+	void BindInstances(const CRhinoInstanceObject* const* objects, size_t count);
+
+private:
+	unsigned int m_docSerial;
+	CVisibilityData m_data;           ///< Declared before the conduit, which references it
+	CVisibilityConduit m_conduit;
+	CDefinitionLayouts m_layouts;
+	CRedrawScheduler m_redraws;       ///< Declared after the conduit, which it measures with
+};
+
+class CDocVisibilityRegistry
+{
+public:
+	CDocVisibilityRegistry() = default;
+
+	CDocVisibilityRegistry(const CDocVisibilityRegistry&) = delete;
+	CDocVisibilityRegistry& operator=(const CDocVisibilityRegistry&) = delete;
+
+	/// State of a document, or nullptr if it has none yet
+	CDocVisibility* Find(unsigned int docSerial);
+
+	/// State of a document, created (with its conduit enabled) on first use
+	CDocVisibility& Get(unsigned int docSerial);
+
+	/// Drop the state and conduit of a closed document
+	void Remove(unsigned int docSerial);
+
+	/// Make the pending redraws of every open document
+	void FlushRedraws();
+
+	/// Debug logging of all current and future conduits
+	void SetDebugLogging(bool enabled);
+
+	/// LOD proxy threshold of all current and future conduits (0 = off)
+	void SetLodThreshold(double pixels);
+	double GetLodThreshold() const { return m_lodPixels; }
+
+	/// Merged mesh drawing of all current and future conduits
+	void SetMergedMeshes(bool enabled);
+	bool GetMergedMeshes() const { return m_mergeJobs != nullptr; }
+
+	/// Performance counters summed over all documents
+	void GetStats(RAO_CONDUIT_STATS& stats) const;
+
+	/// Zero the performance counters
+	void ResetStats();
+
+private:
+	/// Bytes published by all documents since they were registered
+	uint64_t PublishedBytes() const;
+
+	CConduitStats m_stats;
+	std::unique_ptr<CJobSystem> m_jobs;   ///< Declared before m_docs: joined after the conduits are gone
+	CJobSystem* m_mergeJobs = nullptr;    ///< m_jobs while merged meshes are on
+	std::unordered_map<unsigned int, std::unique_ptr<CDocVisibility>> m_docs;
+	bool m_debugLogging = false;
+	double m_lodPixels = 0.0;
+	uint64_t m_removedBytes = 0;          ///< PublishedBytes() of removed documents
+	uint64_t m_publishedBytesAtReset = 0; ///< PublishedBytes() at last ResetStats
+};
@@ -0,0 +1,830 @@
+// DrawListCache.cpp : Flattened draw list cache implementation
+
+#include "stdafx.h"
+#include "DrawListCache.h"
+#include <algorithm>
+
+// Line segments per span of a curve that is not a polyline
+static const int WIRE_SEGMENTS_PER_SPAN = 16;
+
+// Lists with fewer bounded entries are drawn without culling (Rhino has
+// already culled the instance as a whole)
+static const int BVH_MIN_ENTRIES = 32;
+
+// Maximum entries per BVH leaf
+static const int BVH_LEAF_SIZE = 8;
+
+const CFilteredDrawList* CDrawListCache::Get(
+	const CRhinoInstanceDefinition* pDef,
+	const CVisibilityTrieNode::Ptr& state,
+	bool* pBuilt)
+{
+	if (pBuilt)
+		*pBuilt = false;
+	if (!pDef || !state)
+		return nullptr;
+
+	Key key;
+	key.definitionId = pDef->Id();
+	key.stateHash = state->Hash();
+
+	Bucket& bucket = m_lists[key];
+	for (auto& list : bucket)
+	{
+		if (!CVisibilityTrieNode::Equal(list->m_state.get(), state.get()))
+			continue;
+
+		// Same definition id but a different definition object or component
+		// count means the cache missed an invalidation — rebuild defensively
+		if (list->m_pDefinition != pDef || list->m_objectCount != pDef->ObjectCount())
+		{
+			Build(*list, pDef, state, GetIndex(pDef));
+			if (pBuilt)
+				*pBuilt = true;
+		}
+
+		list->m_lastUsedPass = m_pass;
+		return list.get();
+	}
+
+	bucket.push_back(std::unique_ptr<CFilteredDrawList>(new CFilteredDrawList()));
+	CFilteredDrawList& list = *bucket.back();
+	Build(list, pDef, state, GetIndex(pDef));
+	list.m_lastUsedPass = m_pass;
+	if (pBuilt)
+		*pBuilt = true;
+	return &list;
+}
+
+void CDrawListCache::Prune()
+{
+	for (auto it = m_lists.begin(); it != m_lists.end();)
+	{
+		Bucket& bucket = it->second;
+		bucket.erase(
+			std::remove_if(bucket.begin(), bucket.end(),
+				[this](const std::unique_ptr<CFilteredDrawList>& list) { return list->m_lastUsedPass != m_pass; }),
+			bucket.end());
+
+		if (bucket.empty())
+			it = m_lists.erase(it);
+		else
+			++it;
+	}
+	m_pass++;
+
+	// Indexes only the cache still refers to
+	for (auto it = m_indexes.begin(); it != m_indexes.end();)
+	{
+		if (it->second.use_count() == 1)
+			it = m_indexes.erase(it);
+		else
+			++it;
+	}
+}
+
+std::shared_ptr<const CComponentIndex> CDrawListCache::GetIndex(const CRhinoInstanceDefinition* pDef)
+{
+	if (!pDef)
+		return nullptr;
+
+	// A different definition object or component count under the same id
+	// means a missed invalidation, as in Get
+	std::shared_ptr<const CComponentIndex>& index = m_indexes[pDef->Id()];
+	if (!index || index->Definition() != pDef || index->ObjectCount() != pDef->ObjectCount())
+		index = CComponentIndex::Build(pDef);
+
+	return index->IsComplete() ? index : nullptr;
+}
+
+void CDrawListCache::Invalidate(const std::vector<ON_UUID>& definitionIds)
+{
+	for (auto it = m_lists.begin(); it != m_lists.end();)
+	{
+		const ON_UUID& definitionId = it->first.definitionId;
+		const bool changed = std::any_of(definitionIds.begin(), definitionIds.end(),
+			[&definitionId](const ON_UUID& id) { return ON_UuidCompare(id, definitionId) == 0; });
+
+		if (changed)
+			it = m_lists.erase(it);
+		else
+			++it;
+	}
+
+	for (const ON_UUID& definitionId : definitionIds)
+		m_indexes.erase(definitionId);
+}
+
+void CDrawListCache::Clear()
+{
+	m_lists.clear();
+	m_indexes.clear();
+}
+
+size_t CDrawListCache::Size() const
+{
+	size_t count = 0;
+	for (const auto& pair : m_lists)
+		count += pair.second.size();
+	return count;
+}
+
+void CDrawListCache::Build(
+	CFilteredDrawList& list,
+	const CRhinoInstanceDefinition* pDef,
+	const CVisibilityTrieNode::Ptr& state,
+	const std::shared_ptr<const CComponentIndex>& index)
+{
+	list.m_entries.clear();
+	list.m_wires.reset();
+	list.m_proxy.reset();
+	if (list.m_merge)
+		list.m_merge->Cancel();
+	list.m_merge.reset();
+	list.m_gather.reset();
+	list.m_lastDrawnFrame = 0;
+	list.m_drawnFrames = 0;
+	list.m_skippedCount = 0;
+	list.m_maxDepth = 0;
+	list.m_state = state;
+	list.m_index = index;
+	list.m_pDefinition = pDef;
+	list.m_objectCount = pDef->ObjectCount();
+	if (index)
+		AppendIndexed(*index, state.get(), list);
+	else
+		AppendFiltered(pDef, state.get(), ON_Xform::IdentityTransformation, true, false, 0, list);
+
+	// Entries without a valid bbox go last and are never culled
+	auto unbounded = std::stable_partition(list.m_entries.begin(), list.m_entries.end(),
+		[](const CDrawListEntry& entry) { return entry.bbox.IsValid(); });
+	list.m_boundedCount = static_cast<int>(unbounded - list.m_entries.begin());
+
+	list.m_bvh.clear();
+	if (list.m_boundedCount >= BVH_MIN_ENTRIES)
+	{
+		list.m_bvh.reserve(2 * (list.m_boundedCount / BVH_LEAF_SIZE + 1));
+		BuildBvh(list, 0, list.m_boundedCount);
+	}
+
+	list.m_localBBox.Destroy(); // Start invalid
+	if (index)
+		AccumulateIndexedBBox(*index, state.get(), list.m_localBBox);
+	else
+		AccumulateBBox(pDef, state.get(), ON_Xform::IdentityTransformation, 0, list.m_localBBox);
+}
+
+int CDrawListCache::BuildBvh(CFilteredDrawList& list, int first, int count)
+{
+	const int index = static_cast<int>(list.m_bvh.size());
+	list.m_bvh.push_back(CDrawListBvhNode());
+
+	ON_BoundingBox bbox;
+	bbox.Destroy(); // Start invalid
+	for (int i = first; i < first + count; i++)
+		bbox.Union(list.m_entries[i].bbox);
+
+	int right = -1;
+	if (count > BVH_LEAF_SIZE)
+	{
+		// Split at the median entry center along the longest axis
+		const ON_3dVector extent = bbox.m_max - bbox.m_min;
+		const int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+		const int half = count / 2;
+
+		auto begin = list.m_entries.begin() + first;
+		std::nth_element(begin, begin + half, begin + count,
+			[axis](const CDrawListEntry& a, const CDrawListEntry& b)
+			{
+				return a.bbox.m_min[axis] + a.bbox.m_max[axis] < b.bbox.m_min[axis] + b.bbox.m_max[axis];
+			});
+
+		BuildBvh(list, first, half);
+		right = BuildBvh(list, first + half, count - half);
+	}
+
+	CDrawListBvhNode& node = list.m_bvh[index];
+	node.bbox = bbox;
+	node.first = first;
+	node.count = count;
+	node.right = right;
+	return index;
+}
+
+void CDrawListCache::AppendFiltered(
+	const CRhinoInstanceDefinition* pDef,
+	const CVisibilityTrieNode* pNode,
+	const ON_Xform& xform,
+	bool identity,
+	bool inheritTransparent,
+	int depth,
+	CFilteredDrawList& list)
+{
+	if (depth > list.m_maxDepth)
+		list.m_maxDepth = depth;
+
+	int componentCount = pDef->ObjectCount();
+	for (int i = 0; i < componentCount; i++)
+	{
+		ComponentState state = pNode ? pNode->StateAt(i) : CS_VISIBLE;
+		if (state == CS_SHOWN)
+			state = CS_VISIBLE; // Override of a definition rule the trie was not overlaid on
+
+		// Skip hidden and suppressed components
+		if (state == CS_HIDDEN || state == CS_SUPPRESSED)
+		{
+			list.m_skippedCount++;
+			continue;
+		}
+
+		if (inheritTransparent)
+			state = CS_TRANSPARENT;
+
+		const CRhinoObject* pComponent = pDef->Object(i);
+		if (!pComponent || !pComponent->IsVisible())
+			continue;
+
+		if (pComponent->ObjectType() == ON::instance_reference)
+		{
+			// Nested block with hidden descendants — flatten its visible parts.
+			// Transparent blocks are flattened too, so the transparent pass only
+			// sees leaf geometry. Anything else is drawn whole (below).
+			const CVisibilityTrieNode* pChild = pNode ? pNode->ChildAt(i) : nullptr;
+			if (pChild || state == CS_TRANSPARENT)
+			{
+				if (depth >= CComponentPath::MAX_NESTING_DEPTH)
+					continue;
+
+				const CRhinoInstanceObject* pNested =
+					static_cast<const CRhinoInstanceObject*>(pComponent);
+				const CRhinoInstanceDefinition* pNestedDef = pNested->InstanceDefinition();
+				if (!pNestedDef)
+					continue;
+
+				AppendFiltered(pNestedDef, pChild, xform * pNested->InstanceXform(), false,
+					state == CS_TRANSPARENT, depth + 1, list);
+				continue;
+			}
+		}
+
+		CDrawListEntry entry;
+		entry.pObject = pComponent;
+		entry.xform = xform;
+		entry.identity = identity;
+		entry.state = state;
+		entry.bbox = pComponent->BoundingBox();
+		if (!identity)
+			entry.bbox.Transform(xform);
+		entry.row = -1;
+		list.m_entries.push_back(entry);
+	}
+}
+
+/// Trie node and inherited transparency of one nesting level of a scan
+struct CScanLevel
+{
+	const CVisibilityTrieNode* pNode;   ///< States below this level, may be null
+	bool transparent;                    ///< Inside a transparent nested block
+};
+
+void CDrawListCache::AppendIndexed(const CComponentIndex& index, const CVisibilityTrieNode* pRoot, CFilteredDrawList& list)
+{
+	// A row at depth d is only reached after the block above it set levels[d]
+	CScanLevel levels[CComponentPath::MAX_DEPTH];
+	levels[0] = { pRoot, false };
+
+	const int rowCount = index.RowCount();
+	int next = 0;
+	for (int row = 0; row < rowCount; row = next)
+	{
+		next = index.SubtreeEnd(row);
+		const int depth = index.Depth(row);
+		const CScanLevel& level = levels[depth];
+
+		ComponentState state = level.pNode ? level.pNode->StateAt(index.Index(row)) : CS_VISIBLE;
+		if (state == CS_SHOWN)
+			state = CS_VISIBLE; // Override of a definition rule the trie was not overlaid on
+
+		// Skip hidden and suppressed components with everything below them
+		if (state == CS_HIDDEN || state == CS_SUPPRESSED)
+		{
+			list.m_skippedCount++;
+			continue;
+		}
+
+		if (level.transparent)
+			state = CS_TRANSPARENT;
+
+		const uint8_t flags = index.Flags(row);
+		if (!(flags & CComponentIndex::ROW_VISIBLE))
+			continue;
+
+		if (flags & CComponentIndex::ROW_INSTANCE)
+		{
+			// Same rule as AppendFiltered: flatten nested blocks with hidden
+			// descendants and transparent ones, draw the rest whole
+			const CVisibilityTrieNode* pChild = level.pNode ? level.pNode->ChildAt(index.Index(row)) : nullptr;
+			if (pChild || state == CS_TRANSPARENT)
+			{
+				if (!(flags & CComponentIndex::ROW_EXPANDED))
+					continue;
+
+				levels[depth + 1] = { pChild, state == CS_TRANSPARENT };
+				if (depth + 1 > list.m_maxDepth)
+					list.m_maxDepth = depth + 1;
+				next = row + 1;
+				continue;
+			}
+		}
+
+		CDrawListEntry entry;
+		entry.pObject = index.Object(row);
+		entry.xform = index.Xform(row);
+		entry.identity = index.Identity(row);
+		entry.state = state;
+		entry.bbox = index.BBox(row);
+		entry.row = row;
+		list.m_entries.push_back(entry);
+	}
+}
+
+void CDrawListCache::AccumulateIndexedBBox(const CComponentIndex& index, const CVisibilityTrieNode* pRoot, ON_BoundingBox& bbox)
+{
+	// Only blocks with a child node are entered, so every level has a node
+	const CVisibilityTrieNode* levels[CComponentPath::MAX_DEPTH];
+	levels[0] = pRoot;
+
+	const int rowCount = index.RowCount();
+	int next = 0;
+	for (int row = 0; row < rowCount; row = next)
+	{
+		next = index.SubtreeEnd(row);
+		const int depth = index.Depth(row);
+		const CVisibilityTrieNode* pNode = levels[depth];
+
+		// Suppressed components are excluded from bbox entirely
+		// Hidden components still contribute (they're just visually hidden)
+		if (pNode->StateAt(index.Index(row)) == CS_SUPPRESSED)
+			continue;
+
+		const uint8_t flags = index.Flags(row);
+		if (!(flags & CComponentIndex::ROW_VISIBLE))
+			continue;
+
+		if (flags & CComponentIndex::ROW_INSTANCE)
+		{
+			// Enter nested blocks to exclude suppressed descendants
+			if (const CVisibilityTrieNode* pChild = pNode->ChildAt(index.Index(row)))
+			{
+				if (flags & CComponentIndex::ROW_EXPANDED)
+				{
+					levels[depth + 1] = pChild;
+					next = row + 1;
+				}
+				continue;
+			}
+		}
+
+		bbox.Union(index.BBox(row));
+	}
+}
+
+void CDrawListCache::AccumulateBBox(
+	const CRhinoInstanceDefinition* pDef,
+	const CVisibilityTrieNode* pNode,
+	const ON_Xform& xform,
+	int depth,
+	ON_BoundingBox& bbox)
+{
+	int componentCount = pDef->ObjectCount();
+	for (int i = 0; i < componentCount; i++)
+	{
+		ComponentState state = pNode->StateAt(i);
+
+		// Suppressed components are excluded from bbox entirely
+		// Hidden components still contribute (they're just visually hidden)
+		if (state == CS_SUPPRESSED)
+			continue;
+
+		const CRhinoObject* pComp = pDef->Object(i);
+		if (!pComp || !pComp->IsVisible())
+			continue;
+
+		if (pComp->ObjectType() == ON::instance_reference)
+		{
+			// Recurse for nested blocks to exclude suppressed descendants
+			if (const CVisibilityTrieNode* pChild = pNode->ChildAt(i))
+			{
+				if (depth >= CComponentPath::MAX_NESTING_DEPTH)
+					continue;
+
+				const CRhinoInstanceObject* pNested =
+					static_cast<const CRhinoInstanceObject*>(pComp);
+				const CRhinoInstanceDefinition* pNestedDef = pNested->InstanceDefinition();
+				if (!pNestedDef)
+					continue;
+
+				AccumulateBBox(pNestedDef, pChild, xform * pNested->InstanceXform(), depth + 1, bbox);
+				continue;
+			}
+		}
+
+		ON_BoundingBox compBBox = pComp->BoundingBox();
+		compBBox.Transform(xform);
+		bbox.Union(compBBox);
+	}
+}
+
+/// Append curve as line segments transformed by xform
+static void TessellateCurve(const ON_Curve& curve, const ON_Xform& xform, ON_SimpleArray<ON_Line>& lines)
+{
+	ON_SimpleArray<ON_3dPoint> points;
+	if (curve.IsPolyline(&points) < 2)
+	{
+		const int spanCount = curve.SpanCount();
+		if (spanCount <= 0)
+			return;
+
+		ON_SimpleArray<double> spans(spanCount + 1);
+		spans.SetCount(spanCount + 1);
+		if (!curve.GetSpanVector(spans.Array()))
+			return;
+
+		points.Empty();
+		points.Reserve(spanCount * WIRE_SEGMENTS_PER_SPAN + 1);
+		for (int span = 0; span < spanCount; span++)
+		{
+			for (int k = 0; k < WIRE_SEGMENTS_PER_SPAN; k++)
+			{
+				const double s = static_cast<double>(k) / WIRE_SEGMENTS_PER_SPAN;
+				points.Append(curve.PointAt((1.0 - s) * spans[span] + s * spans[span + 1]));
+			}
+		}
+		points.Append(curve.PointAt(spans[spanCount]));
+	}
+
+	for (int i = 0; i + 1 < points.Count(); i++)
+		lines.Append(ON_Line(xform * points[i], xform * points[i + 1]));
+}
+
+/// Append the wireframe curves of one leaf component, or queue it for a
+/// full redraw if it has none
+static void AppendCurveWires(
+	const CRhinoObject* pObject,
+	const ON_Xform& xform,
+	bool identity,
+	const CDrawListEntry& entry,
+	CSelectionWires& wires)
+{
+	ON_SimpleArray<ON_Curve*> curves;
+	if (pObject->GetWireframeCurves(curves) <= 0)
+	{
+		// Meshes, points, annotations: highlighted by a full redraw
+		CDrawListEntry fallback = entry;
+		fallback.pObject = pObject;
+		fallback.xform = xform;
+		fallback.identity = identity;
+		wires.fallback.push_back(fallback);
+		return;
+	}
+
+	for (int i = 0; i < curves.Count(); i++)
+	{
+		if (curves[i])
+			TessellateCurve(*curves[i], xform, wires.lines);
+		delete curves[i];
+	}
+}
+
+/// Append the wireframe of one component. Block instances are expanded
+/// (all of their components are visible: filtered ones were flattened).
+static void AppendWires(
+	const CRhinoObject* pObject,
+	const ON_Xform& xform,
+	const CDrawListEntry& entry,
+	int depth,
+	CSelectionWires& wires)
+{
+	if (pObject->ObjectType() == ON::instance_reference)
+	{
+		if (depth >= CComponentPath::MAX_NESTING_DEPTH)
+			return;
+
+		const CRhinoInstanceObject* pNested = static_cast<const CRhinoInstanceObject*>(pObject);
+		const CRhinoInstanceDefinition* pNestedDef = pNested->InstanceDefinition();
+		if (!pNestedDef)
+			return;
+
+		const ON_Xform nestedXform = xform * pNested->InstanceXform();
+		for (int i = 0; i < pNestedDef->ObjectCount(); i++)
+		{
+			const CRhinoObject* pComponent = pNestedDef->Object(i);
+			if (pComponent && pComponent->IsVisible())
+				AppendWires(pComponent, nestedXform, entry, depth + 1, wires);
+		}
+		return;
+	}
+
+	AppendCurveWires(pObject, xform, (depth == 0) && entry.identity, entry, wires);
+}
+
+/// AppendWires over the index rows of an entry and its subtree
+static void AppendIndexedWires(const CComponentIndex& index, const CDrawListEntry& entry, CSelectionWires& wires)
+{
+	const int end = index.SubtreeEnd(entry.row);
+	int next = entry.row;
+	for (int row = entry.row; row < end; row = next)
+	{
+		next = index.SubtreeEnd(row);
+		const uint8_t flags = index.Flags(row);
+		if (!(flags & CComponentIndex::ROW_VISIBLE))
+			continue;
+
+		if (flags & CComponentIndex::ROW_INSTANCE)
+		{
+			if (flags & CComponentIndex::ROW_EXPANDED)
+				next = row + 1;
+			continue;
+		}
+
+		AppendCurveWires(index.Object(row), index.Xform(row), index.Identity(row), entry, wires);
+	}
+}
+
+const CSelectionWires& CFilteredDrawList::SelectionWires() const
+{
+	if (!m_wires)
+	{
+		m_wires.reset(new CSelectionWires());
+		for (const CDrawListEntry& entry : m_entries)
+		{
+			if (m_index && entry.row >= 0)
+				AppendIndexedWires(*m_index, entry, *m_wires);
+			else
+				AppendWires(entry.pObject, entry.xform, entry, 0, *m_wires);
+		}
+	}
+	return *m_wires;
+}
+
+// Box corner c is (x, y, z) = (c & 1, c & 2, c & 4) of min/max; faces are
+// wound counter-clockwise seen from outside
+static const int BOX_FACES[6][4] = {
+	{ 0, 2, 3, 1 }, { 4, 5, 7, 6 },   // -z, +z
+	{ 0, 1, 5, 4 }, { 2, 6, 7, 3 },   // -y, +y
+	{ 0, 4, 6, 2 }, { 1, 3, 7, 5 }    // -x, +x
+};
+
+static ON_3dPoint BoxCorner(const ON_BoundingBox& bbox, int corner)
+{
+	return bbox.Corner(corner & 1, (corner >> 1) & 1, (corner >> 2) & 1);
+}
+
+const CLodProxy& CFilteredDrawList::LodProxy() const
+{
+	if (!m_proxy)
+	{
+		m_proxy.reset(new CLodProxy());
+		CLodProxy& proxy = *m_proxy;
+		for (int i = 0; i < m_boundedCount; i++)
+			proxy.bbox.Union(m_entries[i].bbox);
+		if (!proxy.bbox.IsValid())
+			return proxy;
+
+		// Separate vertices per face keep the shading flat
+		for (int f = 0; f < 6; f++)
+		{
+			for (int k = 0; k < 4; k++)
+				proxy.mesh.SetVertex(4 * f + k, BoxCorner(proxy.bbox, BOX_FACES[f][k]));
+			proxy.mesh.SetQuad(f, 4 * f, 4 * f + 1, 4 * f + 2, 4 * f + 3);
+		}
+		proxy.mesh.ComputeVertexNormals();
+
+		for (int corner = 0; corner < 8; corner++)
+		{
+			for (int axis = 1; axis < 8; axis <<= 1)
+			{
+				if (!(corner & axis))
+					proxy.edges.Append(ON_Line(BoxCorner(proxy.bbox, corner), BoxCorner(proxy.bbox, corner | axis)));
+			}
+		}
+	}
+	return *m_proxy;
+}
+
+int CFilteredDrawList::NoteDrawnFrame(uint64_t frame) const
+{
+	if (frame != m_lastDrawnFrame)
+	{
+		m_lastDrawnFrame = frame;
+		m_drawnFrames++;
+	}
+	return m_drawnFrames;
+}
+
+bool SameDisplayMaterial(const CRhinoObject* a, const CRhinoObject* b)
+{
+	const ON_3dmObjectAttributes& attrsA = a->Attributes();
+	const ON_3dmObjectAttributes& attrsB = b->Attributes();
+	if (attrsA.ColorSource() != attrsB.ColorSource() || attrsA.MaterialSource() != attrsB.MaterialSource())
+		return false;
+
+	// By-parent sources resolve to the instance both are drawn in
+	if (attrsA.ColorSource() == ON::color_from_object && attrsA.m_color != attrsB.m_color)
+		return false;
+	if (attrsA.MaterialSource() == ON::material_from_object && attrsA.m_material_index != attrsB.m_material_index)
+		return false;
+	if ((attrsA.ColorSource() == ON::color_from_layer || attrsA.MaterialSource() == ON::material_from_layer)
+		&& attrsA.m_layer_index != attrsB.m_layer_index)
+		return false;
+	return true;
+}
+
+CFilteredDrawList::~CFilteredDrawList()
+{
+	// A merge still queued or running is no longer wanted
+	if (m_merge)
+		m_merge->Cancel();
+}
+
+const CMergedMesh* CFilteredDrawList::MergedMesh() const
+{
+	if (!m_merge)
+		return nullptr;
+	return std::atomic_load_explicit(&m_merge->result, std::memory_order_acquire).get();
+}
+
+/// Render mesh copy to merge into a color group
+struct CMergeMeshInput
+{
+	size_t group;
+	std::unique_ptr<ON_Mesh> mesh;   ///< Copy of a component render mesh
+	ON_Xform xform;
+	bool identity;
+};
+
+/// Wireframe curve or brep edge to tessellate into a material group
+struct CMergeWireInput
+{
+	size_t group;
+	std::unique_ptr<ON_Curve> curve;  ///< Copy owned by the job
+	ON_Xform xform;
+	bool edge;                        ///< A brep edge (CMergedMeshGroup::edges), else a wireframe curve
+};
+
+struct CMergeGather
+{
+	std::unique_ptr<CMergedMesh> merged{ new CMergedMesh() };
+	std::vector<CMergeMeshInput> inputs;
+	std::vector<CMergeWireInput> wires;
+	int nextEntry = 0;                 ///< First entry not looked at yet
+};
+
+/// Merges render mesh copies and wireframe curves into their material
+/// groups on a worker thread
+class CMergeMeshJob : public CJob
+{
+public:
+	typedef CMergeMeshInput Input;
+
+	CMergeMeshJob(std::shared_ptr<CMergedMeshSlot> slot, std::unique_ptr<CMergedMesh> merged,
+		std::vector<Input> inputs, std::vector<CMergeWireInput> wires)
+		: CJob(slot)
+		, m_slot(std::move(slot))
+		, m_merged(std::move(merged))
+		, m_inputs(std::move(inputs))
+		, m_wires(std::move(wires))
+	{
+	}
+
+	void Run() override
+	{
+		for (Input& input : m_inputs)
+		{
+			if (IsCancelled())
+				return;
+			if (!input.identity)
+				input.mesh->Transform(input.xform);
+			m_merged->groups[input.group].mesh->Append(*input.mesh);
+			input.mesh.reset();
+		}
+
+		for (CMergeWireInput& wire : m_wires)
+		{
+			if (IsCancelled())
+				return;
+			CMergedMeshGroup& group = m_merged->groups[wire.group];
+			TessellateCurve(*wire.curve, wire.xform, wire.edge ? group.edges : group.wires);
+			wire.curve.reset();
+		}
+
+		std::shared_ptr<const CMergedMesh> result(std::move(m_merged));
+		std::atomic_store_explicit(&m_slot->result, result, std::memory_order_release);
+	}
+
+private:
+	std::shared_ptr<CMergedMeshSlot> m_slot;
+	std::unique_ptr<CMergedMesh> m_merged;
+	std::vector<Input> m_inputs;
+	std::vector<CMergeWireInput> m_wires;
+};
+
+/// Append copies of the edge curves of a brep or extrusion
+static void AppendBrepEdges(const ON_Geometry* pGeometry, ON_SimpleArray<ON_Curve*>& curves)
+{
+	const ON_Brep* pBrep = ON_Brep::Cast(pGeometry);
+	std::unique_ptr<ON_Brep> extrusionBrep;
+	if (!pBrep)
+	{
+		const ON_Extrusion* pExtrusion = ON_Extrusion::Cast(pGeometry);
+		if (!pExtrusion)
+			return;
+		extrusionBrep.reset(pExtrusion->BrepForm());
+		pBrep = extrusionBrep.get();
+		if (!pBrep)
+			return;
+	}
+
+	for (int i = 0; i < pBrep->m_E.Count(); i++)
+		curves.Append(pBrep->m_E[i].DuplicateCurve());
+}
+
+bool CFilteredDrawList::RequestMerge(CJobSystem& jobs, JobPriority priority, int vertexBudget) const
+{
+	if (m_merge)
+		return true;
+	if (!m_gather)
+		m_gather.reset(new CMergeGather());
+
+	CMergedMesh* merged = m_gather->merged.get();
+	std::vector<CMergeMeshInput>& inputs = m_gather->inputs;
+	const int entryCount = static_cast<int>(m_entries.size());
+
+	// Copying is the drawing thread's share of the work: bounded per frame
+	int copied = 0;
+	ON_SimpleArray<const ON_Mesh*> meshes;
+	for (; m_gather->nextEntry < entryCount && (copied == 0 || copied < vertexBudget); m_gather->nextEntry++)
+	{
+		const int i = m_gather->nextEntry;
+		const CDrawListEntry& entry = m_entries[i];
+
+		// Transparent entries go through the sorted transparent pass; nested
+		// blocks drawn whole have no render mesh of their own
+		meshes.Empty();
+		if (entry.state != CS_VISIBLE || entry.pObject->ObjectType() == ON::instance_reference
+			|| entry.pObject->GetMeshes(ON::render_mesh, meshes) <= 0)
+		{
+			merged->unmerged.push_back(i);
+			continue;
+		}
+
+		size_t group = 0;
+		while (group < merged->groups.size() && !SameDisplayMaterial(merged->groups[group].pMaterialSource, entry.pObject))
+			group++;
+		if (group == merged->groups.size())
+		{
+			merged->groups.push_back(CMergedMeshGroup());
+			merged->groups.back().pMaterialSource = entry.pObject;
+			merged->groups.back().mesh.reset(new ON_Mesh());
+		}
+
+		// The job must not touch document objects: it gets its own copies
+		for (int m = 0; m < meshes.Count(); m++)
+		{
+			if (!meshes[m])
+				continue;
+			CMergeMeshInput input;
+			input.group = group;
+			input.mesh.reset(new ON_Mesh(*meshes[m]));
+			input.xform = entry.xform;
+			input.identity = entry.identity;
+			inputs.push_back(std::move(input));
+			copied += meshes[m]->VertexCount();
+		}
+
+		// Shaded meshes alone lose the edges and isocurves the mode draws:
+		// the full wireframe, and the edges for modes without isocurves
+		ON_SimpleArray<ON_Curve*> curves;
+		entry.pObject->GetWireframeCurves(curves);
+		const int wireCount = curves.Count();
+		AppendBrepEdges(entry.pObject->Geometry(), curves);
+		for (int c = 0; c < curves.Count(); c++)
+		{
+			if (!curves[c])
+				continue;
+			CMergeWireInput wire;
+			wire.group = group;
+			wire.curve.reset(curves[c]);
+			wire.xform = entry.xform;
+			wire.edge = c >= wireCount;
+			m_gather->wires.push_back(std::move(wire));
+		}
+	}
+	if (m_gather->nextEntry < entryCount)
+		return false;
+
+	m_merge = std::make_shared<CMergedMeshSlot>();
+	jobs.Submit(std::unique_ptr<CJob>(new CMergeMeshJob(m_merge, std::move(m_gather->merged), std::move(inputs), std::move(m_gather->wires))), priority);
+	m_gather.reset();
+	return true;
+}
@@ -0,0 +1,307 @@
+// DrawListCache.h : Flattened draw lists per (definition, visibility state)
+//
+// Instances that share a definition and an identical set of component states
+// draw exactly the same components. Instead of walking the definition tree
+// alongside the state trie every frame, the walk is done once and its result
+// (component, transform into definition space, state) is cached. Drawing an
+// instance replays the list with only the instance transform applied.
+//
+// Lists are keyed by (definition UUID, trie structural hash); a hit is
+// confirmed with a structural trie comparison, so a hash collision can never
+// draw the wrong components. Lists hold raw pointers into definition
+// geometry: Invalidate() (or Clear()) must be called whenever instance
+// definitions change.
+//
+// Each list also carries the definition-space bounding box of the
+// non-suppressed components (hidden ones still count), shared by every
+// instance with the same definition and states, and — built on first use —
+// the tessellated wireframe of its components for selection highlights and
+// a box proxy for instances too small on screen to draw component by component.
+// Lists drawn for a while can also merge their components' render meshes,
+// one mesh per display color, so an instance draws with a few mesh calls.
+// The meshes are copied on the drawing thread, a bounded number of vertices
+// per frame so large lists spread the copy over several frames, and merged by
+// a CJobSystem worker; the list picks the result up atomically once it is
+// published.
+//
+// Lists are built by linear scans over the definition's CComponentIndex,
+// built once per definition and shared by all of its lists; subtrees the
+// states hide, or that are drawn whole, are skipped in one jump. Definitions
+// too large to index are walked recursively instead.
+//
+// Lists with many entries carry a bounding volume hierarchy over the entry
+// bounding boxes (definition space). Entries are reordered so every BVH node
+// covers a contiguous entry range, which lets the conduit cull whole groups of
+// components — including nested sub-blocks — against the view frustum.
+//
+// Owned by the conduit and only used from the drawing thread — no locking.
+
+#pragma once
+
+#include "ComponentIndex.h"
+#include "JobSystem.h"
+#include "VisibilityData.h"
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+/// One drawable component of a flattened definition
+struct CDrawListEntry
+{
+	const CRhinoObject* pObject;  ///< Leaf component, or an opaque nested block without hidden descendants
+	ON_Xform xform;               ///< Component -> top-level definition space (nested instance xforms)
+	bool identity;                ///< xform is the identity (top-level component)
+	ComponentState state;         ///< CS_VISIBLE or CS_TRANSPARENT
+	ON_BoundingBox bbox;          ///< Component bbox in top-level definition space
+	int row;                      ///< Row of pObject in the list's component index, -1 without one
+};
+
+/// Node of a draw list BVH. Children of an inner node cover halves of its
+/// entry range; the left child directly follows its parent.
+struct CDrawListBvhNode
+{
+	ON_BoundingBox bbox;          ///< Union of the entry bboxes in definition space
+	int first;                    ///< First entry covered
+	int count;                    ///< Number of entries covered
+	int right;                    ///< Index of the right child, -1 for a leaf
+};
+
+/// Selection highlight wireframe of a draw list, in definition space
+struct CSelectionWires
+{
+	ON_SimpleArray<ON_Line> lines;          ///< Tessellated wireframe curves of all entries
+	std::vector<CDrawListEntry> fallback;   ///< Components without wireframe curves (redrawn whole)
+};
+
+/// Level-of-detail proxy of a draw list: the box around its drawn
+/// components, in definition space
+struct CLodProxy
+{
+	ON_BoundingBox bbox;              ///< Union of the entry bboxes (invalid if none)
+	ON_Mesh mesh;                     ///< bbox as a flat-shaded box (6 quads)
+	ON_SimpleArray<ON_Line> edges;    ///< The 12 bbox edges
+};
+
+/// Whether two components of the same definition are always drawn with
+/// the same display material and color in any instance (same sources, and
+/// the same color, material or layer where a source uses it)
+bool SameDisplayMaterial(const CRhinoObject* a, const CRhinoObject* b);
+
+/// Render meshes of one display material merged in definition space
+struct CMergedMeshGroup
+{
+	const CRhinoObject* pMaterialSource;   ///< Component whose attributes give the group material and color
+	std::unique_ptr<ON_Mesh> mesh;
+	ON_SimpleArray<ON_Line> wires;         ///< Tessellated wireframe curves (edges and isocurves)
+	ON_SimpleArray<ON_Line> edges;         ///< Tessellated brep edges only
+};
+
+/// Render meshes of a draw list merged per display material
+struct CMergedMesh
+{
+	std::vector<CMergedMeshGroup> groups;
+	std::vector<int> unmerged;          ///< Entries still drawn one by one (transparent, nested blocks, no render mesh)
+};
+
+/// Result slot shared by a draw list and its merge job. Cancelled when the
+/// list is dropped; the job publishes result with atomic_store.
+struct CMergedMeshSlot : public CJobToken
+{
+	std::shared_ptr<const CMergedMesh> result;
+};
+
+/// Render mesh copies of a merge not queued yet (RequestMerge)
+struct CMergeGather;
+
+/// Draw list of one definition filtered by one visibility state
+class CFilteredDrawList
+{
+public:
+	CFilteredDrawList() = default;
+	~CFilteredDrawList();
+
+	CFilteredDrawList(const CFilteredDrawList&) = delete;
+	CFilteredDrawList& operator=(const CFilteredDrawList&) = delete;
+
+	const std::vector<CDrawListEntry>& Entries() const { return m_entries; }
+
+	/// Component index the entries' rows refer to (nullptr if the list was
+	/// built without one)
+	const CComponentIndex* Index() const { return m_index.get(); }
+
+	/// Bounding box of all non-suppressed components in definition space
+	/// (invalid if there are none)
+	const ON_BoundingBox& LocalBBox() const { return m_localBBox; }
+
+	/// Hidden or suppressed components left out while flattening
+	int SkippedCount() const { return m_skippedCount; }
+
+	/// Deepest nested block level flattened (0 = top-level components only)
+	int MaxDepth() const { return m_maxDepth; }
+
+	/// BVH over entries [0, BoundedCount()); empty if the list is too small
+	/// to be worth culling. Node 0 is the root.
+	const std::vector<CDrawListBvhNode>& Bvh() const { return m_bvh; }
+
+	/// Entries with a valid bbox come first; the rest can never be culled
+	int BoundedCount() const { return m_boundedCount; }
+
+	/// Wireframe of the entries (nested blocks drawn whole are expanded),
+	/// tessellated on the first call
+	const CSelectionWires& SelectionWires() const;
+
+	/// Box proxy of the drawn entries, built on the first call
+	const CLodProxy& LodProxy() const;
+
+	/// Count a frame the list was drawn in. Returns the number of distinct
+	/// frames it was drawn in since it was built.
+	int NoteDrawnFrame(uint64_t frame) const;
+
+	/// Merged render meshes, or nullptr until the merge job published them
+	const CMergedMesh* MergedMesh() const;
+
+	/// Whether the merge job was queued (it may still be running)
+	bool MergeRequested() const { return m_merge != nullptr; }
+
+	/// Copy the render meshes and wireframe curves of the next visible
+	/// entries, about vertexBudget vertices (at least one entry), continuing
+	/// where the last call stopped. Once every entry is copied, queue
+	/// merging them per display material on jobs and return true.
+	bool RequestMerge(CJobSystem& jobs, JobPriority priority, int vertexBudget) const;
+
+private:
+	friend class CDrawListCache;
+
+	std::vector<CDrawListEntry> m_entries;
+	std::vector<CDrawListBvhNode> m_bvh;
+	int m_boundedCount = 0;
+	ON_BoundingBox m_localBBox;
+	int m_skippedCount = 0;
+	int m_maxDepth = 0;
+	CVisibilityTrieNode::Ptr m_state;                          ///< Trie the list was built from
+	std::shared_ptr<const CComponentIndex> m_index;            ///< Index it was built from (null if the definition has none)
+	const CRhinoInstanceDefinition* m_pDefinition = nullptr;   ///< Definition the list was built from
+	int m_objectCount = 0;                                     ///< pDefinition->ObjectCount() at build time
+	uint64_t m_lastUsedPass = 0;
+	mutable std::unique_ptr<CSelectionWires> m_wires;          ///< Built by SelectionWires()
+	mutable std::unique_ptr<CLodProxy> m_proxy;                ///< Built by LodProxy()
+	mutable std::unique_ptr<CMergeGather> m_gather;            ///< Copies made so far by RequestMerge()
+	mutable std::shared_ptr<CMergedMeshSlot> m_merge;          ///< Set once RequestMerge() queued the job
+	mutable uint64_t m_lastDrawnFrame = 0;
+	mutable int m_drawnFrames = 0;
+};
+
+class CDrawListCache
+{
+public:
+	CDrawListCache() = default;
+
+	CDrawListCache(const CDrawListCache&) = delete;
+	CDrawListCache& operator=(const CDrawListCache&) = delete;
+
+	/// Draw list for pDef filtered by state, built on first use.
+	/// Returns nullptr if pDef or state is null. *pBuilt (optional) is set
+	/// to whether the list had to be built.
+	const CFilteredDrawList* Get(
+		const CRhinoInstanceDefinition* pDef,
+		const CVisibilityTrieNode::Ptr& state,
+		bool* pBuilt = nullptr
+	);
+
+	/// Flattened component index of pDef, built on first use. Returns
+	/// nullptr if pDef is null or its tree is too large to flatten.
+	const CComponentIndex* Index(const CRhinoInstanceDefinition* pDef) { return GetIndex(pDef).get(); }
+
+	/// Drop lists that were not used since the previous Prune, and the
+	/// indexes no remaining list was built from.
+	/// Called when a new visibility generation is picked up.
+	void Prune();
+
+	/// Drop the lists and indexes of the given definitions (they were edited, added or
+	/// deleted). Lists of other definitions stay valid as long as
+	/// definitionIds includes every definition that nests a changed one.
+	void Invalidate(const std::vector<ON_UUID>& definitionIds);
+
+	/// Drop all lists and indexes (instance definitions changed or document closed)
+	void Clear();
+
+	/// Number of cached lists
+	size_t Size() const;
+
+private:
+	struct Key
+	{
+		ON_UUID definitionId;
+		uint64_t stateHash;
+	};
+
+	struct KeyHash
+	{
+		size_t operator()(const Key& key) const noexcept
+		{
+			return ON_UUID_Hash()(key.definitionId) ^ static_cast<size_t>(key.stateHash * 0x9e3779b97f4a7c15ULL);
+		}
+	};
+
+	struct KeyEqual
+	{
+		bool operator()(const Key& a, const Key& b) const noexcept
+		{
+			return a.stateHash == b.stateHash && ON_UuidCompare(a.definitionId, b.definitionId) == 0;
+		}
+	};
+
+	/// Lists sharing a key (distinct states whose hashes collide)
+	typedef std::vector<std::unique_ptr<CFilteredDrawList>> Bucket;
+
+	/// Complete index of pDef, built on first use (null if it has none)
+	std::shared_ptr<const CComponentIndex> GetIndex(const CRhinoInstanceDefinition* pDef);
+
+	/// Flatten the visible components of the indexed definition in one scan,
+	/// entering nested blocks that have hidden descendants or are transparent
+	static void AppendIndexed(const CComponentIndex& index, const CVisibilityTrieNode* pRoot, CFilteredDrawList& list);
+
+	/// Union the bounding boxes of the non-suppressed rows of index, entering
+	/// nested blocks that have non-visible descendants
+	static void AccumulateIndexedBBox(const CComponentIndex& index, const CVisibilityTrieNode* pRoot, ON_BoundingBox& bbox);
+
+	/// Flatten the visible components of pDef, recursing into nested blocks
+	/// that have hidden descendants or are transparent. pNode may be null
+	/// (no states below this level); inheritTransparent marks every visible
+	/// component transparent (inside a transparent nested block).
+	static void AppendFiltered(
+		const CRhinoInstanceDefinition* pDef,
+		const CVisibilityTrieNode* pNode,
+		const ON_Xform& xform,
+		bool identity,
+		bool inheritTransparent,
+		int depth,
+		CFilteredDrawList& list
+	);
+
+	/// Union the bounding boxes of the non-suppressed components of pDef,
+	/// recursing into nested blocks that have non-visible descendants
+	static void AccumulateBBox(
+		const CRhinoInstanceDefinition* pDef,
+		const CVisibilityTrieNode* pNode,
+		const ON_Xform& xform,
+		int depth,
+		ON_BoundingBox& bbox
+	);
+
+	/// Reorder entries [first, first + count) into BVH order and append
+	/// their subtree to list.m_bvh. Returns the index of the subtree root.
+	static int BuildBvh(CFilteredDrawList& list, int first, int count);
+
+	/// Build list from index if it has one, else by walking pDef
+	static void Build(
+		CFilteredDrawList& list,
+		const CRhinoInstanceDefinition* pDef,
+		const CVisibilityTrieNode::Ptr& state,
+		const std::shared_ptr<const CComponentIndex>& index
+	);
+
+	std::unordered_map<Key, Bucket, KeyHash, KeyEqual> m_lists;
+	std::unordered_map<ON_UUID, std::shared_ptr<const CComponentIndex>, ON_UUID_Hash, ON_UUID_Equal> m_indexes;
+	uint64_t m_pass = 1;
+};
@@ -0,0 +1,113 @@
+// InstanceTree.cpp : Flat instance hierarchy export
+
+#include "stdafx.h"
+#include "InstanceTree.h"
+
+static const CRhinoInstanceDefinition* NestedDefinition(const CRhinoObject* pObject)
+{
+	if (!pObject || pObject->ObjectType() != ON::instance_reference)
+		return nullptr;
+	return static_cast<const CRhinoInstanceObject*>(pObject)->InstanceDefinition();
+}
+
+CInstanceTreeWriter::CInstanceTreeWriter(RAO_TREE_NODE* buffer, int capacity, std::shared_ptr<const CVisibilitySnapshot> snapshot)
+	: m_buffer(buffer)
+	, m_capacity(buffer ? capacity : 0)
+	, m_snapshot(std::move(snapshot))
+{
+}
+
+int CInstanceTreeWriter::Append(
+	int parent,
+	const CRhinoObject* pObject,
+	int componentIndex,
+	int depth,
+	ComponentState state)
+{
+	const int index = m_count++;
+	if (index >= m_capacity)
+		return index;
+
+	const CRhinoInstanceDefinition* pDef = NestedDefinition(pObject);
+	RAO_TREE_NODE& node = m_buffer[index];
+	node.parent = parent;
+	node.definitionIndex = pDef ? pDef->Index() : -1;
+	node.componentIndex = componentIndex;
+	node.depth = depth;
+	node.objectId = pObject ? pObject->Attributes().m_uuid : ON_nil_uuid;
+	node.state = state == CS_SHOWN ? CS_VISIBLE : state;
+	node.childCount = pDef ? pDef->ObjectCount() : 0;
+	node.objectType = pObject ? static_cast<uint32_t>(pObject->ObjectType()) : 0;
+	return index;
+}
+
+void CInstanceTreeWriter::AppendComponents(
+	const CRhinoInstanceDefinition* pDef,
+	int parent,
+	const CVisibilityTrieNode* pNode,
+	int depth,
+	int maxDepth)
+{
+	const int componentCount = pDef->ObjectCount();
+	for (int i = 0; i < componentCount; i++)
+	{
+		const CRhinoObject* pComponent = pDef->Object(i);
+		const int index = Append(parent, pComponent, i, depth, pNode ? pNode->StateAt(i) : CS_VISIBLE);
+
+		const CRhinoInstanceDefinition* pNestedDef = NestedDefinition(pComponent);
+		if (!pNestedDef || depth >= maxDepth)
+			continue;
+
+		AppendComponents(pNestedDef, index, pNode ? pNode->ChildAt(i) : nullptr, depth + 1, maxDepth);
+	}
+}
+
+CVisibilityTrieNode::Ptr CInstanceTreeWriter::EffectiveTrie(
+	const CRhinoInstanceObject* pInstance,
+	const CRhinoInstanceDefinition* pDef) const
+{
+	if (!m_snapshot)
+		return nullptr;
+
+	return m_snapshot->GetEffectiveTrie(pInstance->Attributes().m_uuid, pDef->Id());
+}
+
+void CInstanceTreeWriter::AppendInstance(const CRhinoInstanceObject* pInstance, int maxDepth)
+{
+	const int index = Append(-1, pInstance, -1, 0, CS_VISIBLE);
+
+	const CRhinoInstanceDefinition* pDef = pInstance->InstanceDefinition();
+	if (!pDef || maxDepth == 0)
+		return;
+
+	const CVisibilityTrieNode::Ptr trie = EffectiveTrie(pInstance, pDef);
+	const bool unlimited = maxDepth < 0 || maxDepth > CComponentPath::MAX_DEPTH;
+	AppendComponents(pDef, index, trie.get(), 1, unlimited ? CComponentPath::MAX_DEPTH : maxDepth);
+}
+
+bool CInstanceTreeWriter::AppendChildren(const CRhinoInstanceObject* pInstance, const CComponentPath& path)
+{
+	// Children must still be addressable by a path
+	const CRhinoInstanceDefinition* pDef = pInstance->InstanceDefinition();
+	if (!pDef || path.Depth() >= CComponentPath::MAX_DEPTH)
+		return false;
+
+	// Follow the path through the definitions and the trie together
+	const CVisibilityTrieNode::Ptr trie = EffectiveTrie(pInstance, pDef);
+	const CVisibilityTrieNode* pNode = trie.get();
+	for (int level = 0; level < path.Depth(); level++)
+	{
+		const int index = path.At(level);
+		if (index >= pDef->ObjectCount())
+			return false;
+
+		pDef = NestedDefinition(pDef->Object(index));
+		if (!pDef)
+			return false;
+		pNode = pNode ? pNode->ChildAt(index) : nullptr;
+	}
+
+	// One level only: the children's own children are not entered
+	AppendComponents(pDef, -1, pNode, path.Depth() + 1, path.Depth() + 1);
+	return true;
+}
@@ -0,0 +1,70 @@
+// InstanceTree.h : Flat export of a document's block instance hierarchy
+//
+// The outliner panel's tree is the document's top-level block instances and,
+// below each one, the components of its definition, nested blocks expanded.
+// CInstanceTreeWriter walks that hierarchy once and fills a caller-provided
+// RAO_TREE_NODE array in depth-first preorder. A record refers to its parent
+// by index within the same buffer, so the panel maps the array as is without
+// one call per node.
+//
+// States are those each component is drawn with in its top-level instance:
+// the instance's own states over the rules of its definition. The trie is
+// walked alongside the definition tree, one array read per component.
+//
+// Records past the buffer capacity are counted but not written, so the caller
+// can size the buffer from a first call. AppendChildren serves the lazy mode,
+// one level below an already exported node.
+
+#pragma once
+
+#include "NativeApi.h"
+#include "VisibilityData.h"
+#include <memory>
+
+class CInstanceTreeWriter
+{
+public:
+	/// Write into buffer (capacity records, buffer may be null if 0), with
+	/// states from snapshot (null = all visible)
+	CInstanceTreeWriter(RAO_TREE_NODE* buffer, int capacity, std::shared_ptr<const CVisibilitySnapshot> snapshot);
+
+	/// Append a top-level instance and its components down to maxDepth levels
+	/// below it (-1 = all, up to CComponentPath::MAX_DEPTH)
+	void AppendInstance(const CRhinoInstanceObject* pInstance, int maxDepth);
+
+	/// Append the components directly below the node at path of pInstance
+	/// (its definition's components for an empty path), with parent -1.
+	/// Returns false if path does not address a block.
+	bool AppendChildren(const CRhinoInstanceObject* pInstance, const CComponentPath& path);
+
+	/// Records appended, including those past capacity
+	int Count() const { return m_count; }
+
+private:
+	/// Write record m_count (if it fits) and return its index
+	int Append(
+		int parent,
+		const CRhinoObject* pObject,
+		int componentIndex,
+		int depth,
+		ComponentState state
+	);
+
+	/// Append the components of pDef below record parent, recursing while
+	/// depth < maxDepth. pNode holds their states (may be null).
+	void AppendComponents(
+		const CRhinoInstanceDefinition* pDef,
+		int parent,
+		const CVisibilityTrieNode* pNode,
+		int depth,
+		int maxDepth
+	);
+
+	/// The trie pInstance is drawn with (its states over its definition's rules)
+	CVisibilityTrieNode::Ptr EffectiveTrie(const CRhinoInstanceObject* pInstance, const CRhinoInstanceDefinition* pDef) const;
+
+	RAO_TREE_NODE* m_buffer;
+	int m_capacity;
+	int m_count = 0;
+	std::shared_ptr<const CVisibilitySnapshot> m_snapshot;
+};
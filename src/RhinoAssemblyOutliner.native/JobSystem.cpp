@@ -0,0 +1,100 @@
+// JobSystem.cpp : Worker pool implementation
+
+#include "stdafx.h"
+#include "JobSystem.h"
+
+// Derived caches are a side path: a couple of workers keep the machine
+// responsive while still taking merges off the drawing thread
+static const int MAX_WORKERS = 2;
+
+CJobSystem::CJobSystem(int workerCount)
+{
+	::InitializeCriticalSection(&m_cs);
+	::InitializeConditionVariable(&m_wake);
+
+	if (workerCount < 1)
+		workerCount = 1;
+	m_workers.reserve(static_cast<size_t>(workerCount));
+	for (int i = 0; i < workerCount; i++)
+		m_workers.emplace_back(&CJobSystem::WorkerLoop, this);
+}
+
+CJobSystem::~CJobSystem()
+{
+	{
+		CAutoLock lock(m_cs);
+		m_stopping = true;
+		for (auto& queue : m_queues)
+			queue.clear();
+	}
+	::WakeAllConditionVariable(&m_wake);
+
+	for (std::thread& worker : m_workers)
+		worker.join();
+
+	::DeleteCriticalSection(&m_cs);
+}
+
+void CJobSystem::Submit(std::unique_ptr<CJob> job, JobPriority priority)
+{
+	if (!job || priority < 0 || priority >= JOB_PRIORITY_COUNT)
+		return;
+
+	{
+		CAutoLock lock(m_cs);
+		if (m_stopping)
+			return;
+		m_queues[priority].push_back(std::move(job));
+	}
+	::WakeConditionVariable(&m_wake);
+}
+
+size_t CJobSystem::PendingCount() const
+{
+	CAutoLock lock(m_cs);
+	size_t count = 0;
+	for (const auto& queue : m_queues)
+		count += queue.size();
+	return count;
+}
+
+int CJobSystem::DefaultWorkerCount()
+{
+	const int cores = static_cast<int>(std::thread::hardware_concurrency());
+	const int workers = cores - 1;
+	return workers < 1 ? 1 : (workers > MAX_WORKERS ? MAX_WORKERS : workers);
+}
+
+bool CJobSystem::PopJob(std::unique_ptr<CJob>& job)
+{
+	CAutoLock lock(m_cs);
+	for (;;)
+	{
+		if (m_stopping)
+			return false;
+
+		for (auto& queue : m_queues)
+		{
+			while (!queue.empty())
+			{
+				job = std::move(queue.front());
+				queue.pop_front();
+				if (!job->IsCancelled())
+					return true;
+				job.reset();
+			}
+		}
+
+		::SleepConditionVariableCS(&m_wake, &m_cs, INFINITE);
+	}
+}
+
+void CJobSystem::WorkerLoop()
+{
+	std::unique_ptr<CJob> job;
+	while (PopJob(job))
+	{
+		job->Run();
+		job.reset();
+	}
+}
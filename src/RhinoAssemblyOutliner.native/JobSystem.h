@@ -0,0 +1,99 @@
+// JobSystem.h : Small worker pool for derived cache computation
+//
+// Jobs run on a few worker threads and only touch data they own or immutable
+// shared data: per ADR-005, Rhino documents and objects are never accessed
+// off the thread that draws. Whatever a job needs from the document is
+// copied when it is queued; its result is published atomically to a slot the
+// conduit polls while drawing.
+//
+// Two priorities: jobs for the active viewport run before background jobs.
+// A job is cancelled through its token when its result is no longer wanted
+// (e.g. the draw list it belongs to was dropped because the state changed
+// again). Queued cancelled jobs are discarded without running; running ones
+// stop at their next IsCancelled() check.
+
+#pragma once
+
+#include "VisibilityData.h"
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <vector>
+
+enum JobPriority
+{
+	JOB_PRIORITY_VISIBLE = 0,     ///< Needed by the active viewport
+	JOB_PRIORITY_BACKGROUND = 1,  ///< Other viewports, prewarming
+	JOB_PRIORITY_COUNT = 2
+};
+
+/// Cancellation flag shared by a job and the owner of its result
+class CJobToken
+{
+public:
+	CJobToken() = default;
+
+	CJobToken(const CJobToken&) = delete;
+	CJobToken& operator=(const CJobToken&) = delete;
+
+	void Cancel() { m_cancelled.store(true, std::memory_order_relaxed); }
+	bool IsCancelled() const { return m_cancelled.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<bool> m_cancelled{ false };
+};
+
+/// Unit of work. Run() is called once on a worker thread unless the job is
+/// cancelled before it starts.
+class CJob
+{
+public:
+	explicit CJob(std::shared_ptr<const CJobToken> token) : m_token(std::move(token)) {}
+	virtual ~CJob() = default;
+
+	CJob(const CJob&) = delete;
+	CJob& operator=(const CJob&) = delete;
+
+	virtual void Run() = 0;
+
+	bool IsCancelled() const { return m_token->IsCancelled(); }
+
+private:
+	std::shared_ptr<const CJobToken> m_token;
+};
+
+class CJobSystem
+{
+public:
+	/// Start workerCount worker threads (at least one)
+	explicit CJobSystem(int workerCount);
+
+	/// Discard queued jobs, let running ones finish and join the workers
+	~CJobSystem();
+
+	CJobSystem(const CJobSystem&) = delete;
+	CJobSystem& operator=(const CJobSystem&) = delete;
+
+	/// Queue a job behind others of the same priority
+	void Submit(std::unique_ptr<CJob> job, JobPriority priority);
+
+	/// Jobs queued but not started
+	size_t PendingCount() const;
+
+	/// Workers for this machine: one core is left to the UI thread
+	static int DefaultWorkerCount();
+
+private:
+	/// Wait for the next job that is not cancelled, highest priority first.
+	/// Returns false when stopping.
+	bool PopJob(std::unique_ptr<CJob>& job);
+
+	void WorkerLoop();
+
+	mutable CRITICAL_SECTION m_cs;
+	CONDITION_VARIABLE m_wake;
+	std::deque<std::unique_ptr<CJob>> m_queues[JOB_PRIORITY_COUNT];  ///< guarded by m_cs
+	bool m_stopping = false;                                         ///< guarded by m_cs
+	std::vector<std::thread> m_workers;
+};
@@ -2,35 +2,72 @@
 
 #include "stdafx.h"
 #include "NativeApi.h"
-#include "VisibilityConduit.h"
+#include "DocVisibilityRegistry.h"
 #include "DocEventHandler.h"
 #include "Constants.h"
 #include "AssemblyUserData.h"
+#include "ComponentQuery.h"
+#include "InstanceTree.h"
+#include "VisibilityPersistence.h"
+#include <algorithm>
 
 // B4: Validate that System.Guid (C#) and ON_UUID are binary-compatible for P/Invoke.
 // Both are 16-byte structs with identical memory layout (Data1/Data2/Data3/Data4).
 // C# marshals 'ref Guid' as a pointer, which the C++ side receives as 'const ON_UUID*'.
 static_assert(sizeof(ON_UUID) == 16, "ON_UUID must be 16 bytes to match System.Guid layout");
+static_assert(sizeof(RAO_TREE_NODE) == 44, "RAO_TREE_NODE must match NativeVisibilityInterop.TreeNode");
 
-// Version: increment when API changes (5 = ON_AssemblyUserData persistence)
-static const int NATIVE_API_VERSION = 5;
+// Version: increment when API changes (21 = effective instance states, definition rule export)
+static const int NATIVE_API_VERSION = 21;
 
 static bool g_initialized = false;
-static CVisibilityData* g_pVisData = nullptr;
-static CVisibilityConduit* g_pConduit = nullptr;
+static CDocVisibilityRegistry* g_pRegistry = nullptr;
 static CDocEventHandler* g_pDocEventHandler = nullptr;
+static CRedrawIdleWatcher* g_pRedrawWatcher = nullptr;
 
-/// Helper: trigger a document redraw after visibility changes
-static void RedrawActiveDoc()
+static CRhinoDoc* ActiveDoc()
 {
-	CRhinoDoc* pDoc = RhinoApp().ActiveDoc();
-	if (pDoc)
-		pDoc->Redraw();
+	return RhinoApp().ActiveDoc();
 }
 
-static CRhinoDoc* ActiveDoc()
+/// Helper: visibility state of the active document. Queries pass
+/// create = false and get nullptr for a document without state; setters
+/// create it (and the document's conduit) on first use, once their
+/// arguments are known to be valid.
+static CDocVisibility* ActiveDocVisibility(bool create)
 {
-	return RhinoApp().ActiveDoc();
+	CRhinoDoc* pDoc = ActiveDoc();
+	if (!g_pRegistry || !pDoc)
+		return nullptr;
+
+	const unsigned int docSerial = pDoc->RuntimeSerialNumber();
+	return create ? &g_pRegistry->Get(docSerial) : g_pRegistry->Find(docSerial);
+}
+
+/// Helper: visibility data of ActiveDocVisibility
+static CVisibilityData* ActiveData(bool create)
+{
+	CDocVisibility* pDocVis = ActiveDocVisibility(create);
+	return pDocVis ? &pDocVis->Data() : nullptr;
+}
+
+/// Helper: after state changes of instances of the active document, redraw
+/// the views showing them (where they were and are drawn) once Rhino is idle
+static void RedrawInstances(const ON_UUID* instanceIds, size_t count)
+{
+	CRhinoDoc* pDoc = ActiveDoc();
+	CDocVisibility* pDocVis = ActiveDocVisibility(false);
+	if (pDoc && pDocVis)
+		pDocVis->Redraws().MarkInstances(*pDoc, instanceIds, count);
+}
+
+/// Helper: after changes that may show anywhere in the active document,
+/// redraw all of its views once Rhino is idle
+static void RedrawActiveDoc()
+{
+	CDocVisibility* pDocVis = ActiveDocVisibility(false);
+	if (pDocVis)
+		pDocVis->Redraws().MarkAll();
 }
 
 static const CRhinoObject* FindDocObject(const ON_UUID* instanceId)
@@ -45,6 +82,104 @@ static const CRhinoObject* FindDocObject(const ON_UUID* instanceId)
 	return pDoc->LookupObject(*instanceId);
 }
 
+/// Bind managed instances to their active-document objects after state
+/// changes (repeated consecutive ids are looked up once)
+static void BindDocInstances(const ON_UUID* instanceIds, size_t count)
+{
+	CRhinoDoc* pDoc = ActiveDoc();
+	CDocVisibility* pDocVis = ActiveDocVisibility(false);
+	if (!pDoc || !pDocVis)
+		return;
+
+	std::vector<const CRhinoInstanceObject*> objects;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (i > 0 && ON_UuidCompare(instanceIds[i], instanceIds[i - 1]) == 0)
+			continue;
+
+		const CRhinoObject* pObj = pDoc->LookupObject(instanceIds[i]);
+		if (pObj && pObj->ObjectType() == ON::instance_reference)
+			objects.push_back(static_cast<const CRhinoInstanceObject*>(pObj));
+	}
+
+	if (!objects.empty())
+		pDocVis->BindInstances(objects.data(), objects.size());
+}
+
+/// Helper: definition an active-document instance references (nullptr if none)
+static const CRhinoInstanceDefinition* InstanceDefinitionOf(const ON_UUID& instanceId)
+{
+	const CRhinoObject* pObj = FindDocObject(&instanceId);
+	if (!pObj || pObj->ObjectType() != ON::instance_reference)
+		return nullptr;
+	return static_cast<const CRhinoInstanceObject*>(pObj)->InstanceDefinition();
+}
+
+/// Helper: id of InstanceDefinitionOf (ON_nil_uuid if none)
+static ON_UUID InstanceDefinitionId(const ON_UUID& instanceId)
+{
+	const CRhinoInstanceDefinition* pDef = InstanceDefinitionOf(instanceId);
+	return pDef ? pDef->Id() : ON_nil_uuid;
+}
+
+/// Helper: state a component of an instance is drawn with, its own state
+/// over the rules of its definition
+static ComponentState EffectiveState(const CVisibilityData& data, const ON_UUID& instanceId, const CComponentPath& path)
+{
+	std::shared_ptr<const CVisibilitySnapshot> snap = data.AcquireSnapshot();
+	const ON_UUID definitionId = snap->Rules().empty() ? ON_nil_uuid : InstanceDefinitionId(instanceId);
+	return snap->GetEffectiveState(instanceId, definitionId, path);
+}
+
+/// Helper: trie an instance is drawn with in snap, its own states over the
+/// rules of its definition
+static CVisibilityTrieNode::Ptr EffectiveTrie(const CVisibilitySnapshot& snap, const ON_UUID& instanceId)
+{
+	const ON_UUID definitionId = snap.Rules().empty() ? ON_nil_uuid : InstanceDefinitionId(instanceId);
+	return snap.GetEffectiveTrie(instanceId, definitionId);
+}
+
+/// Helper: state to store for an instance. Showing a component a rule of
+/// its definition hides takes an explicit CS_SHOWN override.
+static ComponentState InstanceState(
+	const CVisibilityData& data,
+	const ON_UUID& instanceId,
+	const CComponentPath& path,
+	ComponentState state)
+{
+	if (state != CS_VISIBLE)
+		return state;
+
+	std::shared_ptr<const CVisibilitySnapshot> snap = data.AcquireSnapshot();
+	if (snap->Rules().empty()
+		|| snap->GetDefinitionState(InstanceDefinitionId(instanceId), path) == CS_VISIBLE)
+		return CS_VISIBLE;
+	return CS_SHOWN;
+}
+
+/// Helper: InstanceState for a batch (repeated consecutive ids are looked up once)
+static void ApplyRuleOverrides(const CVisibilityData& data, std::vector<CComponentStateChange>& changes)
+{
+	std::shared_ptr<const CVisibilitySnapshot> snap = data.AcquireSnapshot();
+	if (snap->Rules().empty())
+		return;
+
+	ON_UUID instanceId = ON_nil_uuid;
+	ON_UUID definitionId = ON_nil_uuid;
+	for (CComponentStateChange& change : changes)
+	{
+		if (change.state != CS_VISIBLE)
+			continue;
+		if (ON_UuidCompare(change.instanceId, instanceId) != 0)
+		{
+			instanceId = change.instanceId;
+			definitionId = InstanceDefinitionId(instanceId);
+		}
+		if (snap->GetDefinitionState(definitionId, change.path) != CS_VISIBLE)
+			change.state = CS_SHOWN;
+	}
+}
+
 static const ON_AssemblyUserData* FindAssemblyData(const ON_UUID* instanceId)
 {
 	const CRhinoObject* pObj = FindDocObject(instanceId);
@@ -90,12 +225,9 @@ bool __stdcall NativeInit()
 	if (g_initialized)
 		return true;
 
-	g_pVisData = new CVisibilityData();
-	g_pConduit = new CVisibilityConduit(*g_pVisData);
-	g_pDocEventHandler = new CDocEventHandler(*g_pVisData);
-	CRhinoDoc* pDoc = RhinoApp().ActiveDoc();
-	if (pDoc)
-		g_pConduit->Enable(pDoc->RuntimeSerialNumber());
+	g_pRegistry = new CDocVisibilityRegistry();
+	g_pDocEventHandler = new CDocEventHandler(*g_pRegistry);
+	g_pRedrawWatcher = new CRedrawIdleWatcher(RAO_PLUGIN_ID, *g_pRegistry);
 
 	g_initialized = true;
 	return true;
@@ -108,6 +240,13 @@ void __stdcall NativeCleanup()
 	if (!g_initialized)
 		return;
 
+	if (g_pRedrawWatcher)
+	{
+		g_pRedrawWatcher->Enable(false);
+		delete g_pRedrawWatcher;
+		g_pRedrawWatcher = nullptr;
+	}
+
 	if (g_pDocEventHandler)
 	{
 		g_pDocEventHandler->Enable(FALSE);
@@ -115,17 +254,10 @@ void __stdcall NativeCleanup()
 		g_pDocEventHandler = nullptr;
 	}
 
-	if (g_pConduit)
+	if (g_pRegistry)
 	{
-		g_pConduit->Disable();
-		delete g_pConduit;
-		g_pConduit = nullptr;
-	}
-
-	if (g_pVisData)
-	{
-		delete g_pVisData;
-		g_pVisData = nullptr;
+		delete g_pRegistry;
+		g_pRegistry = nullptr;
 	}
 
 	g_initialized = false;
@@ -138,15 +270,21 @@ bool __stdcall SetComponentVisibility(
 {
 	AFX_MANAGE_STATE(AfxGetStaticModuleState());
 
-	if (!g_initialized || !instanceId || !componentPath || !g_pVisData)
+	if (!g_initialized || !instanceId || !componentPath)
 		return false;
 
-	if (visible)
-		g_pVisData->SetComponentVisible(*instanceId, componentPath);
-	else
-		g_pVisData->SetComponentHidden(*instanceId, componentPath);
+	CComponentPath path;
+	if (!CComponentPath::Parse(componentPath, path))
+		return false;
 
-	RedrawActiveDoc();
+	CVisibilityData* pData = ActiveData(true);
+	if (!pData)
+		return false;
+
+	pData->SetState(*instanceId, path, visible ? InstanceState(*pData, *instanceId, path, CS_VISIBLE) : CS_HIDDEN);
+
+	BindDocInstances(instanceId, 1);
+	RedrawInstances(instanceId, 1);
 	return true;
 }
 
@@ -156,149 +294,101 @@ bool __stdcall IsComponentVisible(
 {
 	AFX_MANAGE_STATE(AfxGetStaticModuleState());
 
-	if (!g_initialized || !instanceId || !componentPath || !g_pVisData)
+	CVisibilityData* pData = ActiveData(false);
+	if (!g_initialized || !instanceId || !componentPath || !pData)
 		return true;
 
-	return !g_pVisData->IsComponentHidden(*instanceId, componentPath);
+	CComponentPath path;
+	if (!CComponentPath::Parse(componentPath, path))
+		return true;
+
+	const ComponentState state = EffectiveState(*pData, *instanceId, path);
+	return state != CS_HIDDEN && state != CS_SUPPRESSED;
 }
 
 int __stdcall GetHiddenComponentCount(const ON_UUID* instanceId)
 {
 	AFX_MANAGE_STATE(AfxGetStaticModuleState());
 
-	if (!g_initialized || !instanceId || !g_pVisData)
+	CVisibilityData* pData = ActiveData(false);
+	if (!g_initialized || !instanceId || !pData)
 		return 0;
 
-	return g_pVisData->GetHiddenCount(*instanceId);
+	std::shared_ptr<const CVisibilitySnapshot> snap = pData->AcquireSnapshot();
+	const ON_UUID definitionId = snap->Rules().empty() ? ON_nil_uuid : InstanceDefinitionId(*instanceId);
+	return snap->GetHiddenCount(*instanceId, definitionId);
 }
 
 void __stdcall ResetComponentVisibility(const ON_UUID* instanceId)
 {
 	AFX_MANAGE_STATE(AfxGetStaticModuleState());
 
-	if (!g_initialized || !instanceId || !g_pVisData)
+	CVisibilityData* pData = ActiveData(false);
+	if (!g_initialized || !instanceId || !pData)
 		return;
 
-	g_pVisData->ResetInstance(*instanceId);
-	RedrawActiveDoc();
+	pData->ResetInstance(*instanceId);
+	RedrawInstances(instanceId, 1);
 }
 
 void __stdcall SetDebugLogging(bool enabled)
 {
 	AFX_MANAGE_STATE(AfxGetStaticModuleState());
 
-	if (g_pConduit)
-		g_pConduit->SetDebugLogging(enabled);
+	if (g_pRegistry)
+		g_pRegistry->SetDebugLogging(enabled);
 }
 
-int __stdcall GetNativeVersion()
+void __stdcall SetLodThreshold(double pixels)
 {
-	return NATIVE_API_VERSION;
-}
-
-/// Serialize visibility data to a pipe-separated string for doc user strings.
-/// Format: <uuid>|<path>:<state>|<path>:<state>\n per instance
-ON_wString SerializeVisibilityState(CVisibilityData& visData)
-{
-	ON_wString result;
-	std::vector<ON_UUID> managedIds;
-	visData.GetManagedInstanceIds(managedIds);
-
-	for (const auto& instanceId : managedIds)
-	{
-		char uuidBuf[64];
-		ON_UuidToString(instanceId, uuidBuf);
-
-		ON_wString line;
-		line.Format(L"%S", uuidBuf);
-
-		// Get all states for this instance
-		CVisibilitySnapshot snap = visData.TakeSnapshot();
-		auto it = snap.m_data.find(instanceId);
-		if (it == snap.m_data.end() || it->second.states.empty())
-			continue;
+	AFX_MANAGE_STATE(AfxGetStaticModuleState());
 
-		for (const auto& pair : it->second.states)
-		{
-			ON_wString entry;
-			entry.Format(L"|%S:%d", pair.first.c_str(), (int)pair.second);
-			line += entry;
-		}
+	if (!g_pRegistry)
+		return;
 
-		result += line;
-		result += L"\n";
-	}
-	return result;
+	g_pRegistry->SetLodThreshold(pixels > 0.0 ? pixels : 0.0);
+	RedrawActiveDoc();
 }
 
-/// Deserialize visibility data from doc user string format
-void DeserializeVisibilityState(const ON_wString& data, CVisibilityData& visData)
+double __stdcall GetLodThreshold()
 {
-	if (data.IsEmpty())
-		return;
-
-	ON_String utf8(data);
-	const char* p = static_cast<const char*>(utf8);
-	std::string str(p);
-
-	size_t lineStart = 0;
-	while (lineStart < str.size())
-	{
-		size_t lineEnd = str.find('\n', lineStart);
-		if (lineEnd == std::string::npos)
-			lineEnd = str.size();
-
-		std::string line = str.substr(lineStart, lineEnd - lineStart);
-		lineStart = lineEnd + 1;
-
-		if (line.empty())
-			continue;
-
-		// Parse: <uuid>|<path>:<state>|<path>:<state>
-		size_t firstPipe = line.find('|');
-		if (firstPipe == std::string::npos)
-			continue;
-
-		std::string uuidStr = line.substr(0, firstPipe);
-		ON_UUID instanceId = ON_UuidFromString(uuidStr.c_str());
-		if (ON_UuidIsNil(instanceId))
-			continue;
+	return g_pRegistry ? g_pRegistry->GetLodThreshold() : 0.0;
+}
 
-		size_t pos = firstPipe + 1;
-		while (pos < line.size())
-		{
-			size_t nextPipe = line.find('|', pos);
-			if (nextPipe == std::string::npos)
-				nextPipe = line.size();
+void __stdcall SetMergedMeshes(bool enabled)
+{
+	AFX_MANAGE_STATE(AfxGetStaticModuleState());
 
-			std::string entry = line.substr(pos, nextPipe - pos);
-			pos = nextPipe + 1;
+	if (!g_pRegistry)
+		return;
 
-			size_t colon = entry.find(':');
-			if (colon == std::string::npos)
-				continue;
+	g_pRegistry->SetMergedMeshes(enabled);
+	RedrawActiveDoc();
+}
 
-			std::string path = entry.substr(0, colon);
-			int state = std::atoi(entry.substr(colon + 1).c_str());
+bool __stdcall GetMergedMeshes()
+{
+	return g_pRegistry && g_pRegistry->GetMergedMeshes();
+}
 
-			if (state >= CS_VISIBLE && state <= CS_TRANSPARENT)
-				visData.SetState(instanceId, path.c_str(), static_cast<ComponentState>(state));
-		}
-	}
+int __stdcall GetNativeVersion()
+{
+	return NATIVE_API_VERSION;
 }
 
 void __stdcall PersistVisibilityState()
 {
 	AFX_MANAGE_STATE(AfxGetStaticModuleState());
 
-	if (!g_initialized || !g_pVisData)
+	CVisibilityData* pData = ActiveData(false);
+	if (!g_initialized || !pData)
 		return;
 
 	CRhinoDoc* pDoc = RhinoApp().ActiveDoc();
 	if (!pDoc)
 		return;
 
-	ON_wString serialized = SerializeVisibilityState(*g_pVisData);
+	ON_wString serialized = SerializeVisibilityState(*pData);
 	pDoc->SetUserString(RAO_DOC_KEY, serialized);
 }
 
@@ -306,27 +396,31 @@ void __stdcall LoadVisibilityState()
 {
 	AFX_MANAGE_STATE(AfxGetStaticModuleState());
 
-	if (!g_initialized || !g_pVisData)
-		return;
-
 	CRhinoDoc* pDoc = RhinoApp().ActiveDoc();
-	if (!pDoc)
+	if (!g_initialized || !pDoc)
 		return;
 
+	// A document without saved state gets none until it is first set
 	ON_wString serialized;
 	pDoc->GetUserString(RAO_DOC_KEY, serialized);
-	DeserializeVisibilityState(serialized, *g_pVisData);
+	CDocVisibility* pDocVis = ActiveDocVisibility(!serialized.IsEmpty());
+	if (!pDocVis)
+		return;
+
+	DeserializeVisibilityState(serialized, pDocVis->Data());
+	CDocEventHandler::BindManagedInstances(*pDoc, *pDocVis);
 }
 
 int __stdcall GetManagedInstances(ON_UUID* buffer, int maxCount)
 {
 	AFX_MANAGE_STATE(AfxGetStaticModuleState());
 
-	if (!g_initialized || !g_pVisData)
+	CVisibilityData* pData = ActiveData(false);
+	if (!g_initialized || !pData)
 		return 0;
 
 	std::vector<ON_UUID> ids;
-	g_pVisData->GetManagedInstanceIds(ids);
+	pData->GetManagedInstanceIds(ids);
 
 	int count = static_cast<int>(ids.size());
 	if (buffer && maxCount > 0)
@@ -339,14 +433,58 @@ int __stdcall GetManagedInstances(ON_UUID* buffer, int maxCount)
 	return count;
 }
 
+int __stdcall GetManagedInstancesOfDefinition(const ON_UUID* definitionId, ON_UUID* buffer, int maxCount)
+{
+	AFX_MANAGE_STATE(AfxGetStaticModuleState());
+
+	CVisibilityData* pData = ActiveData(false);
+	if (!g_initialized || !pData || !definitionId)
+		return 0;
+
+	std::shared_ptr<const CVisibilitySnapshot> snap = pData->AcquireSnapshot();
+	const std::vector<ON_UUID>* pInstances = snap->InstancesOfDefinition(*definitionId);
+	if (!pInstances)
+		return 0;
+
+	int count = static_cast<int>(pInstances->size());
+	if (buffer && maxCount > 0)
+	{
+		int toCopy = (count < maxCount) ? count : maxCount;
+		for (int i = 0; i < toCopy; i++)
+			buffer[i] = (*pInstances)[i];
+	}
+
+	return count;
+}
+
 bool __stdcall IsConduitEnabled()
 {
 	AFX_MANAGE_STATE(AfxGetStaticModuleState());
 
-	if (!g_pConduit)
+	CRhinoDoc* pDoc = ActiveDoc();
+	if (!g_pRegistry || !pDoc)
 		return false;
 
-	return g_pConduit->IsEnabled() ? true : false;
+	CDocVisibility* pDocVis = g_pRegistry->Find(pDoc->RuntimeSerialNumber());
+	return pDocVis && pDocVis->Conduit().IsEnabled();
+}
+
+bool __stdcall GetConduitStats(RAO_CONDUIT_STATS* stats)
+{
+	if (!g_initialized || !g_pRegistry || !stats)
+		return false;
+
+	if (stats->structSize < static_cast<int32_t>(sizeof(RAO_CONDUIT_STATS)))
+		return false;
+
+	g_pRegistry->GetStats(*stats);
+	return true;
+}
+
+void __stdcall ResetConduitStats()
+{
+	if (g_pRegistry)
+		g_pRegistry->ResetStats();
 }
 
 bool __stdcall SetComponentState(
@@ -356,14 +494,23 @@ bool __stdcall SetComponentState(
 {
 	AFX_MANAGE_STATE(AfxGetStaticModuleState());
 
-	if (!g_initialized || !instanceId || !path || !g_pVisData)
+	if (!g_initialized || !instanceId || !path)
 		return false;
 
 	if (state < CS_VISIBLE || state > CS_TRANSPARENT)
 		return false;
 
-	g_pVisData->SetState(*instanceId, path, static_cast<ComponentState>(state));
-	RedrawActiveDoc();
+	CComponentPath componentPath;
+	if (!CComponentPath::Parse(path, componentPath))
+		return false;
+
+	CVisibilityData* pData = ActiveData(true);
+	if (!pData)
+		return false;
+
+	pData->SetState(*instanceId, componentPath, InstanceState(*pData, *instanceId, componentPath, static_cast<ComponentState>(state)));
+	BindDocInstances(instanceId, 1);
+	RedrawInstances(instanceId, 1);
 	return true;
 }
 
@@ -373,10 +520,525 @@ int __stdcall GetComponentState(
 {
 	AFX_MANAGE_STATE(AfxGetStaticModuleState());
 
-	if (!g_initialized || !instanceId || !path || !g_pVisData)
+	CVisibilityData* pData = ActiveData(false);
+	if (!g_initialized || !instanceId || !path || !pData)
+		return CS_VISIBLE;
+
+	CComponentPath componentPath;
+	if (!CComponentPath::Parse(path, componentPath))
+		return CS_VISIBLE;
+
+	return static_cast<int>(EffectiveState(*pData, *instanceId, componentPath));
+}
+
+bool __stdcall SetComponentStateByIndices(
+	const ON_UUID* instanceId,
+	const int* indices,
+	int depth,
+	int state)
+{
+	AFX_MANAGE_STATE(AfxGetStaticModuleState());
+
+	if (!g_initialized || !instanceId)
+		return false;
+
+	if (state < CS_VISIBLE || state > CS_TRANSPARENT)
+		return false;
+
+	CComponentPath componentPath;
+	if (!CComponentPath::FromIndices(indices, depth, componentPath))
+		return false;
+
+	CVisibilityData* pData = ActiveData(true);
+	if (!pData)
+		return false;
+
+	pData->SetState(*instanceId, componentPath, InstanceState(*pData, *instanceId, componentPath, static_cast<ComponentState>(state)));
+	BindDocInstances(instanceId, 1);
+	RedrawInstances(instanceId, 1);
+	return true;
+}
+
+/// Helper: batch entries as state changes, skipping invalid ones
+static void ParseStateChanges(
+	const ON_UUID* instanceIds,
+	const char* const* paths,
+	const int* states,
+	int count,
+	std::vector<CComponentStateChange>& changes)
+{
+	changes.reserve(static_cast<size_t>(count));
+	for (int i = 0; i < count; i++)
+	{
+		if (!paths[i] || states[i] < CS_VISIBLE || states[i] > CS_TRANSPARENT)
+			continue;
+
+		CComponentStateChange change;
+		change.instanceId = instanceIds[i];
+		change.state = static_cast<ComponentState>(states[i]);
+		if (!CComponentPath::Parse(paths[i], change.path))
+			continue;
+		changes.push_back(change);
+	}
+}
+
+int __stdcall SetComponentStatesBatch(
+	const ON_UUID* instanceIds,
+	const char* const* paths,
+	const int* states,
+	int count)
+{
+	AFX_MANAGE_STATE(AfxGetStaticModuleState());
+
+	if (!g_initialized || !instanceIds || !paths || !states || count <= 0)
+		return 0;
+
+	std::vector<CComponentStateChange> changes;
+	ParseStateChanges(instanceIds, paths, states, count, changes);
+	CVisibilityData* pData = changes.empty() ? nullptr : ActiveData(true);
+	if (!pData)
+		return 0;
+	ApplyRuleOverrides(*pData, changes);
+
+	// One lock, one publish, one redraw for the whole batch
+	if (pData->SetStates(changes.data(), changes.size()) > 0)
+	{
+		BindDocInstances(instanceIds, static_cast<size_t>(count));
+		RedrawInstances(instanceIds, static_cast<size_t>(count));
+	}
+
+	return static_cast<int>(changes.size());
+}
+
+int __stdcall SetStateTableStatesBatch(
+	const wchar_t* name,
+	const ON_UUID* instanceIds,
+	const char* const* paths,
+	const int* states,
+	int count)
+{
+	AFX_MANAGE_STATE(AfxGetStaticModuleState());
+
+	if (!g_initialized || !name || !instanceIds || !paths || !states || count <= 0)
+		return 0;
+
+	std::vector<CComponentStateChange> changes;
+	ParseStateChanges(instanceIds, paths, states, count, changes);
+	CVisibilityData* pData = changes.empty() ? nullptr : ActiveData(true);
+	if (!pData)
+		return 0;
+	ApplyRuleOverrides(*pData, changes);
+
+	// Not drawn until activated: no publish, no redraw
+	pData->SetStateTableStates(name, changes.data(), changes.size());
+	return static_cast<int>(changes.size());
+}
+
+int __stdcall SaveStateTable(const wchar_t* name)
+{
+	AFX_MANAGE_STATE(AfxGetStaticModuleState());
+
+	if (!g_initialized || !name)
+		return -1;
+
+	CVisibilityData* pData = ActiveData(true);
+	if (!pData)
+		return -1;
+
+	return pData->SaveStateTable(name);
+}
+
+bool __stdcall ActivateStateTable(const wchar_t* name)
+{
+	AFX_MANAGE_STATE(AfxGetStaticModuleState());
+
+	CRhinoDoc* pDoc = ActiveDoc();
+	CDocVisibility* pDocVis = ActiveDocVisibility(false);
+	if (!g_initialized || !pDoc || !pDocVis || !name || !pDocVis->Data().ActivateStateTable(name))
+		return false;
+
+	// Instances the table has not seen bound yet (edited in while inactive);
+	// a table activated before is fully bound and this does not publish
+	CDocEventHandler::BindManagedInstances(*pDoc, *pDocVis);
+	RedrawActiveDoc();
+	return true;
+}
+
+bool __stdcall DeleteStateTable(const wchar_t* name)
+{
+	AFX_MANAGE_STATE(AfxGetStaticModuleState());
+
+	CVisibilityData* pData = ActiveData(false);
+	return g_initialized && pData && name && pData->DeleteStateTable(name);
+}
+
+bool __stdcall SetDefinitionComponentState(
+	const ON_UUID* definitionId,
+	const char* path,
+	int state)
+{
+	AFX_MANAGE_STATE(AfxGetStaticModuleState());
+
+	CRhinoDoc* pDoc = ActiveDoc();
+	if (!g_initialized || !definitionId || !path || !pDoc)
+		return false;
+
+	if (state < CS_VISIBLE || state > CS_TRANSPARENT)
+		return false;
+
+	const CRhinoInstanceDefinition* pDef = CDocEventHandler::FindDefinition(*pDoc, *definitionId);
+	CComponentPath componentPath;
+	if (!pDef || !CComponentPath::Parse(path, componentPath))
+		return false;
+
+	CDocVisibility* pDocVis = ActiveDocVisibility(true);
+	if (!pDocVis)
+		return false;
+
+	// Recorded so the rule follows its component through definition edits
+	pDocVis->Layouts().Capture(pDef);
+	pDocVis->Data().SetDefinitionState(*definitionId, componentPath, static_cast<ComponentState>(state));
+	RedrawActiveDoc();
+	return true;
+}
+
+int __stdcall GetDefinitionComponentState(
+	const ON_UUID* definitionId,
+	const char* path)
+{
+	AFX_MANAGE_STATE(AfxGetStaticModuleState());
+
+	CVisibilityData* pData = ActiveData(false);
+	if (!g_initialized || !definitionId || !path || !pData)
+		return CS_VISIBLE;
+
+	CComponentPath componentPath;
+	if (!CComponentPath::Parse(path, componentPath))
+		return CS_VISIBLE;
+
+	return static_cast<int>(pData->GetDefinitionState(*definitionId, componentPath));
+}
+
+void __stdcall ResetDefinitionVisibility(const ON_UUID* definitionId)
+{
+	AFX_MANAGE_STATE(AfxGetStaticModuleState());
+
+	CVisibilityData* pData = ActiveData(false);
+	if (!g_initialized || !definitionId || !pData)
+		return;
+
+	if (pData->ResetDefinition(*definitionId))
+		RedrawActiveDoc();
+}
+
+static bool IsValidQuery(const RAO_COMPONENT_QUERY* query)
+{
+	return query && query->structSize >= static_cast<int32_t>(sizeof(RAO_COMPONENT_QUERY));
+}
+
+int __stdcall QueryComponents(
+	const ON_UUID* instanceId,
+	const RAO_COMPONENT_QUERY* query,
+	int* buffer,
+	int capacity)
+{
+	AFX_MANAGE_STATE(AfxGetStaticModuleState());
+
+	if (!g_initialized || !instanceId || !IsValidQuery(query))
+		return -1;
+
+	std::vector<CComponentPath> matches;
+	CComponentQuery(*query).Collect(InstanceDefinitionOf(*instanceId), matches);
+
+	int offset = 0;
+	for (const CComponentPath& path : matches)
+	{
+		const int depth = path.Depth();
+		if (buffer && capacity - offset >= depth + 1)
+		{
+			buffer[offset] = depth;
+			for (int level = 0; level < depth; level++)
+				buffer[offset + 1 + level] = path.At(level);
+		}
+		offset += depth + 1;
+	}
+	return offset;
+}
+
+int __stdcall ApplyComponentQuery(
+	const ON_UUID* instanceIds,
+	int instanceCount,
+	const RAO_COMPONENT_QUERY* query,
+	int state)
+{
+	AFX_MANAGE_STATE(AfxGetStaticModuleState());
+
+	if (!g_initialized || !instanceIds || instanceCount < 0 || !IsValidQuery(query))
+		return -1;
+
+	if (state < CS_VISIBLE || state > CS_TRANSPARENT)
+		return -1;
+
+	// Instances of one definition share its matches
+	const CComponentQuery componentQuery(*query);
+	std::unordered_map<ON_UUID, std::vector<CComponentPath>, ON_UUID_Hash, ON_UUID_Equal> matchesByDefinition;
+	std::vector<CComponentStateChange> changes;
+	for (int i = 0; i < instanceCount; i++)
+	{
+		const CRhinoInstanceDefinition* pDef = InstanceDefinitionOf(instanceIds[i]);
+		if (!pDef)
+			continue;
+
+		auto inserted = matchesByDefinition.emplace(pDef->Id(), std::vector<CComponentPath>());
+		if (inserted.second)
+			componentQuery.Collect(pDef, inserted.first->second);
+
+		for (const CComponentPath& path : inserted.first->second)
+			changes.push_back({ instanceIds[i], path, static_cast<ComponentState>(state) });
+	}
+	CVisibilityData* pData = changes.empty() ? nullptr : ActiveData(true);
+	if (!pData)
+		return 0;
+
+	ApplyRuleOverrides(*pData, changes);
+	if (pData->SetStates(changes.data(), changes.size()) > 0)
+	{
+		BindDocInstances(instanceIds, static_cast<size_t>(instanceCount));
+		RedrawInstances(instanceIds, static_cast<size_t>(instanceCount));
+	}
+	return static_cast<int>(changes.size());
+}
+
+int __stdcall PickComponent(
+	const double* lineFrom,
+	const double* lineTo,
+	double tolerance,
+	ON_UUID* outInstanceId,
+	int* pathBuffer,
+	int capacity)
+{
+	AFX_MANAGE_STATE(AfxGetStaticModuleState());
+
+	if (!g_initialized || !lineFrom || !lineTo || !outInstanceId || tolerance < 0.0 || capacity < 0)
+		return -1;
+
+	// The document's conduit holds the draw lists picking walks: picking
+	// is the one query that creates it
+	CRhinoDoc* pDoc = ActiveDoc();
+	CDocVisibility* pDocVis = ActiveDocVisibility(true);
+	if (!pDoc || !pDocVis)
+		return 0;
+
+	const ON_Line line(
+		ON_3dPoint(lineFrom[0], lineFrom[1], lineFrom[2]),
+		ON_3dPoint(lineTo[0], lineTo[1], lineTo[2]));
+
+	CComponentPick pick;
+	if (!pDocVis->Conduit().PickComponent(*pDoc, line, tolerance, pick))
+		return 0;
+
+	*outInstanceId = pick.pInstance->Attributes().m_uuid;
+	const int depth = pick.path.Depth();
+	for (int level = 0; pathBuffer && level < depth && level < capacity; level++)
+		pathBuffer[level] = pick.path.At(level);
+	return depth;
+}
+
+/// Helper: snapshot the tree export reads states from (nullptr = all visible)
+static std::shared_ptr<const CVisibilitySnapshot> ActiveSnapshot()
+{
+	CVisibilityData* pData = ActiveData(false);
+	return pData ? pData->AcquireSnapshot() : nullptr;
+}
+
+int __stdcall ExportInstanceTree(
+	RAO_TREE_NODE* buffer,
+	int capacity,
+	int maxDepth)
+{
+	AFX_MANAGE_STATE(AfxGetStaticModuleState());
+
+	if (!g_initialized || capacity < 0 || (capacity > 0 && !buffer))
+		return -1;
+
+	CRhinoDoc* pDoc = ActiveDoc();
+	if (!pDoc)
+		return 0;
+
+	// Same order as the panel's tree: by id, stable across object replacement
+	std::vector<const CRhinoInstanceObject*> roots;
+	CRhinoObjectIterator it(*pDoc, CRhinoObjectIterator::undeleted_objects, CRhinoObjectIterator::active_and_reference_objects);
+	it.SetObjectFilter(ON::instance_reference);
+	for (const CRhinoObject* pObject = it.First(); pObject; pObject = it.Next())
+		roots.push_back(static_cast<const CRhinoInstanceObject*>(pObject));
+	std::sort(roots.begin(), roots.end(), [](const CRhinoInstanceObject* a, const CRhinoInstanceObject* b)
+	{
+		return ON_UuidCompare(a->Attributes().m_uuid, b->Attributes().m_uuid) < 0;
+	});
+
+	CInstanceTreeWriter writer(buffer, capacity, ActiveSnapshot());
+	for (const CRhinoInstanceObject* pInstance : roots)
+		writer.AppendInstance(pInstance, maxDepth);
+	return writer.Count();
+}
+
+int __stdcall ExportTreeChildren(
+	const ON_UUID* instanceId,
+	const int* path,
+	int depth,
+	RAO_TREE_NODE* buffer,
+	int capacity)
+{
+	AFX_MANAGE_STATE(AfxGetStaticModuleState());
+
+	if (!g_initialized || !instanceId || capacity < 0 || (capacity > 0 && !buffer))
+		return -1;
+
+	CComponentPath componentPath;
+	if (depth > 0 && !CComponentPath::FromIndices(path, depth, componentPath))
+		return -1;
+
+	const CRhinoObject* pObj = FindDocObject(instanceId);
+	if (!pObj || pObj->ObjectType() != ON::instance_reference)
+		return -1;
+
+	CInstanceTreeWriter writer(buffer, capacity, ActiveSnapshot());
+	if (!writer.AppendChildren(static_cast<const CRhinoInstanceObject*>(pObj), componentPath))
+		return -1;
+	return writer.Count();
+}
+
+void __stdcall FlushRedraws()
+{
+	AFX_MANAGE_STATE(AfxGetStaticModuleState());
+
+	CRhinoDoc* pDoc = ActiveDoc();
+	CDocVisibility* pDocVis = ActiveDocVisibility(false);
+	if (g_initialized && pDoc && pDocVis)
+		pDocVis->Redraws().Flush(*pDoc);
+}
+
+int __stdcall GetComponentStateByIndices(
+	const ON_UUID* instanceId,
+	const int* indices,
+	int depth)
+{
+	AFX_MANAGE_STATE(AfxGetStaticModuleState());
+
+	CVisibilityData* pData = ActiveData(false);
+	if (!g_initialized || !instanceId || !pData)
 		return CS_VISIBLE;
 
-	return static_cast<int>(g_pVisData->GetState(*instanceId, path));
+	CComponentPath componentPath;
+	if (!CComponentPath::FromIndices(indices, depth, componentPath))
+		return CS_VISIBLE;
+
+	return static_cast<int>(EffectiveState(*pData, *instanceId, componentPath));
+}
+
+/// Append the packed (depth, indices..., state) records of the non-visible
+/// states of a trie at buffer[offset]. Records from the first one that does
+/// not fit in capacity on are counted but not written. *pRecords (optional)
+/// receives the number of records. Returns the offset after the last record.
+static int PackStates(const CVisibilityTrieNode* root, int* buffer, int capacity, int offset, int* pRecords = nullptr)
+{
+	if (pRecords)
+		*pRecords = 0;
+	if (!root)
+		return offset;
+
+	root->ForEach([buffer, capacity, &offset, pRecords](const CComponentPath& path, ComponentState state)
+	{
+		// Overrides of rules the instance no longer has
+		if (state == CS_SHOWN)
+			return;
+		if (pRecords)
+			(*pRecords)++;
+
+		const int depth = path.Depth();
+		const int recordSize = depth + 2;
+		if (buffer && capacity - offset >= recordSize)
+		{
+			int* record = buffer + offset;
+			record[0] = depth;
+			for (int level = 0; level < depth; level++)
+				record[1 + level] = path.At(level);
+			record[1 + depth] = static_cast<int>(state);
+		}
+		offset += recordSize;
+	});
+	return offset;
+}
+
+int __stdcall GetInstanceStates(
+	const ON_UUID* instanceId,
+	int* buffer,
+	int capacity)
+{
+	AFX_MANAGE_STATE(AfxGetStaticModuleState());
+
+	CVisibilityData* pData = ActiveData(false);
+	if (!g_initialized || !instanceId || !pData)
+		return 0;
+
+	std::shared_ptr<const CVisibilitySnapshot> snap = pData->AcquireSnapshot();
+	return PackStates(EffectiveTrie(*snap, *instanceId).get(), buffer, capacity, 0);
+}
+
+int __stdcall GetMultiInstanceStates(
+	const ON_UUID* instanceIds,
+	int instanceCount,
+	int* buffer,
+	int capacity)
+{
+	AFX_MANAGE_STATE(AfxGetStaticModuleState());
+
+	CVisibilityData* pData = ActiveData(false);
+	if (!g_initialized || !pData || !instanceIds || instanceCount < 0)
+		return -1;
+
+	std::shared_ptr<const CVisibilitySnapshot> snap = pData->AcquireSnapshot();
+	int offset = 0;
+	for (int i = 0; i < instanceCount; i++)
+	{
+		const CVisibilityTrieNode::Ptr trie = EffectiveTrie(*snap, instanceIds[i]);
+
+		// The count slot is only written once all of its records fit
+		const int countSlot = offset++;
+		int records = 0;
+		offset = PackStates(trie.get(), buffer, capacity, offset, &records);
+		if (buffer && offset <= capacity)
+			buffer[countSlot] = records;
+	}
+	return offset;
+}
+
+int __stdcall GetMultiDefinitionStates(
+	const ON_UUID* definitionIds,
+	int definitionCount,
+	int* buffer,
+	int capacity)
+{
+	AFX_MANAGE_STATE(AfxGetStaticModuleState());
+
+	CVisibilityData* pData = ActiveData(false);
+	if (!g_initialized || !definitionIds || definitionCount < 0)
+		return -1;
+
+	std::shared_ptr<const CVisibilitySnapshot> snap = pData ? pData->AcquireSnapshot() : nullptr;
+	int offset = 0;
+	for (int i = 0; i < definitionCount; i++)
+	{
+		const CVisibilityTrieNode::Ptr* pRules = snap ? snap->FindDefinitionRules(definitionIds[i]) : nullptr;
+
+		// As GetMultiInstanceStates: the count slot follows its records
+		const int countSlot = offset++;
+		int records = 0;
+		offset = PackStates(pRules ? pRules->get() : nullptr, buffer, capacity, offset, &records);
+		if (buffer && offset <= capacity)
+			buffer[countSlot] = records;
+	}
+	return offset;
 }
 
 bool __stdcall AttachAssemblyData(
@@ -8,6 +8,70 @@
 #define NATIVE_API __declspec(dllimport)
 #endif
 
+#include <cstdint>
+
+/// Conduit performance counters (GetConduitStats), summed over all documents.
+/// Counters accumulate from plug-in load or the last ResetConduitStats.
+/// Mirrored by NativeVisibilityInterop.ConduitStats: append fields only.
+struct RAO_CONDUIT_STATS
+{
+	int32_t structSize;               ///< in: sizeof known to the caller; out: native sizeof
+	int32_t maxNestingDepth;          ///< deepest nested block level flattened for drawing
+	uint64_t frames;                  ///< SC_PREDRAWOBJECTS passes
+	uint64_t snapshotRefreshes;       ///< new visibility generations picked up
+	uint64_t snapshotNs;              ///< time spent refreshing snapshots
+	uint64_t drawNs;                  ///< SC_DRAWOBJECT time for managed instances
+	uint64_t bboxNs;                  ///< SC_CALCBOUNDINGBOX time
+	uint64_t transparentNs;           ///< transparent pass time (SC_POSTDRAWOBJECTS)
+	uint64_t highlightNs;             ///< selection highlight time (SC_POSTDRAWOBJECTS)
+	uint64_t instancesDrawn;          ///< managed instance draws
+	uint64_t componentsDrawn;         ///< components drawn for managed instances (after culling)
+	uint64_t componentsSkipped;       ///< hidden or suppressed components not drawn
+	uint64_t transparentDrawn;        ///< components drawn in the transparent pass
+	uint64_t drawListBuilds;          ///< draw list cache misses
+	uint64_t drawListHits;            ///< draw list cache hits
+	uint64_t cachedDrawLists;         ///< draw lists currently cached
+	uint64_t snapshotBytesPublished;  ///< bytes copied publishing visibility snapshots
+	uint64_t componentsCulled;        ///< components outside the view frustum, not drawn
+	uint64_t instancesProxied;        ///< managed instances drawn as their LOD proxy box
+	uint64_t instancesMerged;         ///< managed instances drawn from merged render meshes
+	uint64_t mergedMeshBuilds;        ///< draw lists whose render meshes were merged
+	uint64_t redrawsCoalesced;        ///< state changes folded into an already pending redraw
+	uint64_t viewsRedrawn;            ///< views redrawn after state changes
+	uint64_t viewsSkipped;            ///< views not redrawn: no changed region in their frustum
+};
+
+/// Component query (QueryComponents, ApplyComponentQuery). A component
+/// matches if it meets every criterion that is set.
+/// Mirrored by NativeVisibilityInterop.ComponentQuery: append fields only.
+struct RAO_COMPONENT_QUERY
+{
+	int32_t structSize;               ///< sizeof known to the caller
+	int32_t layerIndex;               ///< layer index of the component, -1 = any layer
+	uint32_t objectTypes;             ///< ON::object_type bit mask, 0 = any type
+	const wchar_t* name;              ///< object name pattern (* and ?, case-insensitive), nullptr = any
+	const wchar_t* userKey;           ///< user text key the component must have, nullptr = any
+	const wchar_t* userValue;         ///< pattern for the value of userKey, nullptr = any value
+};
+
+/// One node of the block instance hierarchy (ExportInstanceTree,
+/// ExportTreeChildren). Mirrored by NativeVisibilityInterop.TreeNode:
+/// a layout change bumps NATIVE_API_VERSION.
+struct RAO_TREE_NODE
+{
+	int32_t parent;                   ///< record index of the parent in the same buffer, -1 = none
+	int32_t definitionIndex;          ///< instance definition table index of a block, -1 otherwise
+	int32_t componentIndex;           ///< child index within the parent's definition, -1 = top-level instance
+	int32_t depth;                    ///< component path length, 0 = top-level instance
+	ON_UUID objectId;                 ///< id of the instance or definition object
+	int32_t state;                    ///< effective state in its top-level instance (0..3)
+	int32_t childCount;               ///< components of its definition, exported or not
+	uint32_t objectType;              ///< ON::object_type
+};
+
+// Visibility state is kept per document. Instance calls act on the state of
+// the active document; each document is drawn by its own conduit. Changes are
+// redrawn when Rhino goes idle, in the views they show in (FlushRedraws).
 extern "C"
 {
 	/// Initialize the native module (call from C# OnLoadPlugIn)
@@ -31,7 +95,8 @@ extern "C"
 		const char* componentPath
 	);
 
-	/// Get the number of hidden components for a specific instance
+	/// Get the number of hidden or suppressed components of an instance,
+	/// those hidden by definition rules included
 	NATIVE_API int __stdcall GetHiddenComponentCount(
 		const ON_UUID* instanceId
 	);
@@ -44,6 +109,23 @@ extern "C"
 	/// Enable or disable debug logging to Rhino command line
 	NATIVE_API void __stdcall SetDebugLogging(bool enabled);
 
+	/// Draw managed instances whose visible components span fewer than
+	/// pixels on screen as a box proxy instead (0 = always draw components).
+	/// Applies to the conduits of all documents.
+	NATIVE_API void __stdcall SetLodThreshold(double pixels);
+
+	/// Current LOD proxy threshold in pixels (0 = off)
+	NATIVE_API double __stdcall GetLodThreshold();
+
+	/// Opt in to drawing managed instances whose states stay unchanged from
+	/// render meshes merged per (definition, states) and display color, in
+	/// shaded modes. Merging runs on worker threads, started on first use.
+	/// Applies to the conduits of all documents (default off).
+	NATIVE_API void __stdcall SetMergedMeshes(bool enabled);
+
+	/// Whether merged mesh drawing is enabled
+	NATIVE_API bool __stdcall GetMergedMeshes();
+
 	/// Return the native DLL version for compatibility checks
 	NATIVE_API int __stdcall GetNativeVersion();
 
@@ -56,9 +138,25 @@ extern "C"
 	/// Get all managed instance IDs (returns count, fills buffer up to maxCount)
 	NATIVE_API int __stdcall GetManagedInstances(ON_UUID* buffer, int maxCount);
 
+	/// Get the managed instances that reference a definition directly
+	/// (returns count, fills buffer up to maxCount). Index lookup, no document scan.
+	NATIVE_API int __stdcall GetManagedInstancesOfDefinition(
+		const ON_UUID* definitionId,
+		ON_UUID* buffer,
+		int maxCount
+	);
+
 	/// Check if native conduit is currently enabled
 	NATIVE_API bool __stdcall IsConduitEnabled();
 
+	/// Read the conduit performance counters.
+	/// Set stats->structSize to sizeof(RAO_CONDUIT_STATS) before calling.
+	/// Returns false if not initialized or the struct is too small.
+	NATIVE_API bool __stdcall GetConduitStats(RAO_CONDUIT_STATS* stats);
+
+	/// Zero the conduit performance counters
+	NATIVE_API void __stdcall ResetConduitStats();
+
 	/// Set the state of a component within a block instance.
 	/// state: 0=Visible, 1=Hidden, 2=Suppressed, 3=Transparent
 	NATIVE_API bool __stdcall SetComponentState(
@@ -67,13 +165,194 @@ extern "C"
 		int state
 	);
 
-	/// Get the state of a component within a block instance.
+	/// Get the state a component within a block instance is drawn with:
+	/// its own state, else the rule of its definition.
 	/// Returns: 0=Visible, 1=Hidden, 2=Suppressed, 3=Transparent
 	NATIVE_API int __stdcall GetComponentState(
 		const ON_UUID* instanceId,
 		const char* path
 	);
 
+	/// Set the state of a component addressed by its child-index sequence
+	/// (root first), e.g. {1, 0, 2} for "1.0.2". Avoids path string formatting.
+	/// state: 0=Visible, 1=Hidden, 2=Suppressed, 3=Transparent
+	NATIVE_API bool __stdcall SetComponentStateByIndices(
+		const ON_UUID* instanceId,
+		const int* indices,
+		int depth,
+		int state
+	);
+
+	/// Set the states of many components in one call.
+	/// Entry i sets paths[i] (dot-separated) of instanceIds[i] to states[i].
+	/// All entries are applied under one lock with a single redraw.
+	/// Invalid entries are skipped; returns the number of entries applied.
+	NATIVE_API int __stdcall SetComponentStatesBatch(
+		const ON_UUID* instanceIds,
+		const char* const* paths,
+		const int* states,
+		int count
+	);
+
+	/// Set component states in a named state table (created if missing)
+	/// without changing what is drawn. Entries as for SetComponentStatesBatch.
+	/// Returns the number of entries applied.
+	NATIVE_API int __stdcall SetStateTableStatesBatch(
+		const wchar_t* name,
+		const ON_UUID* instanceIds,
+		const char* const* paths,
+		const int* states,
+		int count
+	);
+
+	/// Save the current state of all instances as a named state table,
+	/// replacing one of that name. Returns the number of managed instances
+	/// saved, or -1 on error.
+	NATIVE_API int __stdcall SaveStateTable(const wchar_t* name);
+
+	/// Replace the state of all instances with a named state table (a pointer
+	/// swap, independent of assembly size) and redraw once. Instances not in
+	/// the table become fully visible. Returns false if there is no such table.
+	NATIVE_API bool __stdcall ActivateStateTable(const wchar_t* name);
+
+	/// Drop a named state table. Returns false if there is none.
+	NATIVE_API bool __stdcall DeleteStateTable(const wchar_t* name);
+
+	/// Set the state of a component for every instance of a definition,
+	/// stored once for the definition. States set on an instance override it;
+	/// setting 0 on an instance shows a component the rule hides.
+	/// state: 0=Visible, 1=Hidden, 2=Suppressed, 3=Transparent
+	NATIVE_API bool __stdcall SetDefinitionComponentState(
+		const ON_UUID* definitionId,
+		const char* path,
+		int state
+	);
+
+	/// Get the rule state of a component of a definition.
+	/// Returns: 0=Visible, 1=Hidden, 2=Suppressed, 3=Transparent
+	NATIVE_API int __stdcall GetDefinitionComponentState(
+		const ON_UUID* definitionId,
+		const char* path
+	);
+
+	/// Drop all rules of a definition (instance states are kept)
+	NATIVE_API void __stdcall ResetDefinitionVisibility(const ON_UUID* definitionId);
+
+	/// Find the components of an instance matching query, at any nesting
+	/// depth. A matching nested block is reported whole, without its contents.
+	/// buffer receives packed int records in definition order, one per match:
+	///   depth, index[0] .. index[depth - 1]
+	/// Returns the number of ints required, or -1 on invalid arguments. Only
+	/// whole records that fit in capacity are written.
+	NATIVE_API int __stdcall QueryComponents(
+		const ON_UUID* instanceId,
+		const RAO_COMPONENT_QUERY* query,
+		int* buffer,
+		int capacity
+	);
+
+	/// Set state on every component matching query in each of the instances,
+	/// under one lock with a single redraw. Matches are collected once per
+	/// definition. Returns the number of component states set, or -1 on
+	/// invalid arguments.
+	/// state: 0=Visible, 1=Hidden, 2=Suppressed, 3=Transparent
+	NATIVE_API int __stdcall ApplyComponentQuery(
+		const ON_UUID* instanceIds,
+		int instanceCount,
+		const RAO_COMPONENT_QUERY* query,
+		int state
+	);
+
+	/// Pick the nearest visible component of a block instance of the active
+	/// document along a world line from lineFrom to lineTo (3 doubles each),
+	/// e.g. a viewport's frustum line through the mouse point. Hidden and
+	/// suppressed components are never hit. Curves, points and objects
+	/// without a render mesh are hit within tolerance of their bbox.
+	/// *outInstanceId receives the top-level instance and pathBuffer the
+	/// child indices of the component (at most capacity of them).
+	/// Returns the path depth, 0 if nothing was hit, or -1 on invalid arguments.
+	NATIVE_API int __stdcall PickComponent(
+		const double* lineFrom,
+		const double* lineTo,
+		double tolerance,
+		ON_UUID* outInstanceId,
+		int* pathBuffer,
+		int capacity
+	);
+
+	/// Export the block instance hierarchy of the active document in one call:
+	/// each top-level instance (sorted by id) followed by its components in
+	/// depth-first preorder, nested blocks down to maxDepth levels below it
+	/// (-1 = all). Records refer to their parent by index within buffer.
+	/// Returns the number of records required, or -1 on invalid arguments.
+	/// Only the first capacity records are written.
+	NATIVE_API int __stdcall ExportInstanceTree(
+		RAO_TREE_NODE* buffer,
+		int capacity,
+		int maxDepth
+	);
+
+	/// Export the components directly below one node of the hierarchy, for
+	/// lazy expansion: the definition components of an instance for depth 0,
+	/// else those of the nested block at the child-index path. Records have
+	/// parent -1. Returns the number of records required, or -1 if the path
+	/// does not address a block or on invalid arguments.
+	NATIVE_API int __stdcall ExportTreeChildren(
+		const ON_UUID* instanceId,
+		const int* path,
+		int depth,
+		RAO_TREE_NODE* buffer,
+		int capacity
+	);
+
+	/// Make the redraws pending for state changes of the active document now
+	/// instead of when Rhino goes idle (e.g. before capturing a view)
+	NATIVE_API void __stdcall FlushRedraws();
+
+	/// Get the state of a component addressed by its child-index sequence
+	/// (as GetComponentState, definition rules included).
+	/// Returns: 0=Visible, 1=Hidden, 2=Suppressed, 3=Transparent
+	NATIVE_API int __stdcall GetComponentStateByIndices(
+		const ON_UUID* instanceId,
+		const int* indices,
+		int depth
+	);
+
+	/// Get every non-visible component state of an instance in one call:
+	/// the states it is drawn with, its own over its definition's rules.
+	/// buffer receives packed int records in path order, one per state:
+	///   depth, index[0] .. index[depth - 1], state (1..3)
+	/// Returns the number of ints required (0 if every component is visible).
+	/// Only whole records that fit in capacity are written; if the return
+	/// value exceeds capacity, call again with a larger buffer.
+	NATIVE_API int __stdcall GetInstanceStates(
+		const ON_UUID* instanceId,
+		int* buffer,
+		int capacity
+	);
+
+	/// Multi-instance GetInstanceStates, read from one consistent snapshot.
+	/// For each of the instanceCount ids, in order, buffer receives the
+	/// record count followed by that instance's records.
+	/// Returns the number of ints required, or -1 on invalid arguments.
+	NATIVE_API int __stdcall GetMultiInstanceStates(
+		const ON_UUID* instanceIds,
+		int instanceCount,
+		int* buffer,
+		int capacity
+	);
+
+	/// Get the rules of definitions in one call, read from one consistent
+	/// snapshot. For each of the definitionCount ids, in order, buffer
+	/// receives the record count followed by records as GetInstanceStates.
+	/// Returns the number of ints required, or -1 on invalid arguments.
+	NATIVE_API int __stdcall GetMultiDefinitionStates(
+		const ON_UUID* definitionIds,
+		int definitionCount,
+		int* buffer,
+		int capacity
+	);
+
 	/// Attach persisted assembly metadata to an instance object.
 	NATIVE_API bool __stdcall AttachAssemblyData(
 		const ON_UUID* instanceId,
@@ -0,0 +1,145 @@
+// PathRemap.cpp : Definition layouts and path remapping
+
+#include "stdafx.h"
+#include "PathRemap.h"
+
+static const CRhinoInstanceDefinition* NestedDefinition(const CRhinoObject* pComponent)
+{
+	if (!pComponent || pComponent->ObjectType() != ON::instance_reference)
+		return nullptr;
+	return static_cast<const CRhinoInstanceObject*>(pComponent)->InstanceDefinition();
+}
+
+void CDefinitionLayouts::Capture(const CRhinoInstanceDefinition* pDef)
+{
+	Capture(pDef, 0);
+}
+
+void CDefinitionLayouts::Update(const CRhinoInstanceDefinition* pDef)
+{
+	if (!pDef)
+		return;
+	m_layouts.erase(pDef->Id());
+	Capture(pDef, 0);
+}
+
+void CDefinitionLayouts::Capture(const CRhinoInstanceDefinition* pDef, int depth)
+{
+	if (!pDef || depth > CComponentPath::MAX_NESTING_DEPTH)
+		return;
+
+	auto inserted = m_layouts.emplace(pDef->Id(), std::vector<ON_UUID>());
+	if (!inserted.second)
+		return;
+
+	const int componentCount = pDef->ObjectCount();
+	std::vector<ON_UUID>& layout = inserted.first->second;
+	layout.reserve(static_cast<size_t>(componentCount));
+	for (int i = 0; i < componentCount; i++)
+	{
+		const CRhinoObject* pComponent = pDef->Object(i);
+		layout.push_back(pComponent ? pComponent->Attributes().m_uuid : ON_nil_uuid);
+	}
+
+	// Recorded before recursing: definitions nested more than once are visited once
+	for (int i = 0; i < componentCount; i++)
+		Capture(NestedDefinition(pDef->Object(i)), depth + 1);
+}
+
+const std::vector<ON_UUID>* CDefinitionLayouts::Find(const ON_UUID& definitionId) const
+{
+	auto it = m_layouts.find(definitionId);
+	return it != m_layouts.end() ? &it->second : nullptr;
+}
+
+bool CDefinitionLayouts::IndexMap(const CRhinoInstanceDefinition* pDef, std::vector<int>& oldToNew) const
+{
+	oldToNew.clear();
+	const std::vector<ON_UUID>* pOld = pDef ? Find(pDef->Id()) : nullptr;
+	if (!pOld)
+		return false;
+
+	const int componentCount = pDef->ObjectCount();
+	std::unordered_map<ON_UUID, int, ON_UUID_Hash, ON_UUID_Equal> current;
+	current.reserve(static_cast<size_t>(componentCount));
+	for (int i = 0; i < componentCount; i++)
+	{
+		const CRhinoObject* pComponent = pDef->Object(i);
+		if (pComponent)
+			current.emplace(pComponent->Attributes().m_uuid, i);
+	}
+
+	bool moved = pOld->size() != static_cast<size_t>(componentCount);
+	oldToNew.resize(pOld->size(), -1);
+	for (size_t i = 0; i < pOld->size(); i++)
+	{
+		auto it = ON_UuidIsNil((*pOld)[i]) ? current.end() : current.find((*pOld)[i]);
+		if (it != current.end())
+			oldToNew[i] = it->second;
+		if (oldToNew[i] != static_cast<int>(i))
+			moved = true;
+	}
+
+	if (!moved)
+		oldToNew.clear();
+	return moved;
+}
+
+/// Rewrite one path level by level, following the nested definitions it
+/// passes through. Returns false if the component it addressed is gone.
+static bool RemapPath(
+	const CComponentPath& path,
+	const CRhinoInstanceDefinition* pDef,
+	const ON_UUID& editedId,
+	const std::vector<int>& oldToNew,
+	CComponentPath& out)
+{
+	for (int level = 0; level < path.Depth(); level++)
+	{
+		if (!pDef)
+			return false;
+
+		int index = path.At(level);
+		if (ON_UuidCompare(pDef->Id(), editedId) == 0)
+		{
+			if (index >= static_cast<int>(oldToNew.size()) || oldToNew[index] < 0)
+				return false;
+			index = oldToNew[index];
+		}
+		out.Push(index);
+
+		if (level + 1 < path.Depth())
+			pDef = NestedDefinition(pDef->Object(index));
+	}
+	return true;
+}
+
+bool RemapInstancePaths(
+	const CVisibilityTrieNode::Ptr& root,
+	const CRhinoInstanceDefinition* pRoot,
+	const ON_UUID& editedId,
+	const std::vector<int>& oldToNew,
+	CVisibilityTrieNode::Ptr& remapped)
+{
+	if (!root)
+		return false;
+
+	CVisibilityTrieEditor editor{ CVisibilityTrieNode::Ptr() };
+	bool changed = false;
+	root->ForEach([&](const CComponentPath& path, ComponentState state)
+	{
+		CComponentPath mapped;
+		if (!RemapPath(path, pRoot, editedId, oldToNew, mapped))
+		{
+			changed = true;
+			return;
+		}
+		if (!(mapped == path))
+			changed = true;
+		editor.Set(mapped, state);
+	});
+
+	if (changed)
+		remapped = editor.Commit();
+	return changed;
+}
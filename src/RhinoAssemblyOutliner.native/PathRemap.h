@@ -0,0 +1,64 @@
+// PathRemap.h : Carry component paths across instance definition edits
+//
+// Paths are raw indices into CRhinoInstanceDefinition::Object(i). A BlockEdit
+// that reorders, adds or removes components shifts those indices, so the
+// stored paths would address the wrong components afterwards.
+//
+// CDefinitionLayouts records, per definition reached by a managed instance,
+// the object UUID of every component in index order: the stable identity of
+// the component each path level points at. When a definition is modified the
+// recorded layout is matched against the current one by UUID and the stored
+// paths of every managed instance drawn through it are rewritten in one pass.
+// Components that kept their object UUID keep their state; states of removed
+// components are dropped.
+//
+// Layouts are recorded when instances are bound (CDocVisibility::BindInstances)
+// and refreshed after each remap. UI thread only, like the document events.
+
+#pragma once
+
+#include "VisibilityData.h"
+#include <unordered_map>
+#include <vector>
+
+class CDefinitionLayouts
+{
+public:
+	CDefinitionLayouts() = default;
+
+	CDefinitionLayouts(const CDefinitionLayouts&) = delete;
+	CDefinitionLayouts& operator=(const CDefinitionLayouts&) = delete;
+
+	/// Record pDef and every definition nested in it, skipping those already recorded
+	void Capture(const CRhinoInstanceDefinition* pDef);
+
+	/// Re-record pDef after an edit (nested definitions new to it are captured)
+	void Update(const CRhinoInstanceDefinition* pDef);
+
+	/// Drop the layout of a deleted definition
+	void Forget(const ON_UUID& definitionId) { m_layouts.erase(definitionId); }
+
+	/// Component UUIDs of a definition as last recorded, or nullptr
+	const std::vector<ON_UUID>* Find(const ON_UUID& definitionId) const;
+
+	/// Map old component indices of pDef to current ones (-1 = removed).
+	/// Returns false if pDef was never recorded or its layout is unchanged,
+	/// in which case no path needs remapping.
+	bool IndexMap(const CRhinoInstanceDefinition* pDef, std::vector<int>& oldToNew) const;
+
+private:
+	void Capture(const CRhinoInstanceDefinition* pDef, int depth);
+
+	std::unordered_map<ON_UUID, std::vector<ON_UUID>, ON_UUID_Hash, ON_UUID_Equal> m_layouts;
+};
+
+/// Rewrite the paths of one instance whose definition (pRoot) is, or nests,
+/// the edited definition. oldToNew comes from CDefinitionLayouts::IndexMap.
+/// Returns false if no stored path changed; otherwise remapped holds the new
+/// trie (nullptr if no state survived).
+bool RemapInstancePaths(
+	const CVisibilityTrieNode::Ptr& root,
+	const CRhinoInstanceDefinition* pRoot,
+	const ON_UUID& editedId,
+	const std::vector<int>& oldToNew,
+	CVisibilityTrieNode::Ptr& remapped);
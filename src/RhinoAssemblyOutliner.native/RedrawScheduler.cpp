@@ -0,0 +1,121 @@
+// RedrawScheduler.cpp : Coalesced region redraws
+
+#include "stdafx.h"
+#include "RedrawScheduler.h"
+#include "DocVisibilityRegistry.h"
+
+CRedrawScheduler::CRedrawScheduler(CVisibilityConduit& conduit, CConduitStats& stats)
+	: m_conduit(conduit)
+	, m_stats(stats)
+{
+}
+
+void CRedrawScheduler::MarkInstances(CRhinoDoc& doc, const ON_UUID* instanceIds, size_t count)
+{
+	if (IsPending())
+		CConduitStats::Add(m_stats.redrawsCoalesced);
+	if (m_all)
+		return;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		const CRhinoObject* pObject = doc.LookupObject(instanceIds[i]);
+		if (!pObject || pObject->ObjectType() != ON::instance_reference)
+			continue;
+
+		// Frames drawn between two changes may each have shown it elsewhere
+		const ON_BoundingBox drawn = m_conduit.DrawnBBox(static_cast<const CRhinoInstanceObject*>(pObject));
+		auto inserted = m_instances.emplace(instanceIds[i], drawn);
+		if (!inserted.second && drawn.IsValid())
+			inserted.first->second.Union(drawn);
+	}
+}
+
+void CRedrawScheduler::MarkAll()
+{
+	if (IsPending())
+		CConduitStats::Add(m_stats.redrawsCoalesced);
+
+	m_all = true;
+	m_instances.clear();
+}
+
+bool CRedrawScheduler::ShowsRegion(const ON_Viewport& vp) const
+{
+	ON_ClippingRegion clipping;
+	clipping.SetObjectToClipTransformation(vp);
+	for (const ON_BoundingBox& region : m_regions)
+	{
+		if (clipping.IsVisible(region) != 0)
+			return true;
+	}
+	return false;
+}
+
+void CRedrawScheduler::RedrawView(CRhinoView* pView, bool redraw)
+{
+	if (!redraw)
+	{
+		CConduitStats::Add(m_stats.viewsSkipped);
+		return;
+	}
+
+	pView->Redraw();
+	CConduitStats::Add(m_stats.viewsRedrawn);
+}
+
+void CRedrawScheduler::Flush(CRhinoDoc& doc)
+{
+	if (!IsPending())
+		return;
+
+	// Where each instance was drawn and where it is drawn now
+	m_regions.clear();
+	for (const auto& pair : m_instances)
+	{
+		if (pair.second.IsValid())
+			m_regions.push_back(pair.second);
+
+		const CRhinoObject* pObject = doc.LookupObject(pair.first);
+		if (!pObject || pObject->ObjectType() != ON::instance_reference)
+			continue;
+
+		const ON_BoundingBox visible = m_conduit.VisibleBBox(static_cast<const CRhinoInstanceObject*>(pObject));
+		if (visible.IsValid())
+			m_regions.push_back(visible);
+	}
+
+	const bool all = m_all;
+	m_all = false;
+	m_instances.clear();
+
+	m_views.Empty();
+	doc.GetViewList(m_views, true, false);
+	for (int i = 0; i < m_views.Count(); i++)
+	{
+		if (m_views[i])
+			RedrawView(m_views[i], all || ShowsRegion(m_views[i]->ActiveViewport().VP()));
+	}
+
+	m_views.Empty();
+	doc.GetViewList(m_views, false, true);
+	for (int i = 0; i < m_views.Count(); i++)
+	{
+		if (m_views[i])
+			RedrawView(m_views[i], all || !m_regions.empty());
+	}
+	m_views.Empty();
+}
+
+CRedrawIdleWatcher::CRedrawIdleWatcher(const ON_UUID& plugInId, CDocVisibilityRegistry& registry)
+	: CRhinoIsIdle(plugInId)
+	, m_registry(registry)
+{
+	Register();
+	Enable(true);
+}
+
+void CRedrawIdleWatcher::Notify(const CRhinoIsIdle::CParameters& params)
+{
+	m_registry.FlushRedraws();
+}
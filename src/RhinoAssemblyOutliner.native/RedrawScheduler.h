@@ -0,0 +1,75 @@
+// RedrawScheduler.h : Coalesced redraws of the views a visibility change shows in
+//
+// State changes do not redraw the document on the spot. Each change records
+// the instances it touched with the world bbox they were last drawn with
+// (CVisibilityConduit::DrawnBBox: the conduit's bboxes still describe the
+// last frame until it draws again). When Rhino goes idle, each instance adds
+// the bbox of the components it is drawn with now, and only the views whose
+// frustum meets one of these regions are redrawn. However many changes were
+// made since the last idle (a slider scrubbing states, hover previews), each
+// view is redrawn at most once.
+//
+// Changes without a known extent (definition rules, state tables, display
+// settings) redraw every view of the document. Page views are always
+// redrawn: their details are not tested.
+//
+// UI thread only, like the registry.
+
+#pragma once
+
+#include "ConduitStats.h"
+#include "VisibilityConduit.h"
+#include <unordered_map>
+#include <vector>
+
+class CDocVisibilityRegistry;
+
+class CRedrawScheduler
+{
+public:
+	CRedrawScheduler(CVisibilityConduit& conduit, CConduitStats& stats);
+
+	CRedrawScheduler(const CRedrawScheduler&) = delete;
+	CRedrawScheduler& operator=(const CRedrawScheduler&) = delete;
+
+	/// Record instances of doc whose states changed since its last frame
+	void MarkInstances(CRhinoDoc& doc, const ON_UUID* instanceIds, size_t count);
+
+	/// Record a change that may show anywhere in the document
+	void MarkAll();
+
+	/// Whether a redraw is pending
+	bool IsPending() const { return m_all || !m_instances.empty(); }
+
+	/// Redraw the views of doc that show a recorded region and forget the
+	/// records. Does nothing if no redraw is pending.
+	void Flush(CRhinoDoc& doc);
+
+private:
+	/// Whether the view frustum of vp meets one of m_regions
+	bool ShowsRegion(const ON_Viewport& vp) const;
+
+	/// Redraw pView (if redraw) and count it
+	void RedrawView(CRhinoView* pView, bool redraw);
+
+	CVisibilityConduit& m_conduit;
+	CConduitStats& m_stats;
+
+	/// Changed instances and the bbox each was last drawn with (invalid = nothing drawn)
+	std::unordered_map<ON_UUID, ON_BoundingBox, ON_UUID_Hash, ON_UUID_Equal> m_instances;
+	bool m_all = false;                       ///< Redraw every view
+	std::vector<ON_BoundingBox> m_regions;    ///< Scratch for Flush
+	ON_SimpleArray<CRhinoView*> m_views;      ///< Scratch for Flush
+};
+
+/// Flushes the pending redraws of every document when Rhino goes idle
+class CRedrawIdleWatcher : public CRhinoIsIdle
+{
+public:
+	CRedrawIdleWatcher(const ON_UUID& plugInId, CDocVisibilityRegistry& registry);
+
+	void Notify(const CRhinoIsIdle::CParameters& params) override;
+
+private:
+	CDocVisibilityRegistry& m_registry;
+};
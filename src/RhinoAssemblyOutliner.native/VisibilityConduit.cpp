@@ -3,40 +3,115 @@
 // Core logic: in SC_DRAWOBJECT, suppress managed instances via
 // m_bDrawObject = false, then manually draw only visible components
 // using dp.DrawObject() which uses Rhino's own rendering path.
+// The visible components come from a cached draw list per (definition,
+// component states), so the definition tree is only walked on a cache miss.
+// Large lists are culled against the view frustum through their BVH, so
+// off-screen groups of components are never sent to the pipeline. Instances
+// below the LOD threshold on screen draw one cached box proxy instead, and
+// (opt-in) instances whose draw list has been drawn for a while draw its
+// render meshes merged per display color.
+//
+// Instances of a definition with rules are taken over as well, whether or not
+// they have states of their own (EffectiveState).
 //
 // SC_CALCBOUNDINGBOX: computes bbox for only visible components of
-// managed instances, so ZoomExtents works correctly.
+// managed instances, so ZoomExtents works correctly. World bboxes are cached
+// per instance and recomputed only when its transform, definition or its own
+// component states changed.
+//
+// PickComponent: hit-tests the draw lists of the instances along a pick line,
+// bbox first at every level (instance, BVH node, entry), so hidden and
+// suppressed components are never picked.
 //
-// SC_POSTDRAWOBJECTS: draws selection highlights using DrawObject
-// instead of manual per-edge extraction (no heap allocs per frame).
+// SC_POSTDRAWOBJECTS: draws CS_TRANSPARENT components queued during
+// SC_DRAWOBJECT in one back-to-front pass (depth writes off, one display
+// material per run of equal colors), then selection highlights: the cached
+// wireframe of the draw list of each selected instance drawn in the frame,
+// in the selection color.
 //
-// Snapshot pattern: takes one lock-free snapshot at frame start,
-// uses it for all visibility checks during the frame.
+// Snapshot pattern: picks up the published immutable snapshot at frame start
+// (no copy; re-acquired only when the visibility generation changed) and
+// uses it for all visibility checks during the frame. Every viewport of the
+// document runs the same conduit, so one snapshot serves all of them.
 
 #include "stdafx.h"
 #include "VisibilityConduit.h"
+#include <algorithm>
 #include <cstdio>
 
-CVisibilityConduit::CVisibilityConduit(CVisibilityData& visData)
+// Transparency of CS_TRANSPARENT components (0 = opaque, 1 = invisible)
+static const double TRANSPARENT_COMPONENT_TRANSPARENCY = 0.7;
+
+// Frames a draw list must have been drawn in before its meshes are merged,
+// so lists of states still being edited are never merged
+static const int MERGE_AFTER_FRAMES = 60;
+
+// Render mesh vertices a draw list copies for its merge per frame, so the
+// copy of a large list is spread over several frames
+static const int MERGE_COPY_VERTICES = 1 << 16;
+
+/// Whether a component takes its color or material from the instance it is drawn in
+static bool InheritsFromParent(const CRhinoObject* pComponent)
+{
+	const ON_3dmObjectAttributes& attrs = pComponent->Attributes();
+	return attrs.ColorSource() == ON::color_from_parent || attrs.MaterialSource() == ON::material_from_parent;
+}
+
+/// Color of a layer of pDoc (gray if there is no such layer)
+static ON_Color LayerColor(int layerIndex, const CRhinoDoc* pDoc)
+{
+	if (pDoc && layerIndex >= 0 && layerIndex < pDoc->m_layer_table.LayerCount())
+		return pDoc->m_layer_table[layerIndex].Color();
+	return ON_Color(128, 128, 128);
+}
+
+/// Render material index of a component drawn as part of pInstance
+/// (-1 = the default material)
+static int MaterialIndex(const CRhinoObject* pComponent, const CRhinoObject* pInstance, const CRhinoDoc* pDoc)
+{
+	const ON_3dmObjectAttributes& attrs = pComponent->Attributes();
+	if (attrs.MaterialSource() == ON::material_from_object)
+		return attrs.m_material_index;
+	if (attrs.MaterialSource() == ON::material_from_parent && pInstance)
+		return MaterialIndex(pInstance, nullptr, pDoc);
+
+	if (pDoc && attrs.m_layer_index >= 0 && attrs.m_layer_index < pDoc->m_layer_table.LayerCount())
+		return pDoc->m_layer_table[attrs.m_layer_index].RenderMaterialIndex();
+	return -1;
+}
+
+CVisibilityConduit::CVisibilityConduit(CVisibilityData& visData, CConduitStats& stats, unsigned int docSerial)
 	: CRhinoDisplayConduit(
 		CSupportChannels::SC_PREDRAWOBJECTS |
 		CSupportChannels::SC_CALCBOUNDINGBOX |
 		CSupportChannels::SC_DRAWOBJECT |
 		CSupportChannels::SC_POSTDRAWOBJECTS)
 	, m_visData(visData)
+	, m_docSerial(docSerial)
+	, m_unfiltered(std::make_shared<CVisibilityTrieNode>())
+	, m_stats(stats)
 {
 }
 
+CVisibilityConduit::~CVisibilityConduit()
+{
+	m_drawLists.Clear();
+	UpdateDrawListGauge();
+}
+
 bool CVisibilityConduit::ExecConduit(
 	CRhinoDisplayPipeline& dp,
 	UINT nChannel,
 	bool& bTerminate)
 {
-	// --- SC_PREDRAWOBJECTS: take snapshot once per frame ---
+	// --- SC_PREDRAWOBJECTS: refresh snapshot once per frame ---
 	if (nChannel == CSupportChannels::SC_PREDRAWOBJECTS)
 	{
-		m_snapshot = m_visData.TakeSnapshot();
-		m_snapshotValid = true;
+		CConduitStats::Add(m_stats.frames);
+		m_frame++;
+		m_mergedThisFrame = false;
+		RefreshSnapshot();
+		m_scratch.Reset(); // In case the last frame ended before SC_POSTDRAWOBJECTS
 		return true;
 	}
 
@@ -45,23 +120,24 @@ bool CVisibilityConduit::ExecConduit(
 	{
 		// Ensure we have a snapshot (in case SC_PREDRAWOBJECTS wasn't called)
 		if (!m_snapshotValid)
-		{
-			m_snapshot = m_visData.TakeSnapshot();
-			m_snapshotValid = true;
-		}
-		CalcVisibleBoundingBox();
+			RefreshSnapshot();
+		CStatsTimer timer(m_stats.bboxTicks);
+		if (CRhinoDoc* pDoc = DrawnDoc(dp))
+			CalcVisibleBoundingBox(*pDoc);
 		return true;
 	}
 
-	// --- SC_POSTDRAWOBJECTS: draw selection highlights ---
+	// --- SC_POSTDRAWOBJECTS: draw transparent components, then selection highlights ---
 	if (nChannel == CSupportChannels::SC_POSTDRAWOBJECTS)
 	{
 		if (!m_snapshotValid)
+			RefreshSnapshot();
+		DrawTransparentComponents(dp);
 		{
-			m_snapshot = m_visData.TakeSnapshot();
-			m_snapshotValid = true;
+			CStatsTimer timer(m_stats.highlightTicks);
+			DrawSelectionHighlights(dp);
 		}
-		DrawSelectionHighlights(dp);
+		m_scratch.Reset();
 		m_snapshotValid = false; // Frame is done
 		return true;
 	}
@@ -83,118 +159,215 @@ bool CVisibilityConduit::ExecConduit(
 
 	// Ensure snapshot (fallback if SC_PREDRAWOBJECTS wasn't hit)
 	if (!m_snapshotValid)
+		RefreshSnapshot();
+
+	// Check if this instance is managed by us, or its definition has rules
+	const CVisibilityTrieNode::Ptr* pOwn = m_snapshot->FindInstanceRoot(instanceId);
+	if (!pOwn && m_snapshot->Rules().empty())
+		return true;
+
+	const CRhinoInstanceObject* pInstance =
+		static_cast<const CRhinoInstanceObject*>(pObject);
+	const CRhinoInstanceDefinition* pDef = pInstance->InstanceDefinition();
+	if (!pDef)
 	{
-		m_snapshot = m_visData.TakeSnapshot();
-		m_snapshotValid = true;
+		if (pOwn)
+			m_pChannelAttrs->m_bDrawObject = false;
+		return true;
 	}
 
-	// Check if this instance is managed by us
-	if (!m_snapshot.IsManaged(instanceId))
+	// Overrides cancelling every rule leave nothing to filter
+	const CVisibilityTrieNode::Ptr* pRoot = EffectiveState(pDef, pOwn);
+	if (!pRoot || !*pRoot)
+		return true;
+
+	// --- This instance has hidden components: take over drawing ---
+
+	// Suppress the default drawing of this object
+	m_pChannelAttrs->m_bDrawObject = false;
+
+	CStatsTimer timer(m_stats.drawTicks);
+
+	if (pInstance->IsSelected())
+		m_scratch.selected.push_back({ pInstance, pDef, *pRoot });
+
+	// Flattened visible components, shared by all instances of this definition
+	// with the same component states
+	bool built = false;
+	const CFilteredDrawList* pList = m_drawLists.Get(pDef, *pRoot, &built);
+	if (!pList)
 		return true;
 
+	if (built)
+	{
+		CConduitStats::Add(m_stats.drawListBuilds);
+		UpdateDrawListGauge();
+	}
+	else
+	{
+		CConduitStats::Add(m_stats.drawListHits);
+	}
+	CConduitStats::Add(m_stats.instancesDrawn);
+	CConduitStats::Add(m_stats.componentsSkipped, static_cast<uint64_t>(pList->SkippedCount()));
+	m_stats.NoteDepth(pList->MaxDepth());
+
 	if (m_debugLogging)
 	{
 		char buf[64];
 		ON_UuidToString(instanceId, buf);
 		ON_wString msg;
-		msg.Format(L"[Conduit] SC_DRAWOBJECT: instance %S, managed=YES, suppressing default draw\n", buf);
+		msg.Format(L"[Conduit] SC_DRAWOBJECT: instance %S, managed=YES, replaying %d of %d components (%d cached lists)\n",
+			buf, (int)pList->Entries().size(), pDef->ObjectCount(), (int)m_drawLists.Size());
 		RhinoApp().Print(msg);
 	}
 
-	// --- This instance has hidden components: take over drawing ---
+	ON_Xform instanceXform = pInstance->InstanceXform();
 
-	// Suppress the default drawing of this object
-	m_pChannelAttrs->m_bDrawObject = false;
+	if (m_lodPixels > 0.0 && DrawLodProxy(dp, *pList, pInstance, instanceXform))
+	{
+		CConduitStats::Add(m_stats.instancesProxied);
+		return true;
+	}
 
-	const CRhinoInstanceObject* pInstance =
-		static_cast<const CRhinoInstanceObject*>(pObject);
-	const CRhinoInstanceDefinition* pDef = pInstance->InstanceDefinition();
-	if (!pDef)
+	if (m_pJobs && DrawMerged(dp, *pList, pInstance, instanceXform))
+	{
+		CConduitStats::Add(m_stats.instancesMerged);
 		return true;
+	}
 
-	ON_Xform instanceXform = pInstance->InstanceXform();
+	const int culled = DrawListCulled(dp, *pList, pInstance, instanceXform);
+	CConduitStats::Add(m_stats.componentsDrawn, pList->Entries().size() - static_cast<size_t>(culled));
+	CConduitStats::Add(m_stats.componentsCulled, static_cast<uint64_t>(culled));
+
+	// Selection highlight is handled in SC_POSTDRAWOBJECTS, not here.
+
+	return true;
+}
+
+void CVisibilityConduit::DrawEntries(
+	CRhinoDisplayPipeline& dp,
+	const CFilteredDrawList& list,
+	int first,
+	int count,
+	const CRhinoObject* pInstance,
+	const ON_Xform& instanceXform)
+{
+	const std::vector<CDrawListEntry>& entries = list.Entries();
+	for (int i = first; i < first + count; i++)
+	{
+		const CDrawListEntry& entry = entries[i];
+		const ON_Xform combinedXform = entry.identity ? instanceXform : instanceXform * entry.xform;
+
+		// CS_TRANSPARENT: deferred to the sorted pass in SC_POSTDRAWOBJECTS
+		if (entry.state == CS_TRANSPARENT)
+			QueueTransparent(dp, entry.pObject, pInstance, combinedXform);
+		else
+			DrawComponent(dp, entry.pObject, combinedXform);
+	}
+}
+
+int CVisibilityConduit::DrawListCulled(
+	CRhinoDisplayPipeline& dp,
+	const CFilteredDrawList& list,
+	const CRhinoObject* pInstance,
+	const ON_Xform& instanceXform)
+{
+	const std::vector<CDrawListBvhNode>& bvh = list.Bvh();
+	const int entryCount = static_cast<int>(list.Entries().size());
+	if (bvh.empty())
+	{
+		DrawEntries(dp, list, 0, entryCount, pInstance, instanceXform);
+		return 0;
+	}
+
+	// Depth-first over the BVH; median splits keep it far shallower than the stack
+	int stack[64];
+	int top = 0;
+	int culled = 0;
+	stack[top++] = 0;
 
-	// Iterate definition components, skip hidden ones using path-based lookup
-	int componentCount = pDef->ObjectCount();
-	for (int i = 0; i < componentCount; i++)
+	while (top > 0)
 	{
-		std::string path = std::to_string(i);
-		ComponentState state = m_snapshot.GetComponentState(instanceId, path.c_str());
+		const int index = stack[--top];
+		const CDrawListBvhNode& node = bvh[index];
 
-		// Skip hidden and suppressed components
-		if (state == CS_HIDDEN || state == CS_SUPPRESSED)
+		ON_BoundingBox worldBBox = node.bbox;
+		worldBBox.Transform(instanceXform);
+		if (!dp.IsVisible(worldBBox))
 		{
-			if (m_debugLogging)
-			{
-				ON_wString msg;
-				msg.Format(L"[Conduit]   component[%d] path=\"%S\" => state=%d, skipping\n",
-					i, path.c_str(), (int)state);
-				RhinoApp().Print(msg);
-			}
+			culled += node.count;
 			continue;
 		}
 
-		const CRhinoObject* pComponent = pDef->Object(i);
-		if (!pComponent)
+		if (node.right < 0 || top + 2 > static_cast<int>(sizeof(stack) / sizeof(stack[0])))
+		{
+			DrawEntries(dp, list, node.first, node.count, pInstance, instanceXform);
 			continue;
+		}
 
-		// Skip objects that are hidden in the definition
-		if (!pComponent->IsVisible())
-			continue;
+		stack[top++] = node.right;
+		stack[top++] = index + 1;
+	}
 
-		if (pComponent->ObjectType() == ON::instance_reference)
-		{
-			// Nested block instance — check if it has hidden descendants
-			const CRhinoInstanceObject* pNestedInstance =
-				static_cast<const CRhinoInstanceObject*>(pComponent);
+	// Entries without a bbox are always drawn
+	DrawEntries(dp, list, list.BoundedCount(), entryCount - list.BoundedCount(), pInstance, instanceXform);
+	return culled;
+}
 
-			if (m_snapshot.HasHiddenDescendants(instanceId, path.c_str()))
-			{
-				if (m_debugLogging)
-				{
-					ON_wString msg;
-					msg.Format(L"[Conduit]   component[%d] path=\"%S\" => nested block with hidden descendants, recursing\n", i, path.c_str());
-					RhinoApp().Print(msg);
-				}
-				DrawNestedFiltered(dp, pNestedInstance, instanceXform, instanceId, path, 0);
-			}
-			else
-			{
-				if (m_debugLogging)
-				{
-					ON_wString msg;
-					msg.Format(L"[Conduit]   component[%d] path=\"%S\" => nested block, no hidden descendants, DrawObject\n", i, path.c_str());
-					RhinoApp().Print(msg);
-				}
-				DrawComponent(dp, pComponent, instanceXform);
-			}
+void CVisibilityConduit::RefreshSnapshot()
+{
+	if (!m_snapshot || m_snapshot->Generation() != m_visData.GetGeneration())
+	{
+		CStatsTimer timer(m_stats.snapshotTicks);
+		CConduitStats::Add(m_stats.snapshotRefreshes);
+
+		std::shared_ptr<const CVisibilitySnapshot> snapshot = m_visData.AcquireSnapshot();
+
+		// Changed definitions: their cached lists and bboxes may point to
+		// replaced components. Unknown changes drop everything.
+		if (!m_snapshot || !snapshot->GetDefinitionChangesSince(m_snapshot->DefinitionEpoch(), m_changedDefinitions))
+		{
+			m_drawLists.Clear();
+			m_instanceBBoxes.clear();
 		}
 		else
 		{
-			if (m_debugLogging)
+			if (!m_changedDefinitions.empty())
 			{
-				ON_wString msg;
-				msg.Format(L"[Conduit]   component[%d] path=\"%S\" type=%d state=%d => DrawObject\n",
-					i, path.c_str(), pComponent->ObjectType(), (int)state);
-				RhinoApp().Print(msg);
-			}
+				m_drawLists.Invalidate(m_changedDefinitions);
 
-			// CS_TRANSPARENT: draw normally for now
-			// TODO: proper transparency needs display mode override or custom material push
-			if (state == CS_TRANSPARENT)
-			{
-				DrawComponent(dp, pComponent, instanceXform);
-			}
-			else
-			{
-				DrawComponent(dp, pComponent, instanceXform);
+				// Only bound instances have cached bboxes: the reverse index
+				// finds all of them without scanning the cache
+				for (const ON_UUID& definitionId : m_changedDefinitions)
+				{
+					if (const std::vector<ON_UUID>* pInstances = snapshot->InstancesOfDefinition(definitionId))
+					{
+						for (const ON_UUID& instanceId : *pInstances)
+							m_instanceBBoxes.erase(instanceId);
+					}
+				}
 			}
+
+			// Drop lists nobody used since the last change
+			m_drawLists.Prune();
 		}
-	}
+		UpdateDrawListGauge();
 
-	// Selection highlight is handled in SC_POSTDRAWOBJECTS, not here.
+		// Keyed by nodes of the snapshot being replaced
+		m_overlays.clear();
 
-	return true;
+		m_snapshot = snapshot;
+
+		// Forget bboxes of instances that are no longer managed
+		for (auto it = m_instanceBBoxes.begin(); it != m_instanceBBoxes.end();)
+		{
+			if (m_snapshot->IsManaged(it->first))
+				++it;
+			else
+				it = m_instanceBBoxes.erase(it);
+		}
+	}
+	m_snapshotValid = true;
 }
 
 void CVisibilityConduit::DrawComponent(
@@ -208,290 +381,559 @@ void CVisibilityConduit::DrawComponent(
 	dp.DrawObject(pComponent, &xform);
 }
 
-void CVisibilityConduit::DrawNestedFiltered(
+bool CVisibilityConduit::IsActiveViewport(CRhinoDisplayPipeline& dp) const
+{
+	const CRhinoView* pView = RhinoApp().ActiveView();
+	return pView && ON_UuidCompare(pView->ActiveViewportID(), dp.GetRhinoVP().ViewportId()) == 0;
+}
+
+CRhinoDoc* CVisibilityConduit::DrawnDoc(CRhinoDisplayPipeline& dp) const
+{
+	// Never the active document: another document's views draw too
+	CRhinoDoc* pDoc = dp.GetRhinoDoc();
+	return pDoc ? pDoc : CRhinoDoc::FromRuntimeSerialNumber(m_docSerial);
+}
+
+void CVisibilityConduit::UpdateDrawListGauge()
+{
+	// Unsigned wrap-around makes a shrinking cache subtract from the gauge
+	const size_t size = m_drawLists.Size();
+	CConduitStats::Add(m_stats.cachedDrawLists, static_cast<uint64_t>(size) - static_cast<uint64_t>(m_gaugeDrawLists));
+	m_gaugeDrawLists = size;
+}
+
+bool CVisibilityConduit::DrawLodProxy(
 	CRhinoDisplayPipeline& dp,
-	const CRhinoInstanceObject* pNestedInstance,
-	const ON_Xform& parentXform,
-	const ON_UUID& topLevelId,
-	const std::string& parentPath,
-	int depth)
+	const CFilteredDrawList& list,
+	const CRhinoObject* pInstance,
+	const ON_Xform& instanceXform)
 {
-	if (!pNestedInstance || depth >= MAX_NESTING_DEPTH)
+	const CLodProxy& proxy = list.LodProxy();
+	if (!proxy.bbox.IsValid())
+		return false;
+
+	// Screen size of the world bbox diagonal at its center
+	ON_BoundingBox worldBBox = proxy.bbox;
+	worldBBox.Transform(instanceXform);
+	double pixelsPerUnit = 0.0;
+	if (!dp.VP().GetWorldToScreenScale(worldBBox.Center(), &pixelsPerUnit)
+		|| worldBBox.Diagonal().Length() * pixelsPerUnit >= m_lodPixels)
+		return false;
+
+	const ON_Color color = GetComponentColor(pInstance, nullptr, DrawnDoc(dp));
+	const CDisplayPipelineAttributes* pAttrs = dp.DisplayAttrs();
+
+	dp.PushModelTransform(instanceXform);
+	if (pAttrs && pAttrs->m_bShadeSurface)
+	{
+		dp.SetupDisplayMaterial(m_scratch.material, color);
+		dp.DrawShadedMesh(proxy.mesh, &m_scratch.material);
+	}
+	else
+	{
+		dp.DrawLines(proxy.edges, color);
+	}
+	dp.PopModelTransform();
+	return true;
+}
+
+bool CVisibilityConduit::DrawMerged(
+	CRhinoDisplayPipeline& dp,
+	const CFilteredDrawList& list,
+	const CRhinoObject* pInstance,
+	const ON_Xform& instanceXform)
+{
+	// Selected instances draw per component so the highlight matches exactly
+	const CDisplayPipelineAttributes* pAttrs = dp.DisplayAttrs();
+	if (!pAttrs || !pAttrs->m_bShadeSurface || pInstance->IsSelected())
+		return false;
+
+	// Drawn per component until the worker has published the merge
+	const CMergedMesh* pMerged = list.MergedMesh();
+	if (!pMerged)
+	{
+		if (list.NoteDrawnFrame(m_frame) >= MERGE_AFTER_FRAMES && !list.MergeRequested() && !m_mergedThisFrame)
+		{
+			// One list copies meshes per frame, a bounded amount of them
+			m_mergedThisFrame = true;
+			if (list.RequestMerge(*m_pJobs, IsActiveViewport(dp) ? JOB_PRIORITY_VISIBLE : JOB_PRIORITY_BACKGROUND, MERGE_COPY_VERTICES))
+				CConduitStats::Add(m_stats.mergedMeshBuilds);
+		}
+		return false;
+	}
+
+	// Group materials are resolved every frame, so layer and material edits
+	// show. Isocurves come with the full wireframe; without them only the
+	// brep edges are drawn.
+	const CRhinoDoc* pDoc = DrawnDoc(dp);
+	CDisplayPipelineMaterial& material = m_scratch.material;
+	dp.PushModelTransform(instanceXform);
+	for (const CMergedMeshGroup& group : pMerged->groups)
+	{
+		SetupComponentMaterial(dp, material, group.pMaterialSource, pInstance, pDoc);
+		dp.DrawShadedMesh(*group.mesh, &material);
+
+		const ON_SimpleArray<ON_Line>* pWires = pAttrs->m_bShowIsocurves ? &group.wires
+			: pAttrs->m_bShowSurfaceEdges ? &group.edges : nullptr;
+		if (pWires && pWires->Count() > 0)
+			dp.DrawLines(*pWires, GetComponentColor(group.pMaterialSource, pInstance, pDoc));
+	}
+	dp.PopModelTransform();
+
+	for (int index : pMerged->unmerged)
+		DrawEntries(dp, list, index, 1, pInstance, instanceXform);
+	return true;
+}
+
+void CVisibilityConduit::QueueTransparent(
+	CRhinoDisplayPipeline& dp,
+	const CRhinoObject* pComponent,
+	const CRhinoObject* pInstance,
+	const ON_Xform& xform)
+{
+	if (!pComponent)
 		return;
 
-	const CRhinoInstanceDefinition* pDef = pNestedInstance->InstanceDefinition();
-	if (!pDef)
+	const ON_Viewport& vp = dp.VP();
+	const ON_3dPoint center = xform * pComponent->BoundingBox().Center();
+
+	CTransparentItem item;
+	item.pObject = pComponent;
+	item.pInstance = pInstance;
+	item.xform = xform;
+	item.depth = (center - vp.CameraLocation()) * vp.CameraDirection();
+	m_scratch.transparent.push_back(item);
+}
+
+void CVisibilityConduit::DrawTransparentComponents(CRhinoDisplayPipeline& dp)
+{
+	std::vector<CTransparentItem>& transparent = m_scratch.transparent;
+	if (transparent.empty())
 		return;
 
-	ON_Xform combinedXform = parentXform * pNestedInstance->InstanceXform();
+	CStatsTimer timer(m_stats.transparentTicks);
+	CConduitStats::Add(m_stats.transparentDrawn, transparent.size());
 
-	int componentCount = pDef->ObjectCount();
-	for (int i = 0; i < componentCount; i++)
-	{
-		std::string childPath = BuildPath(parentPath, i);
-		ComponentState state = m_snapshot.GetComponentState(topLevelId, childPath.c_str());
+	// Back to front, so blending composes correctly
+	std::sort(transparent.begin(), transparent.end(),
+		[](const CTransparentItem& a, const CTransparentItem& b) { return a.depth > b.depth; });
+
+	const CRhinoDoc* pDoc = DrawnDoc(dp);
+	CDisplayPipelineMaterial& material = m_scratch.transparentMaterial;
+	ON_SimpleArray<const ON_Mesh*>& meshes = m_scratch.meshes;
+	const CTransparentItem* pMaterialItem = nullptr;
+
+	// Transparent surfaces must not occlude each other or later geometry
+	dp.PushDepthWriting(false);
 
-		if (state == CS_HIDDEN || state == CS_SUPPRESSED)
+	for (const CTransparentItem& item : transparent)
+	{
+		meshes.Empty();
+		if (item.pObject->GetMeshes(ON::render_mesh, meshes) <= 0)
 		{
-			if (m_debugLogging)
-			{
-				ON_wString msg;
-				msg.Format(L"[Conduit]   nested path=\"%S\" => state=%d, skipping\n",
-					childPath.c_str(), (int)state);
-				RhinoApp().Print(msg);
-			}
+			// Curves, points, annotations (or not yet meshed): nothing to shade
+			DrawComponent(dp, item.pObject, item.xform);
 			continue;
 		}
 
-		const CRhinoObject* pComponent = pDef->Object(i);
-		if (!pComponent || !pComponent->IsVisible())
-			continue;
-
-		if (pComponent->ObjectType() == ON::instance_reference)
+		// Set up the material once per run of components drawn alike;
+		// by-parent ones only share it within one instance
+		if (!pMaterialItem || !SameDisplayMaterial(pMaterialItem->pObject, item.pObject)
+			|| (pMaterialItem->pInstance != item.pInstance && InheritsFromParent(item.pObject)))
 		{
-			const CRhinoInstanceObject* pDeeper =
-				static_cast<const CRhinoInstanceObject*>(pComponent);
-
-			if (m_snapshot.HasHiddenDescendants(topLevelId, childPath.c_str()))
-			{
-				DrawNestedFiltered(dp, pDeeper, combinedXform, topLevelId, childPath, depth + 1);
-			}
-			else
-			{
-				DrawComponent(dp, pComponent, combinedXform);
-			}
+			SetupComponentMaterial(dp, material, item.pObject, item.pInstance, pDoc);
+			material.m_FrontMaterial.SetTransparency(TRANSPARENT_COMPONENT_TRANSPARENCY);
+			material.m_BackMaterial.SetTransparency(TRANSPARENT_COMPONENT_TRANSPARENCY);
+			pMaterialItem = &item;
 		}
-		else
+
+		dp.PushModelTransform(item.xform);
+		for (int m = 0; m < meshes.Count(); m++)
 		{
-			// CS_TRANSPARENT treated same as visible for now
-			// TODO: proper transparency needs display mode override
-			DrawComponent(dp, pComponent, combinedXform);
+			if (meshes[m])
+				dp.DrawShadedMesh(*meshes[m], &material);
 		}
+		dp.PopModelTransform();
 	}
+
+	dp.PopDepthWriting();
 }
 
 void CVisibilityConduit::DrawSelectionHighlights(CRhinoDisplayPipeline& dp)
 {
-	CRhinoDoc* pDoc = RhinoApp().ActiveDoc();
-	if (!pDoc)
+	if (m_scratch.selected.empty())
 		return;
 
-	std::vector<ON_UUID> managedIds;
-	m_snapshot.GetManagedInstanceIds(managedIds);
+	const ON_Color selColor = RhinoApp().AppSettings().SelectedObjectColor();
 
-	for (const auto& instanceId : managedIds)
+	for (const CSelectedItem& item : m_scratch.selected)
 	{
-		const CRhinoObject* pObj = pDoc->LookupObject(instanceId);
-		if (!pObj || !pObj->IsSelected() || pObj->ObjectType() != ON::instance_reference)
-			continue;
-
-		const CRhinoInstanceObject* pInstance =
-			static_cast<const CRhinoInstanceObject*>(pObj);
-		const CRhinoInstanceDefinition* pDef = pInstance->InstanceDefinition();
-		if (!pDef)
+		// Same draw list as SC_DRAWOBJECT, so nested filtered blocks are
+		// highlighted exactly as drawn; its wireframe is tessellated once
+		// per (definition, states) and drawn in one batch per instance
+		const CFilteredDrawList* pList = m_drawLists.Get(item.pDefinition, item.state);
+		if (!pList)
 			continue;
 
-		ON_Xform instanceXform = pInstance->InstanceXform();
-		int componentCount = pDef->ObjectCount();
-
-		// Re-draw visible components for selection highlight.
-		// TODO: DrawObject in SC_POSTDRAWOBJECTS may not render proper selection
-		// highlights. Consider drawing wireframe edges with pre-computed data
-		// instead of full object redraws for better visual fidelity.
-		ON_Color selColor = RhinoApp().AppSettings().SelectedObjectColor();
-		(void)selColor; // TODO: use for manual wireframe highlight
+		const CSelectionWires& wires = pList->SelectionWires();
+		const ON_Xform instanceXform = item.pInstance->InstanceXform();
 
-		for (int i = 0; i < componentCount; i++)
+		if (wires.lines.Count() > 0)
 		{
-			std::string path = std::to_string(i);
-			ComponentState state = m_snapshot.GetComponentState(instanceId, path.c_str());
-			if (state == CS_HIDDEN || state == CS_SUPPRESSED)
-				continue;
-
-			const CRhinoObject* pComp = pDef->Object(i);
-			if (!pComp || !pComp->IsVisible())
-				continue;
+			dp.PushModelTransform(instanceXform);
+			dp.DrawLines(wires.lines, selColor);
+			dp.PopModelTransform();
+		}
 
-			if (pComp->ObjectType() == ON::instance_reference)
-			{
-				// For nested blocks, draw the whole sub-block with highlight
-				// if it has no hidden descendants; otherwise recurse
-				if (!m_snapshot.HasHiddenDescendants(instanceId, path.c_str()))
-				{
-					dp.DrawObject(pComp, &instanceXform);
-				}
-				// TODO: recurse for nested selection highlight if needed
-			}
-			else
-			{
-				// Use DrawObject — no manual edge extraction, no heap allocs
-				dp.DrawObject(pComp, &instanceXform);
-			}
+		// Components without wireframe curves (meshes, points, annotations)
+		for (const CDrawListEntry& entry : wires.fallback)
+		{
+			const ON_Xform combinedXform = entry.identity ? instanceXform : instanceXform * entry.xform;
+			dp.DrawObject(entry.pObject, &combinedXform);
 		}
 	}
 }
 
-void CVisibilityConduit::CalcVisibleBoundingBox()
+void CVisibilityConduit::CalcVisibleBoundingBox(CRhinoDoc& doc)
 {
 	if (!m_pChannelAttrs)
 		return;
 
-	CRhinoDoc* pDoc = RhinoApp().ActiveDoc();
-	if (!pDoc)
-		return;
-
-	std::vector<ON_UUID> managedIds;
-	m_snapshot.GetManagedInstanceIds(managedIds);
-
-	for (const auto& instanceId : managedIds)
+	for (const auto& pair : m_snapshot->Instances())
 	{
-		const CRhinoObject* pObj = pDoc->LookupObject(instanceId);
-		if (!pObj || pObj->ObjectType() != ON::instance_reference)
+		bool bound = false;
+		const CRhinoInstanceObject* pInstance = m_snapshot->ResolveInstance(doc, pair.first, &bound);
+		if (!pInstance)
 			continue;
 
-		const CRhinoInstanceObject* pInstance =
-			static_cast<const CRhinoInstanceObject*>(pObj);
 		const CRhinoInstanceDefinition* pDef = pInstance->InstanceDefinition();
 		if (!pDef)
 			continue;
 
+		// Drawn through its definition's rules, if it has any
+		const CVisibilityTrieNode::Ptr& state = *EffectiveState(pDef, &pair.second);
 		ON_Xform instanceXform = pInstance->InstanceXform();
-		int componentCount = pDef->ObjectCount();
 
-		ON_BoundingBox visibleBBox;
-		visibleBBox.Destroy(); // Start invalid
-
-		for (int i = 0; i < componentCount; i++)
+		// Unbound instances are not in the definition index, so definition
+		// changes could not invalidate a cached bbox: compute it every time
+		if (!bound)
 		{
-			std::string path = std::to_string(i);
-			ComponentState state = m_snapshot.GetComponentState(instanceId, path.c_str());
-
-			// Suppressed components are excluded from bbox entirely
-			// Hidden components still contribute (they're just visually hidden)
-			if (state == CS_SUPPRESSED)
-				continue;
-
-			const CRhinoObject* pComp = pDef->Object(i);
-			if (!pComp || !pComp->IsVisible())
-				continue;
-
-			if (pComp->ObjectType() == ON::instance_reference)
+			m_instanceBBoxes.erase(pair.first);
+			const CFilteredDrawList* pList = m_drawLists.Get(pDef, state);
+			if (pList && pList->LocalBBox().IsValid())
 			{
-				const CRhinoInstanceObject* pNested =
-					static_cast<const CRhinoInstanceObject*>(pComp);
-				// Recurse for nested blocks to exclude suppressed descendants
-				if (m_snapshot.HasHiddenDescendants(instanceId, path.c_str()))
-				{
-					AccumulateNestedBBox(pNested, instanceXform, instanceId, path, 0, visibleBBox);
-				}
-				else
-				{
-					ON_BoundingBox compBBox = pComp->BoundingBox();
-					compBBox.Transform(instanceXform);
-					visibleBBox.Union(compBBox);
-				}
+				ON_BoundingBox bbox = pList->LocalBBox();
+				bbox.Transform(instanceXform);
+				m_pChannelAttrs->m_BoundingBox.Union(bbox);
 			}
-			else
+			continue;
+		}
+
+		// Recompute only when the instance moved, its definition changed or
+		// its component states changed (edits to other instances or to
+		// unrelated definitions keep it); the definition-space bbox itself is
+		// shared by all instances with the same definition and states
+		CInstanceBBox& cached = m_instanceBBoxes[pair.first];
+		if (cached.state != state || cached.pDefinition != pDef || cached.xform != instanceXform)
+		{
+			const CFilteredDrawList* pList = m_drawLists.Get(pDef, state);
+
+			cached.bbox.Destroy(); // Start invalid
+			if (pList && pList->LocalBBox().IsValid())
 			{
-				ON_BoundingBox compBBox = pComp->BoundingBox();
-				compBBox.Transform(instanceXform);
-				visibleBBox.Union(compBBox);
+				cached.bbox = pList->LocalBBox();
+				cached.bbox.Transform(instanceXform);
 			}
+			cached.xform = instanceXform;
+			cached.pDefinition = pDef;
+			cached.state = state;
 		}
 
-		if (visibleBBox.IsValid())
+		if (cached.bbox.IsValid())
 		{
-			m_pChannelAttrs->m_BoundingBox.Union(visibleBBox);
+			m_pChannelAttrs->m_BoundingBox.Union(cached.bbox);
 		}
 	}
 }
 
-void CVisibilityConduit::AccumulateNestedBBox(
-	const CRhinoInstanceObject* pNestedInstance,
-	const ON_Xform& parentXform,
-	const ON_UUID& topLevelId,
-	const std::string& parentPath,
-	int depth,
-	ON_BoundingBox& bbox)
+bool CVisibilityConduit::PickComponent(CRhinoDoc& doc, const ON_Line& line, double tolerance, CComponentPick& pick)
 {
-	if (!pNestedInstance || depth >= MAX_NESTING_DEPTH)
-		return;
+	// Picking happens between frames: leave the next frame to refresh again
+	const bool snapshotValid = m_snapshotValid;
+	RefreshSnapshot();
+
+	CRhinoObjectIterator it(doc, CRhinoObjectIterator::normal_objects, CRhinoObjectIterator::active_and_reference_objects);
+	it.SetObjectFilter(ON::instance_reference);
+	for (const CRhinoObject* pObject = it.First(); pObject; pObject = it.Next())
+	{
+		// Rhino's bbox of the full instance is never smaller than the visible part
+		double parameter = 0.0;
+		if (!PickBBox(pObject->BoundingBox(), line, tolerance, parameter) || parameter > pick.parameter)
+			continue;
 
-	const CRhinoInstanceDefinition* pDef = pNestedInstance->InstanceDefinition();
+		const CRhinoInstanceObject* pInstance = static_cast<const CRhinoInstanceObject*>(pObject);
+		const CRhinoInstanceDefinition* pDef = pInstance->InstanceDefinition();
+		if (!pDef)
+			continue;
+
+		const CVisibilityTrieNode::Ptr* pRoot = EffectiveState(pDef, m_snapshot->FindInstanceRoot(pObject->Attributes().m_uuid));
+		const CFilteredDrawList* pList = m_drawLists.Get(pDef, pRoot && *pRoot ? *pRoot : m_unfiltered);
+		if (pList)
+			PickList(*pList, pInstance, pDef, line, tolerance, pick);
+	}
+
+	m_snapshotValid = snapshotValid;
+	UpdateDrawListGauge();
+	return pick.pInstance != nullptr;
+}
+
+ON_BoundingBox CVisibilityConduit::DrawnBBox(const CRhinoInstanceObject* pInstance) const
+{
+	// Cached by the last bbox pass for bound managed instances, if it still
+	// matches their placement and definition
+	const auto it = m_instanceBBoxes.find(pInstance->Attributes().m_uuid);
+	if (it != m_instanceBBoxes.end()
+		&& it->second.pDefinition == pInstance->InstanceDefinition()
+		&& it->second.xform == pInstance->InstanceXform())
+		return it->second.bbox;
+
+	// The whole instance holds any part of it that was drawn
+	return pInstance->BoundingBox();
+}
+
+ON_BoundingBox CVisibilityConduit::VisibleBBox(const CRhinoInstanceObject* pInstance)
+{
+	const CRhinoInstanceDefinition* pDef = pInstance->InstanceDefinition();
 	if (!pDef)
-		return;
+		return pInstance->BoundingBox();
 
-	ON_Xform combinedXform = parentXform * pNestedInstance->InstanceXform();
+	// Measured between frames: leave the next frame to refresh again
+	const bool snapshotValid = m_snapshotValid;
+	RefreshSnapshot();
+	m_snapshotValid = snapshotValid;
 
-	int componentCount = pDef->ObjectCount();
-	for (int i = 0; i < componentCount; i++)
+	// Instances without states or rules are drawn whole by Rhino
+	const CVisibilityTrieNode::Ptr* pRoot = EffectiveState(pDef, m_snapshot->FindInstanceRoot(pInstance->Attributes().m_uuid));
+	if (!pRoot)
+		return pInstance->BoundingBox();
+
+	ON_BoundingBox bbox;
+	const CFilteredDrawList* pList = m_drawLists.Get(pDef, *pRoot ? *pRoot : m_unfiltered);
+	if (pList && pList->LocalBBox().IsValid())
 	{
-		std::string childPath = BuildPath(parentPath, i);
-		ComponentState state = m_snapshot.GetComponentState(topLevelId, childPath.c_str());
+		bbox = pList->LocalBBox();
+		bbox.Transform(pInstance->InstanceXform());
+	}
+	UpdateDrawListGauge();
+	return bbox;
+}
 
-		if (state == CS_SUPPRESSED)
-			continue;
+void CVisibilityConduit::PickList(
+	const CFilteredDrawList& list,
+	const CRhinoInstanceObject* pInstance,
+	const CRhinoInstanceDefinition* pDef,
+	const ON_Line& line,
+	double tolerance,
+	CComponentPick& pick)
+{
+	const std::vector<CDrawListEntry>& entries = list.Entries();
+	const std::vector<CDrawListBvhNode>& bvh = list.Bvh();
+	const int entryCount = static_cast<int>(entries.size());
+	const ON_Xform instanceXform = pInstance->InstanceXform();
 
-		const CRhinoObject* pComp = pDef->Object(i);
-		if (!pComp || !pComp->IsVisible())
-			continue;
+	int first = 0;
+	if (!bvh.empty())
+	{
+		// Same walk as DrawListCulled, skipping nodes entered beyond the nearest hit
+		int stack[64];
+		int top = 0;
+		stack[top++] = 0;
 
-		if (pComp->ObjectType() == ON::instance_reference)
+		while (top > 0)
 		{
-			const CRhinoInstanceObject* pDeeper =
-				static_cast<const CRhinoInstanceObject*>(pComp);
-			if (m_snapshot.HasHiddenDescendants(topLevelId, childPath.c_str()))
-			{
-				AccumulateNestedBBox(pDeeper, combinedXform, topLevelId, childPath, depth + 1, bbox);
-			}
-			else
+			const int index = stack[--top];
+			const CDrawListBvhNode& node = bvh[index];
+
+			ON_BoundingBox worldBBox = node.bbox;
+			worldBBox.Transform(instanceXform);
+			double parameter = 0.0;
+			if (!PickBBox(worldBBox, line, tolerance, parameter) || parameter > pick.parameter)
+				continue;
+
+			if (node.right < 0 || top + 2 > static_cast<int>(sizeof(stack) / sizeof(stack[0])))
 			{
-				ON_BoundingBox compBBox = pComp->BoundingBox();
-				compBBox.Transform(combinedXform);
-				bbox.Union(compBBox);
+				for (int i = node.first; i < node.first + node.count; i++)
+					PickEntry(list, entries[i], pInstance, pDef, line, tolerance, pick);
+				continue;
 			}
+
+			stack[top++] = node.right;
+			stack[top++] = index + 1;
 		}
-		else
+		first = list.BoundedCount();
+	}
+
+	for (int i = first; i < entryCount; i++)
+		PickEntry(list, entries[i], pInstance, pDef, line, tolerance, pick);
+}
+
+void CVisibilityConduit::PickEntry(
+	const CFilteredDrawList& list,
+	const CDrawListEntry& entry,
+	const CRhinoInstanceObject* pInstance,
+	const CRhinoInstanceDefinition* pDef,
+	const ON_Line& line,
+	double tolerance,
+	CComponentPick& pick)
+{
+	const ON_Xform instanceXform = pInstance->InstanceXform();
+	double parameter = 0.0;
+	if (entry.bbox.IsValid())
+	{
+		ON_BoundingBox worldBBox = entry.bbox;
+		worldBBox.Transform(instanceXform);
+		if (!PickBBox(worldBBox, line, tolerance, parameter) || parameter > pick.parameter)
+			return;
+	}
+
+	// Nested block drawn whole: every visible component below it is drawn
+	const CComponentIndex* pIndex = list.Index();
+	if (pIndex && entry.row >= 0 && (pIndex->Flags(entry.row) & CComponentIndex::ROW_EXPANDED))
+	{
+		const int end = pIndex->SubtreeEnd(entry.row);
+		int next = entry.row + 1;
+		for (int row = next; row < end; row = next)
 		{
-			ON_BoundingBox compBBox = pComp->BoundingBox();
-			compBBox.Transform(combinedXform);
-			bbox.Union(compBBox);
+			next = pIndex->SubtreeEnd(row);
+			const uint8_t flags = pIndex->Flags(row);
+			if (!(flags & CComponentIndex::ROW_VISIBLE))
+				continue;
+
+			if (flags & CComponentIndex::ROW_INSTANCE)
+			{
+				if (flags & CComponentIndex::ROW_EXPANDED)
+					next = row + 1;
+				continue;
+			}
+
+			ON_BoundingBox worldBBox = pIndex->BBox(row);
+			worldBBox.Transform(instanceXform);
+			if (!PickBBox(worldBBox, line, tolerance, parameter) || parameter > pick.parameter)
+				continue;
+
+			if (PickGeometry(pIndex->Object(row), instanceXform * pIndex->Xform(row), line, tolerance, m_scratch.meshes, parameter)
+				&& parameter < pick.parameter)
+			{
+				pick.pInstance = pInstance;
+				pick.path = pIndex->Path(row);
+				pick.parameter = parameter;
+			}
 		}
+		return;
 	}
+
+	const ON_Xform componentXform = entry.identity ? instanceXform : instanceXform * entry.xform;
+	if (!PickGeometry(entry.pObject, componentXform, line, tolerance, m_scratch.meshes, parameter)
+		|| parameter >= pick.parameter)
+		return;
+
+	CComponentPath path;
+	if (pIndex && entry.row >= 0)
+		path = pIndex->Path(entry.row);
+	else if (!FindComponentPath(pDef, entry.pObject, entry.xform, path))
+		return;
+
+	pick.pInstance = pInstance;
+	pick.path = path;
+	pick.parameter = parameter;
 }
 
-std::string CVisibilityConduit::BuildPath(const std::string& parentPath, int childIndex)
+const CVisibilityTrieNode::Ptr* CVisibilityConduit::EffectiveState(
+	const CRhinoInstanceDefinition* pDef,
+	const CVisibilityTrieNode::Ptr* pOwn)
 {
-	if (parentPath.empty())
-		return std::to_string(childIndex);
-	return parentPath + "." + std::to_string(childIndex);
+	const CVisibilityTrieNode::Ptr* pRules = m_snapshot->FindDefinitionRules(pDef->Id());
+	if (!pRules || !pOwn)
+		return pRules ? pRules : pOwn;
+
+	// Instances overriding the same rules the same way share one overlay,
+	// and through it one draw list
+	const COverlayKey key{ pRules->get(), pOwn->get() };
+	auto it = m_overlays.find(key);
+	if (it == m_overlays.end())
+		it = m_overlays.emplace(key, CVisibilityTrieNode::Overlay(*pRules, **pOwn)).first;
+	return &it->second;
 }
 
 ON_Color CVisibilityConduit::GetComponentColor(
 	const CRhinoObject* pComponent,
+	const CRhinoObject* pInstance,
 	const CRhinoDoc* pDoc)
 {
 	if (!pComponent)
 		return ON_Color(128, 128, 128);
 
 	const ON_3dmObjectAttributes& attrs = pComponent->Attributes();
-
-	if (attrs.ColorSource() == ON::color_from_object)
+	switch (attrs.ColorSource())
+	{
+	case ON::color_from_object:
 		return attrs.m_color;
 
-	if (pDoc && attrs.ColorSource() == ON::color_from_layer)
+	case ON::color_from_parent:
+		// Top-level objects have no parent and use their layer's color
+		if (pInstance)
+			return GetComponentColor(pInstance, nullptr, pDoc);
+		return LayerColor(attrs.m_layer_index, pDoc);
+
+	case ON::color_from_material:
 	{
-		int layerIndex = attrs.m_layer_index;
-		const CRhinoLayerTable& layerTable = pDoc->m_layer_table;
-		if (layerIndex >= 0 && layerIndex < layerTable.LayerCount())
-		{
-			const CRhinoLayer& layer = layerTable[layerIndex];
-			return layer.Color();
-		}
+		const int materialIndex = MaterialIndex(pComponent, pInstance, pDoc);
+		if (pDoc && materialIndex >= 0 && materialIndex < pDoc->m_material_table.MaterialCount())
+			return pDoc->m_material_table[materialIndex].Diffuse();
+		return ON_Material::Default.Diffuse();
 	}
 
-	if (attrs.ColorSource() == ON::color_from_parent)
-		return attrs.m_color;
+	default:
+		return LayerColor(attrs.m_layer_index, pDoc);
+	}
+}
 
-	return ON_Color(128, 128, 128);
+void CVisibilityConduit::SetupComponentMaterial(
+	CRhinoDisplayPipeline& dp,
+	CDisplayPipelineMaterial& material,
+	const CRhinoObject* pComponent,
+	const CRhinoObject* pInstance,
+	const CRhinoDoc* pDoc)
+{
+	const ON_3dmObjectAttributes& attrs = pComponent->Attributes();
+	const bool colorFromParent = attrs.ColorSource() == ON::color_from_parent;
+	const bool materialFromParent = attrs.MaterialSource() == ON::material_from_parent;
+
+	if (!pInstance || (!colorFromParent && !materialFromParent))
+	{
+		dp.SetupDisplayMaterial(material, pDoc, pComponent);
+		return;
+	}
+
+	// Everything from the parent: drawn like the instance itself
+	if (colorFromParent && materialFromParent)
+	{
+		dp.SetupDisplayMaterial(material, pDoc, pInstance);
+		return;
+	}
+
+	// Half by-parent: the component's attributes with that half resolved
+	ON_3dmObjectAttributes& resolved = m_scratch.attributes;
+	resolved = attrs;
+	if (colorFromParent)
+	{
+		resolved.SetColorSource(ON::color_from_object);
+		resolved.m_color = GetComponentColor(pInstance, nullptr, pDoc);
+	}
+	else
+	{
+		resolved.SetMaterialSource(ON::material_from_object);
+		resolved.m_material_index = MaterialIndex(pInstance, nullptr, pDoc);
+	}
+	dp.SetupDisplayMaterial(material, pDoc, pComponent, &resolved);
 }
@@ -3,18 +3,41 @@
 // Intercepts SC_DRAWOBJECT to suppress managed block instances and
 // re-draw only their visible components using path-based filtering.
 // Uses SC_CALCBOUNDINGBOX for correct zoom extents.
-// Uses SC_POSTDRAWOBJECTS for selection highlights (no per-frame heap allocs).
+// Uses SC_POSTDRAWOBJECTS for transparent components (one sorted batch) and
+// selection highlights (cached wireframes). Per-frame temporaries live in
+// reusable scratch, so steady-state frames do no heap allocation.
+// Instances smaller on screen than the LOD threshold draw a box proxy; with
+// merged meshes on, static instances draw their merged render meshes.
+//
+// Instances of a definition with rules are drawn through the rule trie (one
+// draw list for all of them) or, if they override it, through an overlay of
+// their own states on it, built once per (rules, states) pair and snapshot.
+//
+// PickComponent hit-tests the same draw lists, so only components the
+// instance is drawn with can be picked (ComponentPick.h).
+//
+// DrawnBBox and VisibleBBox give the regions a state change redraws
+// (RedrawScheduler.h).
+//
+// One conduit per document (see CDocVisibilityRegistry), enabled for that
+// document only; its viewports share the conduit's snapshot and caches.
 
 #pragma once
 
+#include "ComponentPick.h"
+#include "ConduitStats.h"
+#include "DrawListCache.h"
 #include "VisibilityData.h"
-#include <string>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 
 class CVisibilityConduit : public CRhinoDisplayConduit
 {
 public:
-	/// Construct with a reference to the shared visibility data
-	explicit CVisibilityConduit(CVisibilityData& visData);
+	/// Construct for the visibility data of one document, counting into stats
+	CVisibilityConduit(CVisibilityData& visData, CConduitStats& stats, unsigned int docSerial);
+	~CVisibilityConduit() override;
 
 	bool ExecConduit(
 		CRhinoDisplayPipeline& dp,
@@ -26,8 +49,53 @@ public:
 	void SetDebugLogging(bool enabled) { m_debugLogging = enabled; }
 	bool GetDebugLogging() const { return m_debugLogging; }
 
+	/// Screen size in pixels below which managed instances are drawn as the
+	/// box around their visible components (0 = off)
+	void SetLodThreshold(double pixels) { m_lodPixels = pixels; }
+
+	/// Draw instances from their draw list's merged render meshes once the
+	/// list has been drawn for a while (shaded modes, unselected instances).
+	/// Merges run on pJobs; nullptr turns merged meshes off.
+	void SetMergeJobs(CJobSystem* pJobs) { m_pJobs = pJobs; }
+
+	/// Pick the nearest visible component of doc's normal top-level block
+	/// instances along a world line. Instances without states or rules are
+	/// picked through their whole definition. Returns false if nothing is hit.
+	/// UI thread, like drawing.
+	bool PickComponent(CRhinoDoc& doc, const ON_Line& line, double tolerance, CComponentPick& pick);
+
+	/// World bbox of the components pInstance was drawn with in the last
+	/// frame's bbox pass, or of the whole instance if it was drawn by Rhino
+	/// or not measured. Invalid if it drew nothing.
+	ON_BoundingBox DrawnBBox(const CRhinoInstanceObject* pInstance) const;
+
+	/// World bbox of the components pInstance is drawn with in the currently
+	/// published states. Invalid if it draws nothing. UI thread, like drawing.
+	ON_BoundingBox VisibleBBox(const CRhinoInstanceObject* pInstance);
+
 private:
-	static const int MAX_NESTING_DEPTH = 32;
+	/// Pick the entries of an instance's draw list whose BVH nodes the line
+	/// crosses, keeping pick if nearer
+	void PickList(
+		const CFilteredDrawList& list,
+		const CRhinoInstanceObject* pInstance,
+		const CRhinoInstanceDefinition* pDef,
+		const ON_Line& line,
+		double tolerance,
+		CComponentPick& pick
+	);
+
+	/// Pick one draw list entry. A nested block drawn whole is tested
+	/// component by component through the list's index.
+	void PickEntry(
+		const CFilteredDrawList& list,
+		const CDrawListEntry& entry,
+		const CRhinoInstanceObject* pInstance,
+		const CRhinoInstanceDefinition* pDef,
+		const ON_Line& line,
+		double tolerance,
+		CComponentPick& pick
+	);
 
 	/// Draw a single component with the given transform.
 	/// Uses dp.DrawObject, which handles all geometry types via Rhino's pipeline.
@@ -37,46 +105,203 @@ private:
 		const ON_Xform& xform
 	);
 
-	/// Recursively draw a nested block instance with path-based filtering.
-	/// Only recurses into sub-blocks that contain hidden descendants.
-	void DrawNestedFiltered(
+	/// Draw (or queue, if transparent) entries [first, first + count) of
+	/// the draw list of pInstance
+	void DrawEntries(
 		CRhinoDisplayPipeline& dp,
-		const CRhinoInstanceObject* pNestedInstance,
-		const ON_Xform& parentXform,
-		const ON_UUID& topLevelId,
-		const std::string& parentPath,
-		int depth
+		const CFilteredDrawList& list,
+		int first,
+		int count,
+		const CRhinoObject* pInstance,
+		const ON_Xform& instanceXform
 	);
 
-	/// Draw selection highlights for all managed selected instances.
-	/// Called from SC_POSTDRAWOBJECTS — uses DrawObject instead of manual edge extraction.
+	/// Draw the entries of a draw list whose BVH nodes are inside the view
+	/// frustum (all of them if the list has no BVH). Returns the number culled.
+	int DrawListCulled(
+		CRhinoDisplayPipeline& dp,
+		const CFilteredDrawList& list,
+		const CRhinoObject* pInstance,
+		const ON_Xform& instanceXform
+	);
+
+	/// Draw the LOD proxy of a managed instance if the proxy box spans fewer
+	/// than m_lodPixels on screen (shaded box, or its edges in wireframe
+	/// modes, in the instance color). Returns false if it is large enough to
+	/// draw component by component.
+	bool DrawLodProxy(
+		CRhinoDisplayPipeline& dp,
+		const CFilteredDrawList& list,
+		const CRhinoObject* pInstance,
+		const ON_Xform& instanceXform
+	);
+
+	/// Draw a managed instance from the merged render meshes of its draw
+	/// list. Once the list has been drawn in enough frames, copies its meshes
+	/// over the following frames and queues the merge (one list per frame;
+	/// visible priority for the active viewport).
+	/// Each group is shaded with its display material as Rhino resolves it
+	/// for the mode (render materials included); its edges and isocurves
+	/// are drawn over it as far as the mode shows them.
+	/// Returns false if the instance has to be drawn component by component:
+	/// selected, not shaded, or the merge is not published yet.
+	bool DrawMerged(
+		CRhinoDisplayPipeline& dp,
+		const CFilteredDrawList& list,
+		const CRhinoObject* pInstance,
+		const ON_Xform& instanceXform
+	);
+
+	/// Queue a CS_TRANSPARENT component of pInstance for
+	/// DrawTransparentComponents, keyed by its view depth
+	void QueueTransparent(
+		CRhinoDisplayPipeline& dp,
+		const CRhinoObject* pComponent,
+		const CRhinoObject* pInstance,
+		const ON_Xform& xform
+	);
+
+	/// Draw the queued transparent components back to front with depth
+	/// writing off, in their display material made transparent, sharing one
+	/// material per run of equal materials. Called from SC_POSTDRAWOBJECTS.
+	void DrawTransparentComponents(CRhinoDisplayPipeline& dp);
+
+	/// Draw selection highlights for the selected instances drawn this frame:
+	/// the cached wireframe of their draw list in the selection color, one
+	/// DrawLines batch per instance. Called from SC_POSTDRAWOBJECTS.
 	void DrawSelectionHighlights(CRhinoDisplayPipeline& dp);
 
 	/// Compute bounding box contribution for managed instances (only visible components).
-	/// Called from SC_CALCBOUNDINGBOX.
-	void CalcVisibleBoundingBox();
+	/// Called from SC_CALCBOUNDINGBOX. Uses m_instanceBBoxes for bound instances
+	/// while still current.
+	void CalcVisibleBoundingBox(CRhinoDoc& doc);
+
+	/// Trie an instance of pDef is drawn with: the rules of pDef with the
+	/// instance's own states (pOwn, may be null) on top. nullptr if neither
+	/// exists; the trie itself is null if the overrides cancel every rule.
+	const CVisibilityTrieNode::Ptr* EffectiveState(
+		const CRhinoInstanceDefinition* pDef,
+		const CVisibilityTrieNode::Ptr* pOwn
+	);
+
+	/// Whether dp draws the active view's active viewport
+	bool IsActiveViewport(CRhinoDisplayPipeline& dp) const;
 
-	/// Resolve display color for a component
+	/// Document being drawn: the pipeline's, else the one this conduit is for
+	CRhinoDoc* DrawnDoc(CRhinoDisplayPipeline& dp) const;
+
+	/// Bring the shared cachedDrawLists gauge in line with this conduit's cache
+	void UpdateDrawListGauge();
+
+	/// Resolve the display color of a component drawn as part of pInstance
+	/// (nullptr for a top-level object): object, layer or material color,
+	/// by-parent colors from the instance
 	ON_Color GetComponentColor(
 		const CRhinoObject* pComponent,
+		const CRhinoObject* pInstance,
 		const CRhinoDoc* pDoc
 	);
 
-	/// Build a child path string: "parentPath.childIndex" or just "childIndex"
-	static std::string BuildPath(const std::string& parentPath, int childIndex);
-
-	/// Accumulate bounding box for visible components of a nested block
-	void AccumulateNestedBBox(
-		const CRhinoInstanceObject* pNestedInstance,
-		const ON_Xform& parentXform,
-		const ON_UUID& topLevelId,
-		const std::string& parentPath,
-		int depth,
-		ON_BoundingBox& bbox
+	/// Set material up as the display material of a component drawn as part
+	/// of pInstance: Rhino's own for the display mode, with by-parent color
+	/// and material taken from the instance
+	void SetupComponentMaterial(
+		CRhinoDisplayPipeline& dp,
+		CDisplayPipelineMaterial& material,
+		const CRhinoObject* pComponent,
+		const CRhinoObject* pInstance,
+		const CRhinoDoc* pDoc
 	);
 
+	/// Pick up the currently published visibility snapshot.
+	/// Costs one atomic load when the visibility generation is unchanged.
+	/// On a new generation, drops cached data of changed definitions (all of it
+	/// if they are not individually known) and prunes the draw list cache.
+	void RefreshSnapshot();
+
 	CVisibilityData& m_visData;
-	CVisibilitySnapshot m_snapshot;  ///< Per-frame snapshot, taken once at SC_PREDRAWOBJECTS
+	unsigned int m_docSerial;        ///< Document this conduit draws
+	std::shared_ptr<const CVisibilitySnapshot> m_snapshot;  ///< Shared published snapshot, refreshed at SC_PREDRAWOBJECTS
 	bool m_snapshotValid = false;    ///< Whether snapshot is valid for this frame
+	CDrawListCache m_drawLists;      ///< Flattened visible components per (definition, states)
+
+	/// Cached world bbox of a managed instance and the inputs it was computed from
+	struct CInstanceBBox
+	{
+		ON_BoundingBox bbox;
+		ON_Xform xform;
+		const CRhinoInstanceDefinition* pDefinition = nullptr;
+		CVisibilityTrieNode::Ptr state;          ///< instance trie the bbox was computed from
+	};
+	std::unordered_map<ON_UUID, CInstanceBBox, ON_UUID_Hash, ON_UUID_Equal> m_instanceBBoxes;
+	std::vector<ON_UUID> m_changedDefinitions;     ///< Scratch for RefreshSnapshot
+
+	/// Rule trie and instance trie an overlay was built from
+	struct COverlayKey
+	{
+		const CVisibilityTrieNode* rules;
+		const CVisibilityTrieNode* own;
+
+		bool operator==(const COverlayKey& other) const { return rules == other.rules && own == other.own; }
+	};
+
+	struct COverlayKeyHash
+	{
+		size_t operator()(const COverlayKey& key) const noexcept
+		{
+			return std::hash<const void*>()(key.rules) ^ (std::hash<const void*>()(key.own) * 0x9e3779b97f4a7c15ULL);
+		}
+	};
+
+	/// Overlays built for the current snapshot, whose tries the keys point into
+	std::unordered_map<COverlayKey, CVisibilityTrieNode::Ptr, COverlayKeyHash> m_overlays;
+
+	/// Empty trie: draw list key of instances picked through their whole definition
+	const CVisibilityTrieNode::Ptr m_unfiltered;
+
+	/// CS_TRANSPARENT component queued for the post-draw pass
+	struct CTransparentItem
+	{
+		const CRhinoObject* pObject;
+		const CRhinoObject* pInstance;   ///< Top-level instance it is drawn in
+		ON_Xform xform;
+		double depth;                    ///< distance along the camera direction
+	};
+
+	/// Selected instance drawn this frame, highlighted in the post-draw pass
+	struct CSelectedItem
+	{
+		const CRhinoInstanceObject* pInstance;
+		const CRhinoInstanceDefinition* pDefinition;
+		CVisibilityTrieNode::Ptr state;            ///< trie its draw list was built from
+	};
+
+	/// Per-frame temporaries. Emptied, with their capacity kept, when a frame
+	/// ends: once they have grown to the largest frame, drawing managed
+	/// instances does no heap allocation.
+	struct CFrameScratch
+	{
+		std::vector<CTransparentItem> transparent;     ///< Queued for the post-draw pass
+		std::vector<CSelectedItem> selected;           ///< Highlighted in the post-draw pass
+		ON_SimpleArray<const ON_Mesh*> meshes;         ///< Render mesh lookup
+		CDisplayPipelineMaterial material;             ///< Opaque proxies and merged meshes
+		CDisplayPipelineMaterial transparentMaterial;  ///< CS_TRANSPARENT components
+		ON_3dmObjectAttributes attributes;             ///< Components half by-parent (SetupComponentMaterial)
+
+		void Reset()
+		{
+			transparent.clear();
+			selected.clear();
+			meshes.Empty();
+		}
+	};
+	CFrameScratch m_scratch;
 	bool m_debugLogging = false;
+	double m_lodPixels = 0.0;
+	CJobSystem* m_pJobs = nullptr;     ///< Merge workers, if merged meshes are on
+	uint64_t m_frame = 0;              ///< SC_PREDRAWOBJECTS passes of this conduit
+	bool m_mergedThisFrame = false;    ///< A list copied meshes for its merge this frame
+
+	CConduitStats& m_stats;          ///< Shared by the conduits of all documents
+	size_t m_gaugeDrawLists = 0;     ///< This conduit's share of m_stats.cachedDrawLists
 };
@@ -1,29 +1,53 @@
 // VisibilityData.h : Thread-safe per-instance component visibility state
 //
 // Stores which components within block instances are hidden/suppressed/transparent.
-// Uses CRITICAL_SECTION for thread safety (render thread vs UI thread).
+// Writers serialize on a CRITICAL_SECTION; readers never take it. Each
+// committed change is published RCU-style: a new immutable snapshot is built
+// under the writer lock and swapped in with an atomic shared_ptr store. Read
+// accessors (UI queries) and AcquireSnapshot (render thread) only perform an
+// atomic load of that pointer, so they never block each other or a writer.
 //
-// Paths are dot-separated index strings, e.g.:
+// Per-instance state is a CVisibilityTrieNode tree keyed by child index.
+// Every mutation publishes a new immutable, reference-counted snapshot and
+// bumps a generation counter. Tries are copy-on-write: only nodes along the
+// changed path are copied. The conduit keeps the snapshot it last acquired
+// and only re-acquires when the generation changed (one atomic load per
+// unchanged frame).
+//
+// The instance map itself is shared between the store and the snapshots it
+// published until it next changes. A publication that touches an instance
+// copies the whole map (one entry of trie pointers per managed instance), so
+// its cost is O(managed instances) however small the change; batch changes
+// to pay it once. Named state tables (variants) keep such a
+// map alive: activating one swaps it in as the current state in O(1).
+//
+// Definition rules ("in definition X, path P is hidden") are stored once per
+// definition, in the same tries keyed by definition UUID, and apply to every
+// top-level instance of it. An instance's own states override them path by
+// path; CS_SHOWN records that a path a rule hides is shown in that instance.
+// Rules cost memory, snapshot copies and file size per unique rule rather
+// than per instance.
+//
+// Paths are packed index sequences (CComponentPath). Their text form is a
+// dot-separated index string, e.g.:
 //   "0"     — first component in the top-level definition
 //   "1.0"   — first child of the second component (nested block)
 //   "1.0.2" — third child inside a doubly-nested block
 
 #pragma once
 
+#include "ComponentPath.h"
+#include "VisibilityTrie.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
 #include <unordered_map>
 #include <unordered_set>
 #include <string>
+#include <utility>
 #include <vector>
 
-/// Component state enum — supports hide, suppress, and transparency
-enum ComponentState
-{
-	CS_VISIBLE     = 0,
-	CS_HIDDEN      = 1,   // Visual only — still in BOM, still in bbox
-	CS_SUPPRESSED  = 2,   // Structural — excluded from BOM, bbox, export
-	CS_TRANSPARENT = 3    // Draw with alpha transparency
-};
-
 /// Hash functor for ON_UUID in std containers
 struct ON_UUID_Hash
 {
@@ -58,90 +82,337 @@ private:
 	CRITICAL_SECTION& m_cs;
 };
 
-/// Lock-free snapshot of visibility data for one frame.
-/// Taken once at frame start, used for all checks during that frame.
-/// Same query API as CVisibilityData but without locks.
+/// One entry of a batched state update (CVisibilityData::SetStates)
+struct CComponentStateChange
+{
+	ON_UUID instanceId;
+	CComponentPath path;
+	ComponentState state;
+};
+
+/// Recent instance definition changes (CVisibilityData::NotifyDefinitionsChanged).
+/// Immutable once published; shared by every snapshot until the next change.
+struct CDefinitionChangeLog
+{
+	struct Entry
+	{
+		uint64_t epoch;              ///< definition epoch the change was published with
+		ON_UUID definitionId;        ///< ON_nil_uuid = all definitions
+	};
+
+	std::vector<Entry> entries;      ///< ascending epochs
+	uint64_t floor = 0;              ///< entries with epoch <= floor were dropped
+
+	/// Entries kept before the oldest ones are dropped
+	static const size_t MAX_ENTRIES = 256;
+};
+
+/// Document object a managed instance is drawn from (CVisibilityData::BindInstances)
+struct CInstanceBinding
+{
+	const CRhinoInstanceObject* pObject = nullptr;
+	unsigned int objectSerial = 0;        ///< pObject->RuntimeSerialNumber() when bound
+	ON_UUID definitionId = ON_nil_uuid;   ///< definition pObject referenced when bound
+};
+
+/// Bound managed instances and the reverse definition -> instances index.
+/// Immutable once published; shared by snapshots until a binding changes.
+struct CInstanceBindings
+{
+	typedef std::unordered_map<ON_UUID, CInstanceBinding, ON_UUID_Hash, ON_UUID_Equal> BindingMap;
+	typedef std::unordered_map<ON_UUID, std::vector<ON_UUID>, ON_UUID_Hash, ON_UUID_Equal> DefinitionIndex;
+
+	BindingMap instances;                 ///< instance id -> binding
+	DefinitionIndex definitions;          ///< definition id -> bound instance ids
+
+	void Set(const ON_UUID& instanceId, const CInstanceBinding& binding)
+	{
+		Remove(instanceId);
+		instances[instanceId] = binding;
+		definitions[binding.definitionId].push_back(instanceId);
+	}
+
+	void Remove(const ON_UUID& instanceId)
+	{
+		auto it = instances.find(instanceId);
+		if (it == instances.end())
+			return;
+
+		auto dit = definitions.find(it->second.definitionId);
+		if (dit != definitions.end())
+		{
+			std::vector<ON_UUID>& ids = dit->second;
+			for (size_t i = 0; i < ids.size(); i++)
+			{
+				if (ON_UuidCompare(ids[i], instanceId) == 0)
+				{
+					ids[i] = ids.back();
+					ids.pop_back();
+					break;
+				}
+			}
+			if (ids.empty())
+				definitions.erase(dit);
+		}
+		instances.erase(it);
+	}
+};
+
+/// Immutable snapshot of visibility data, published by CVisibilityData.
+/// Shared by reference between the store and every reader; never modified
+/// after publication, so queries need no locks.
 class CVisibilitySnapshot
 {
 public:
 	CVisibilitySnapshot() = default;
 
-	/// Per-instance data: component states + precomputed parent prefixes
-	struct InstanceData
+	/// Instance UUID -> root of the instance's (non-empty) state trie
+	typedef std::unordered_map<ON_UUID,
+		CVisibilityTrieNode::Ptr,
+		ON_UUID_Hash, ON_UUID_Equal> InstanceMap;
+
+	/// Definition UUID -> root of the definition's (non-empty) rule trie
+	typedef InstanceMap RuleMap;
+
+	/// Rule map shared by every snapshot without rules, so publishing one allocates none
+	static const std::shared_ptr<const RuleMap>& NoRules()
 	{
-		std::unordered_map<std::string, ComponentState> states;
-		std::unordered_set<std::string> parentPrefixes; // for O(1) HasHiddenDescendants
-	};
+		static const std::shared_ptr<const RuleMap> empty = std::make_shared<const RuleMap>();
+		return empty;
+	}
+
+	/// Generation of CVisibilityData that published this snapshot
+	uint64_t Generation() const { return m_generation; }
+
+	/// Bumped whenever instance definitions may have changed.
+	/// Caches holding definition geometry must be dropped when it differs.
+	uint64_t DefinitionEpoch() const { return m_definitionEpoch; }
+
+	/// Ids of the definitions reported changed after definition epoch since.
+	/// Returns false if they are not individually known (a document-wide
+	/// change, or the log no longer reaches back that far): the caller must
+	/// then drop all cached definition data.
+	bool GetDefinitionChangesSince(uint64_t since, std::vector<ON_UUID>& outIds) const
+	{
+		outIds.clear();
+		if (since == m_definitionEpoch)
+			return true;
+		if (!m_definitionLog || since < m_definitionLog->floor)
+			return false;
+
+		for (const CDefinitionChangeLog::Entry& entry : m_definitionLog->entries)
+		{
+			if (entry.epoch <= since)
+				continue;
+			if (ON_UuidIsNil(entry.definitionId))
+				return false;
+			outIds.push_back(entry.definitionId);
+		}
+		return true;
+	}
+
+	/// Root trie node of a managed instance, or nullptr if the instance is not managed.
+	/// Traversals walk this alongside the definition tree.
+	const CVisibilityTrieNode* FindInstance(const ON_UUID& instanceId) const
+	{
+		auto it = m_instances->find(instanceId);
+		return it != m_instances->end() ? it->second.get() : nullptr;
+	}
+
+	/// Shared root pointer of a managed instance's trie (nullptr if not managed).
+	/// For caches that need to keep the trie alive beyond this snapshot.
+	const CVisibilityTrieNode::Ptr* FindInstanceRoot(const ON_UUID& instanceId) const
+	{
+		auto it = m_instances->find(instanceId);
+		return it != m_instances->end() ? &it->second : nullptr;
+	}
 
 	/// Check if this instance has any non-visible components (is managed by us)
 	bool IsManaged(const ON_UUID& instanceId) const
 	{
-		auto it = m_data.find(instanceId);
-		return it != m_data.end() && !it->second.states.empty();
+		return FindInstance(instanceId) != nullptr;
 	}
 
-	/// Get the state of a component (CS_VISIBLE if not found)
-	ComponentState GetComponentState(const ON_UUID& instanceId, const char* path) const
+	/// Shared root pointer of a definition's rule trie (nullptr if it has no rules)
+	const CVisibilityTrieNode::Ptr* FindDefinitionRules(const ON_UUID& definitionId) const
 	{
-		auto it = m_data.find(instanceId);
-		if (it == m_data.end())
-			return CS_VISIBLE;
-		auto sit = it->second.states.find(std::string(path));
-		if (sit == it->second.states.end())
+		auto it = m_rules->find(definitionId);
+		return it != m_rules->end() ? &it->second : nullptr;
+	}
+
+	/// Rule state of a component of a definition (CS_VISIBLE if none)
+	ComponentState GetDefinitionState(const ON_UUID& definitionId, const CComponentPath& path) const
+	{
+		const CVisibilityTrieNode::Ptr* pRules = FindDefinitionRules(definitionId);
+		return CVisibilityTrieNode::Find(pRules ? pRules->get() : nullptr, path);
+	}
+
+	/// State a component is drawn with: the instance's own state, else the
+	/// rule of definitionId (the definition the instance references)
+	ComponentState GetEffectiveState(const ON_UUID& instanceId, const ON_UUID& definitionId, const CComponentPath& path) const
+	{
+		const ComponentState own = GetComponentState(instanceId, path);
+		if (own == CS_SHOWN)
 			return CS_VISIBLE;
-		return sit->second;
+		if (own != CS_VISIBLE || m_rules->empty())
+			return own;
+		return GetDefinitionState(definitionId, path);
+	}
+
+	/// Trie an instance is drawn with: its own states over the rules of
+	/// definitionId (the definition it references). Without own states this
+	/// is the rule trie itself; CS_SHOWN entries remain only where the
+	/// instance has no rules to override. nullptr if nothing applies.
+	CVisibilityTrieNode::Ptr GetEffectiveTrie(const ON_UUID& instanceId, const ON_UUID& definitionId) const
+	{
+		const CVisibilityTrieNode::Ptr* pOwn = FindInstanceRoot(instanceId);
+		const CVisibilityTrieNode::Ptr* pRules = m_rules->empty() ? nullptr : FindDefinitionRules(definitionId);
+		if (pRules && pOwn && *pOwn)
+			return CVisibilityTrieNode::Overlay(*pRules, **pOwn);
+		if (pRules)
+			return *pRules;
+		return pOwn ? *pOwn : nullptr;
+	}
+
+	/// Document object of a managed instance. Uses the bound pointer while
+	/// doc still resolves its runtime serial number to it, and falls back to a
+	/// UUID lookup otherwise (not yet bound, or replaced since).
+	/// *pBound (optional) is set to whether the bound pointer was used.
+	const CRhinoInstanceObject* ResolveInstance(const CRhinoDoc& doc, const ON_UUID& instanceId, bool* pBound = nullptr) const
+	{
+		if (pBound)
+			*pBound = false;
+
+		auto it = m_bindings->instances.find(instanceId);
+		if (it != m_bindings->instances.end()
+			&& doc.LookupObjectByRuntimeSerialNumber(it->second.objectSerial) == it->second.pObject)
+		{
+			if (pBound)
+				*pBound = true;
+			return it->second.pObject;
+		}
+
+		const CRhinoObject* pObj = doc.LookupObject(instanceId);
+		if (!pObj || pObj->ObjectType() != ON::instance_reference)
+			return nullptr;
+		return static_cast<const CRhinoInstanceObject*>(pObj);
+	}
+
+	/// Bound managed instances referencing a definition (nullptr if none)
+	const std::vector<ON_UUID>* InstancesOfDefinition(const ON_UUID& definitionId) const
+	{
+		auto it = m_bindings->definitions.find(definitionId);
+		return it != m_bindings->definitions.end() ? &it->second : nullptr;
+	}
+
+	/// Get the state of a component (CS_VISIBLE if not found)
+	ComponentState GetComponentState(const ON_UUID& instanceId, const CComponentPath& path) const
+	{
+		return CVisibilityTrieNode::Find(FindInstance(instanceId), path);
 	}
 
 	/// Check if a specific component path is hidden (CS_HIDDEN or CS_SUPPRESSED)
-	bool IsComponentHidden(const ON_UUID& instanceId, const char* path) const
+	bool IsComponentHidden(const ON_UUID& instanceId, const CComponentPath& path) const
 	{
 		ComponentState s = GetComponentState(instanceId, path);
 		return s == CS_HIDDEN || s == CS_SUPPRESSED;
 	}
 
 	/// Check if a component is suppressed (excluded from bbox too)
-	bool IsComponentSuppressed(const ON_UUID& instanceId, const char* path) const
+	bool IsComponentSuppressed(const ON_UUID& instanceId, const CComponentPath& path) const
 	{
 		return GetComponentState(instanceId, path) == CS_SUPPRESSED;
 	}
 
 	/// Check if a component should be drawn with transparency
-	bool IsComponentTransparent(const ON_UUID& instanceId, const char* path) const
+	bool IsComponentTransparent(const ON_UUID& instanceId, const CComponentPath& path) const
 	{
 		return GetComponentState(instanceId, path) == CS_TRANSPARENT;
 	}
 
-	/// O(1) check if any descendant path is non-visible
-	bool HasHiddenDescendants(const ON_UUID& instanceId, const char* pathPrefix) const
+	/// O(depth) check if the path itself or any descendant path is non-visible
+	bool HasHiddenDescendants(const ON_UUID& instanceId, const CComponentPath& pathPrefix) const
 	{
-		auto it = m_data.find(instanceId);
-		if (it == m_data.end())
-			return false;
-		return it->second.parentPrefixes.count(std::string(pathPrefix)) > 0;
+		return CVisibilityTrieNode::HasNonVisibleAtOrBelow(FindInstance(instanceId), pathPrefix);
+	}
+
+	/// Number of hidden or suppressed component paths an instance is drawn
+	/// with, rules of definitionId included (0 if none)
+	int GetHiddenCount(const ON_UUID& instanceId, const ON_UUID& definitionId) const
+	{
+		const CVisibilityTrieNode::Ptr trie = GetEffectiveTrie(instanceId, definitionId);
+		if (!trie)
+			return 0;
+
+		int hidden = 0;
+		trie->ForEach([&hidden](const CComponentPath&, ComponentState state)
+		{
+			if (state == CS_HIDDEN || state == CS_SUPPRESSED)
+				hidden++;
+		});
+		return hidden;
 	}
 
 	/// Get all managed instance IDs
 	void GetManagedInstanceIds(std::vector<ON_UUID>& outIds) const
 	{
-		outIds.reserve(m_data.size());
-		for (const auto& pair : m_data)
-		{
-			if (!pair.second.states.empty())
-				outIds.push_back(pair.first);
-		}
+		outIds.reserve(m_instances->size());
+		for (const auto& pair : *m_instances)
+			outIds.push_back(pair.first);
 	}
 
-	/// Direct access to internal data (for building the snapshot)
-	std::unordered_map<ON_UUID, InstanceData, ON_UUID_Hash, ON_UUID_Equal> m_data;
+	/// Every managed instance with its state trie
+	const InstanceMap& Instances() const { return *m_instances; }
+
+	/// Every definition with rules and its rule trie
+	const RuleMap& Rules() const { return *m_rules; }
+
+	/// Direct access to internal data (filled by CVisibilityData::Publish).
+	/// The instance map is shared with the store, and with saved state tables,
+	/// until the next change to it.
+	std::shared_ptr<const InstanceMap> m_instances = std::make_shared<InstanceMap>();
+	std::shared_ptr<const RuleMap> m_rules = NoRules();
+	uint64_t m_generation = 0;
+	uint64_t m_definitionEpoch = 0;
+	std::shared_ptr<const CDefinitionChangeLog> m_definitionLog;
+	std::shared_ptr<const CInstanceBindings> m_bindings = std::make_shared<CInstanceBindings>();
 };
 
+/// Named state table (CVisibilityData::SaveStateTable): the tries of all
+/// instances managed under it and their bindings. Shares both with the
+/// snapshots it was saved from or activated into. Definition rules are not
+/// part of a table.
+struct CStateTable
+{
+	std::shared_ptr<const CVisibilitySnapshot::InstanceMap> instances;
+	std::shared_ptr<const CInstanceBindings> bindings;
+};
+
+/// State of a deleted instance set aside for undo (CVisibilityData::DetachInstance)
+struct CDetachedInstance
+{
+	CVisibilityTrieNode::Ptr root;
+	ON_UUID definitionId = ON_nil_uuid;   ///< definition the deleted object referenced
+	unsigned int objectSerial = 0;        ///< runtime serial of the deleted object
+};
 
 /// Thread-safe visibility state storage.
-/// Maps instance UUID -> map of component path -> ComponentState.
+/// Maps instance UUID -> trie of component path -> ComponentState.
+/// Mutators lock m_cs; queries read the published snapshot without locking
+/// and see the state as of the last completed mutation.
 class CVisibilityData
 {
 public:
+	typedef std::unordered_map<ON_UUID, CDetachedInstance, ON_UUID_Hash, ON_UUID_Equal> DetachedMap;
+
+	/// Set-aside states kept before the first PruneDetached is due
+	static const size_t DETACHED_PRUNE_MIN = 64;
+
 	CVisibilityData()
+		: m_instances(std::make_shared<CVisibilitySnapshot::InstanceMap>())
+		, m_rules(CVisibilitySnapshot::NoRules())
+		, m_published(std::make_shared<CVisibilitySnapshot>())
+		, m_bindings(std::make_shared<CInstanceBindings>())
 	{
 		::InitializeCriticalSection(&m_cs);
 	}
@@ -154,50 +425,213 @@ public:
 	CVisibilityData(const CVisibilityData&) = delete;
 	CVisibilityData& operator=(const CVisibilityData&) = delete;
 
-	/// Set a component to a specific state
-	void SetState(const ON_UUID& instanceId, const char* path, ComponentState state)
+	/// Set a component to a specific state.
+	/// Copies only the trie nodes along the path; no-op changes do not publish.
+	void SetState(const ON_UUID& instanceId, const CComponentPath& path, ComponentState state)
+	{
+		CAutoLock lock(m_cs);
+		const CVisibilityTrieNode::Ptr root = FindRoot(Instances(), instanceId);
+
+		if (CVisibilityTrieNode::Find(root.get(), path) == state)
+			return;
+
+		CVisibilityTrieNode::Ptr updated = CVisibilityTrieNode::With(root, path, state);
+		if (updated)
+			EditInstances()[instanceId] = updated;
+		else
+			Forget(instanceId);
+
+		Publish();
+	}
+
+	/// Apply many state changes under one lock and publish once.
+	/// Each instance trie is edited in place after its first copy, so derived
+	/// counts and flags are updated once per touched node rather than per change.
+	/// Returns the number of changes that altered the stored state.
+	int SetStates(const CComponentStateChange* changes, size_t count)
 	{
+		if (!changes || count == 0)
+			return 0;
+
 		CAutoLock lock(m_cs);
-		if (state == CS_VISIBLE)
+		EditorMap editors;
+		const int changed = EditTries(Instances(), changes, count, editors);
+		if (changed == 0)
+			return 0;
+
+		for (auto& pair : editors)
 		{
-			// Remove from map (visible is the default)
-			auto it = m_data.find(instanceId);
-			if (it != m_data.end())
-			{
-				it->second.erase(std::string(path));
-				if (it->second.empty())
-					m_data.erase(it);
-			}
-			RebuildPrefixes(instanceId);
+			if (!pair.second.Changed())
+				continue;
+			CVisibilityTrieNode::Ptr updated = pair.second.Commit();
+			if (updated)
+				EditInstances()[pair.first] = updated;
+			else
+				Forget(pair.first);
 		}
-		else
+
+		Publish();
+		return changed;
+	}
+
+	/// Install fully built per-instance tries and definition rules (bulk
+	/// load) and publish once. Each listed instance's state and each listed
+	/// definition's rules are replaced; others are untouched.
+	void LoadInstances(const CVisibilitySnapshot::InstanceMap& loaded, const CVisibilitySnapshot::RuleMap& loadedRules)
+	{
+		if (loaded.empty() && loadedRules.empty())
+			return;
+
+		CAutoLock lock(m_cs);
+		for (const auto& pair : loaded)
 		{
-			m_data[instanceId][std::string(path)] = state;
-			RebuildPrefixes(instanceId);
+			m_detached.erase(pair.first);
+			if (pair.second)
+				EditInstances()[pair.first] = pair.second;
+			else
+				Forget(pair.first);
 		}
+		ReplaceRules(loadedRules);
+		Publish();
 	}
 
-	/// Get a component's state
-	ComponentState GetState(const ON_UUID& instanceId, const char* path) const
+	/// Set a component state for every instance of a definition. Instances
+	/// keep their own states on top of it. No-op changes do not publish.
+	void SetDefinitionState(const ON_UUID& definitionId, const CComponentPath& path, ComponentState state)
 	{
 		CAutoLock lock(m_cs);
-		auto it = m_data.find(instanceId);
-		if (it == m_data.end())
-			return CS_VISIBLE;
-		auto sit = it->second.find(std::string(path));
-		if (sit == it->second.end())
-			return CS_VISIBLE;
-		return sit->second;
+		const CVisibilityTrieNode::Ptr root = FindRoot(*m_rules, definitionId);
+		if (CVisibilityTrieNode::Find(root.get(), path) == state)
+			return;
+
+		CVisibilitySnapshot::RuleMap replaced;
+		replaced[definitionId] = CVisibilityTrieNode::With(root, path, state);
+		ReplaceRules(replaced);
+		Publish();
+	}
+
+	/// Rule state of a component of a definition (CS_VISIBLE if none)
+	ComponentState GetDefinitionState(const ON_UUID& definitionId, const CComponentPath& path) const
+	{
+		return AcquireSnapshot()->GetDefinitionState(definitionId, path);
+	}
+
+	/// Drop all rules of a definition. Returns false if it had none.
+	bool ResetDefinition(const ON_UUID& definitionId)
+	{
+		CAutoLock lock(m_cs);
+		if (!m_rules->count(definitionId))
+			return false;
+
+		CVisibilitySnapshot::RuleMap replaced;
+		replaced[definitionId] = CVisibilityTrieNode::Ptr();
+		ReplaceRules(replaced);
+		Publish();
+		return true;
+	}
+
+	/// Save the state of all managed instances as a named table, replacing
+	/// a table of that name. O(1): the table shares the published instance
+	/// map and bindings. Returns the number of instances in it.
+	int SaveStateTable(const std::wstring& name)
+	{
+		CAutoLock lock(m_cs);
+		m_tables[name] = CStateTable{ m_instances, m_bindings };
+		return static_cast<int>(m_instances->size());
+	}
+
+	/// Make a saved table the state of all instances; instances outside it
+	/// stop being managed. One pointer swap and one publish whatever the
+	/// number of instances. Returns false if there is no such table.
+	bool ActivateStateTable(const std::wstring& name)
+	{
+		CAutoLock lock(m_cs);
+		auto it = m_tables.find(name);
+		if (it == m_tables.end())
+			return false;
+		if (it->second.instances == m_instances)
+			return true;
+
+		m_instances = it->second.instances;
+		m_bindings = it->second.bindings;
+		Publish();
+		return true;
+	}
+
+	/// Apply state changes to a saved table (created empty if missing)
+	/// without touching the current state. Returns the number of changes
+	/// that altered the table.
+	int SetStateTableStates(const std::wstring& name, const CComponentStateChange* changes, size_t count)
+	{
+		if (!changes || count == 0)
+			return 0;
+
+		CAutoLock lock(m_cs);
+		CStateTable& table = m_tables[name];
+		if (!table.instances)
+		{
+			table.instances = std::make_shared<CVisibilitySnapshot::InstanceMap>();
+			table.bindings = std::make_shared<CInstanceBindings>();
+		}
+
+		EditorMap editors;
+		const int changed = EditTries(*table.instances, changes, count, editors);
+		if (changed == 0)
+			return 0;
+
+		CVisibilitySnapshot::InstanceMap replaced;
+		for (auto& pair : editors)
+		{
+			if (pair.second.Changed())
+				replaced[pair.first] = pair.second.Commit();
+		}
+		ReplaceTableInstances(table, replaced);
+		return changed;
+	}
+
+	/// Replace tries of a saved table (nullptr = no state left), e.g. after
+	/// its paths were remapped for a definition edit
+	void ReplaceStateTableInstances(const std::wstring& name, const CVisibilitySnapshot::InstanceMap& replaced)
+	{
+		if (replaced.empty())
+			return;
+
+		CAutoLock lock(m_cs);
+		auto it = m_tables.find(name);
+		if (it == m_tables.end())
+			return;
+
+		ReplaceTableInstances(it->second, replaced);
+	}
+
+	/// Drop a saved table. Returns false if there is none of that name.
+	bool DeleteStateTable(const std::wstring& name)
+	{
+		CAutoLock lock(m_cs);
+		return m_tables.erase(name) > 0;
+	}
+
+	/// Copy the saved tables (the copies share their maps and bindings)
+	void GetStateTables(std::vector<std::pair<std::wstring, CStateTable>>& outTables) const
+	{
+		CAutoLock lock(m_cs);
+		outTables.assign(m_tables.begin(), m_tables.end());
+	}
+
+	/// Get a component's state
+	ComponentState GetState(const ON_UUID& instanceId, const CComponentPath& path) const
+	{
+		return AcquireSnapshot()->GetComponentState(instanceId, path);
 	}
 
 	/// Hide a component at a given path within a specific block instance
-	void SetComponentHidden(const ON_UUID& instanceId, const char* path)
+	void SetComponentHidden(const ON_UUID& instanceId, const CComponentPath& path)
 	{
 		SetState(instanceId, path, CS_HIDDEN);
 	}
 
 	/// Show a component at a given path within a specific block instance
-	void SetComponentVisible(const ON_UUID& instanceId, const char* path)
+	void SetComponentVisible(const ON_UUID& instanceId, const CComponentPath& path)
 	{
 		SetState(instanceId, path, CS_VISIBLE);
 	}
@@ -206,150 +640,451 @@ public:
 	void ResetInstance(const ON_UUID& instanceId)
 	{
 		CAutoLock lock(m_cs);
-		m_data.erase(instanceId);
-		m_prefixes.erase(instanceId);
+		m_detached.erase(instanceId);
+		if (Forget(instanceId))
+			Publish();
 	}
 
-	/// Check if this instance has any non-visible components (is managed by us)
-	bool IsManaged(const ON_UUID& instanceId) const
+	/// Set an instance's state aside while its object is deleted.
+	/// The instance stops being managed; ReattachInstance restores the state
+	/// if the object comes back (undo of the delete, or the add half of a
+	/// replace, which keeps the UUID). definitionId and objectSerial describe
+	/// the deleted object, for remaps and PruneDetachedDue.
+	void DetachInstance(const ON_UUID& instanceId, const ON_UUID& definitionId, unsigned int objectSerial)
 	{
 		CAutoLock lock(m_cs);
-		auto it = m_data.find(instanceId);
-		return it != m_data.end() && !it->second.empty();
+		const CVisibilityTrieNode::Ptr root = FindRoot(Instances(), instanceId);
+		if (!root)
+			return;
+		CDetachedInstance& detached = m_detached[instanceId];
+		detached.root = root;
+		detached.definitionId = definitionId;
+		detached.objectSerial = objectSerial;
+		Forget(instanceId);
+		Publish();
 	}
 
-	/// Check if a specific component path is hidden (CS_HIDDEN or CS_SUPPRESSED)
-	bool IsComponentHidden(const ON_UUID& instanceId, const char* path) const
+	/// Restore state set aside by DetachInstance. Returns false if there is none.
+	bool ReattachInstance(const ON_UUID& instanceId)
 	{
 		CAutoLock lock(m_cs);
-		auto it = m_data.find(instanceId);
-		if (it == m_data.end())
+		auto it = m_detached.find(instanceId);
+		if (it == m_detached.end())
 			return false;
-		auto sit = it->second.find(std::string(path));
-		if (sit == it->second.end())
-			return false;
-		return sit->second == CS_HIDDEN || sit->second == CS_SUPPRESSED;
+		EditInstances()[instanceId] = it->second.root;
+		m_detached.erase(it);
+		Publish();
+		return true;
 	}
 
-	/// Check if any path starting with the given prefix is non-visible.
-	/// Uses precomputed prefix set for O(1) lookup.
-	bool HasHiddenDescendants(const ON_UUID& instanceId, const char* pathPrefix) const
+	/// Copy of the states set aside by DetachInstance
+	void GetDetachedInstances(DetachedMap& outDetached) const
 	{
 		CAutoLock lock(m_cs);
-		auto it = m_prefixes.find(instanceId);
-		if (it == m_prefixes.end())
-			return false;
-		return it->second.count(std::string(pathPrefix)) > 0;
+		outDetached = m_detached;
 	}
 
-	/// Get the number of non-visible component paths for a specific instance
-	int GetHiddenCount(const ON_UUID& instanceId) const
+	/// Replace the tries of set-aside states, e.g. remapped across a
+	/// definition edit; nullptr drops the state. Ids not set aside are
+	/// ignored. Nothing is published: detached states are not drawn.
+	void ReplaceDetachedInstances(const CVisibilitySnapshot::InstanceMap& replaced)
 	{
 		CAutoLock lock(m_cs);
-		auto it = m_data.find(instanceId);
-		if (it == m_data.end())
-			return 0;
-		return static_cast<int>(it->second.size());
+		for (const auto& pair : replaced)
+		{
+			auto it = m_detached.find(pair.first);
+			if (it == m_detached.end())
+				continue;
+			if (pair.second)
+				it->second.root = pair.second;
+			else
+				m_detached.erase(it);
+		}
+		m_detachedPruneAt = (std::max)(DETACHED_PRUNE_MIN, 2 * m_detached.size());
 	}
 
-	/// Clear all visibility data
-	void ClearAll()
+	/// Whether set-aside states doubled since they were last replaced, so
+	/// the states of objects purged from the undo stack should be dropped
+	bool PruneDetachedDue() const
 	{
 		CAutoLock lock(m_cs);
-		m_data.clear();
-		m_prefixes.clear();
+		return m_detached.size() >= m_detachedPruneAt;
+	}
+
+	/// Check if this instance has any non-visible components (is managed by us)
+	bool IsManaged(const ON_UUID& instanceId) const
+	{
+		return AcquireSnapshot()->IsManaged(instanceId);
+	}
+
+	/// Check if a specific component path is hidden (CS_HIDDEN or CS_SUPPRESSED)
+	bool IsComponentHidden(const ON_UUID& instanceId, const CComponentPath& path) const
+	{
+		return AcquireSnapshot()->IsComponentHidden(instanceId, path);
+	}
+
+	/// Check if the path itself or any path below it is non-visible.
+	/// O(depth) walk of the instance trie.
+	bool HasHiddenDescendants(const ON_UUID& instanceId, const CComponentPath& pathPrefix) const
+	{
+		return AcquireSnapshot()->HasHiddenDescendants(instanceId, pathPrefix);
+	}
+
+	/// Number of hidden or suppressed component paths of an instance of
+	/// definitionId, definition rules included
+	int GetHiddenCount(const ON_UUID& instanceId, const ON_UUID& definitionId) const
+	{
+		return AcquireSnapshot()->GetHiddenCount(instanceId, definitionId);
 	}
 
 	/// Get all hidden paths for an instance (copies into output set — backward compat)
 	void GetHiddenPaths(const ON_UUID& instanceId, std::unordered_set<std::string>& outPaths) const
 	{
-		CAutoLock lock(m_cs);
 		outPaths.clear();
-		auto it = m_data.find(instanceId);
-		if (it != m_data.end())
+		const std::shared_ptr<const CVisibilitySnapshot> snap = AcquireSnapshot();
+		const CVisibilityTrieNode* root = snap->FindInstance(instanceId);
+		if (!root)
+			return;
+		root->ForEach([&outPaths](const CComponentPath& path, ComponentState state)
 		{
-			for (const auto& pair : it->second)
-			{
-				if (pair.second == CS_HIDDEN || pair.second == CS_SUPPRESSED)
-					outPaths.insert(pair.first);
-			}
-		}
+			if (state == CS_HIDDEN || state == CS_SUPPRESSED)
+				outPaths.insert(path.ToString());
+		});
 	}
 
 	/// Get all managed instance IDs
 	void GetManagedInstanceIds(std::vector<ON_UUID>& outIds) const
 	{
+		AcquireSnapshot()->GetManagedInstanceIds(outIds);
+	}
+
+	/// Record that any instance definition may have changed (e.g. the document
+	/// closed). Publishes a snapshot with a new definition epoch so the conduit
+	/// drops all cached definition geometry before its next draw.
+	void NotifyDefinitionsChanged()
+	{
+		NotifyDefinitionsChanged(std::vector<ON_UUID>(1, ON_nil_uuid));
+	}
+
+	/// Record that specific definitions changed (edited, added or deleted).
+	/// definitionIds must include every definition nesting a changed one; the
+	/// conduit only drops cached geometry of the listed definitions.
+	void NotifyDefinitionsChanged(const std::vector<ON_UUID>& definitionIds)
+	{
+		if (definitionIds.empty())
+			return;
+
+		CAutoLock lock(m_cs);
+		LogDefinitionChanges(definitionIds);
+		Publish();
+	}
+
+	/// Install the instance paths and definition rules remapped by a
+	/// definition edit (nullptr = no state left) and record the changed
+	/// definitions as NotifyDefinitionsChanged does, publishing once for the
+	/// whole edit
+	void ApplyDefinitionEdit(
+		const CVisibilitySnapshot::InstanceMap& remapped,
+		const CVisibilitySnapshot::RuleMap& remappedRules,
+		const std::vector<ON_UUID>& definitionIds)
+	{
+		if (remapped.empty() && remappedRules.empty() && definitionIds.empty())
+			return;
+
 		CAutoLock lock(m_cs);
-		outIds.reserve(m_data.size());
-		for (const auto& pair : m_data)
+		for (const auto& pair : remapped)
 		{
-			if (!pair.second.empty())
-				outIds.push_back(pair.first);
+			if (pair.second)
+				EditInstances()[pair.first] = pair.second;
+			else
+				Forget(pair.first);
 		}
+		ReplaceRules(remappedRules);
+		if (!definitionIds.empty())
+			LogDefinitionChanges(definitionIds);
+		Publish();
 	}
 
-	/// Take a lock-free snapshot of all data for use during one frame.
-	/// Call once at frame start, use the snapshot for all checks.
-	CVisibilitySnapshot TakeSnapshot() const
+	/// Record the document objects managed instances are drawn from, so
+	/// readers can skip UUID lookups and find the managed instances of a
+	/// definition. Unmanaged objects and unchanged bindings are ignored;
+	/// publishes once if anything changed. Bindings are dropped automatically
+	/// when an instance stops being managed.
+	void BindInstances(const CRhinoInstanceObject* const* objects, size_t count)
 	{
 		CAutoLock lock(m_cs);
-		CVisibilitySnapshot snap;
-		for (const auto& pair : m_data)
+		bool changed = false;
+		for (size_t i = 0; i < count; i++)
 		{
-			if (pair.second.empty())
+			const CRhinoInstanceObject* pObject = objects[i];
+			if (!pObject)
+				continue;
+
+			const ON_UUID instanceId = pObject->Attributes().m_uuid;
+			if (!Instances().count(instanceId))
+				continue;
+
+			const CRhinoInstanceDefinition* pDef = pObject->InstanceDefinition();
+			CInstanceBinding binding;
+			binding.pObject = pObject;
+			binding.objectSerial = pObject->RuntimeSerialNumber();
+			binding.definitionId = pDef ? pDef->Id() : ON_nil_uuid;
+
+			const CInstanceBindings& current = m_bindingsEdit ? *m_bindingsEdit : *m_bindings;
+			auto it = current.instances.find(instanceId);
+			if (it != current.instances.end() && it->second.pObject == binding.pObject
+				&& it->second.objectSerial == binding.objectSerial
+				&& ON_UuidCompare(it->second.definitionId, binding.definitionId) == 0)
 				continue;
-			CVisibilitySnapshot::InstanceData& instData = snap.m_data[pair.first];
-			instData.states = pair.second;
 
-			// Copy precomputed prefixes
-			auto pit = m_prefixes.find(pair.first);
-			if (pit != m_prefixes.end())
-				instData.parentPrefixes = pit->second;
+			EditBindings().Set(instanceId, binding);
+			changed = true;
 		}
-		return snap;
+
+		if (!changed)
+			return;
+
+		Publish();
+
+		// Tables showing the published instances share its bindings, so
+		// activating them later needs no rebinding
+		for (auto& pair : m_tables)
+		{
+			if (pair.second.instances == m_instances)
+				pair.second.bindings = m_bindings;
+		}
+	}
+
+	/// Approximate bytes copied by all snapshot publications so far (lock-free)
+	uint64_t GetPublishedBytes() const
+	{
+		return m_publishedBytes.load(std::memory_order_relaxed);
+	}
+
+	/// Generation of the currently published snapshot.
+	/// Lock-free; compare against CVisibilitySnapshot::Generation() to detect changes.
+	uint64_t GetGeneration() const
+	{
+		return m_generation.load(std::memory_order_acquire);
+	}
+
+	/// Get the currently published snapshot (no deep copy, no lock).
+	/// The returned snapshot is immutable and stays valid while referenced.
+	std::shared_ptr<const CVisibilitySnapshot> AcquireSnapshot() const
+	{
+		return std::atomic_load_explicit(&m_published, std::memory_order_acquire);
 	}
 
 private:
-	/// Rebuild the parent prefix set for an instance after state changes.
-	/// For path "1.0.2", adds prefixes "1" and "1.0".
-	/// Must be called while lock is held.
-	void RebuildPrefixes(const ON_UUID& instanceId)
+	/// Remove an instance along with its binding. Returns false if it was
+	/// not managed. Lock must be held.
+	bool Forget(const ON_UUID& instanceId)
+	{
+		if (!Instances().count(instanceId))
+			return false;
+
+		const CInstanceBindings& current = m_bindingsEdit ? *m_bindingsEdit : *m_bindings;
+		if (current.instances.count(instanceId))
+			EditBindings().Remove(instanceId);
+		EditInstances().erase(instanceId);
+		return true;
+	}
+
+	/// Trie of an instance in instances (nullptr if not managed)
+	static CVisibilityTrieNode::Ptr FindRoot(const CVisibilitySnapshot::InstanceMap& instances, const ON_UUID& instanceId)
+	{
+		auto it = instances.find(instanceId);
+		return it != instances.end() ? it->second : CVisibilityTrieNode::Ptr();
+	}
+
+	/// Current instance map: the pending copy while a mutation changes it,
+	/// else the published one. Lock must be held.
+	const CVisibilitySnapshot::InstanceMap& Instances() const
+	{
+		return m_instancesEdit ? *m_instancesEdit : *m_instances;
+	}
+
+	/// Writable instance map for the next publication. Copied whole once per
+	/// publish that touches an instance: O(managed instances) entries.
+	/// Lock must be held.
+	CVisibilitySnapshot::InstanceMap& EditInstances()
 	{
-		auto it = m_data.find(instanceId);
-		if (it == m_data.end() || it->second.empty())
+		if (!m_instancesEdit)
 		{
-			m_prefixes.erase(instanceId);
+			m_instancesEdit.reset(new CVisibilitySnapshot::InstanceMap(*m_instances));
+			m_publishedBytes.fetch_add(m_instances->size()
+				* (sizeof(CVisibilitySnapshot::InstanceMap::value_type) + 2 * sizeof(void*)),
+				std::memory_order_relaxed);
+		}
+		return *m_instancesEdit;
+	}
+
+	/// Install rule tries of definitions (nullptr = no rules left) in a copy
+	/// of the rule map. There are few rules, so it is copied whole rather
+	/// than shared with a pending edit. Lock must be held.
+	void ReplaceRules(const CVisibilitySnapshot::RuleMap& replaced)
+	{
+		if (replaced.empty())
 			return;
+
+		std::shared_ptr<CVisibilitySnapshot::RuleMap> rules = std::make_shared<CVisibilitySnapshot::RuleMap>(*m_rules);
+		for (const auto& pair : replaced)
+		{
+			if (pair.second)
+				(*rules)[pair.first] = pair.second;
+			else
+				rules->erase(pair.first);
 		}
+		m_publishedBytes.fetch_add(rules->size()
+			* (sizeof(CVisibilitySnapshot::RuleMap::value_type) + 2 * sizeof(void*)),
+			std::memory_order_relaxed);
+		m_rules = rules;
+	}
 
-		auto& prefixSet = m_prefixes[instanceId];
-		prefixSet.clear();
+	typedef std::unordered_map<ON_UUID, CVisibilityTrieEditor, ON_UUID_Hash, ON_UUID_Equal> EditorMap;
 
-		for (const auto& pair : it->second)
+	/// Install tries into a saved table (nullptr = no state left), copying
+	/// its map and, if an instance leaves it, its bindings. Lock must be held.
+	static void ReplaceTableInstances(CStateTable& table, const CVisibilitySnapshot::InstanceMap& replaced)
+	{
+		CVisibilitySnapshot::InstanceMap edited(*table.instances);
+		std::unique_ptr<CInstanceBindings> bindings;
+		for (const auto& pair : replaced)
 		{
-			const std::string& path = pair.first;
-			// Add all parent prefixes of this path
-			// e.g. for "1.0.2" add "1.0.2", "1.0", "1"
-			prefixSet.insert(path);
-			size_t pos = path.rfind('.');
-			while (pos != std::string::npos)
+			if (pair.second)
+			{
+				edited[pair.first] = pair.second;
+				continue;
+			}
+
+			edited.erase(pair.first);
+			if (table.bindings->instances.count(pair.first))
 			{
-				std::string prefix = path.substr(0, pos);
-				prefixSet.insert(prefix);
-				pos = prefix.rfind('.');
+				if (!bindings)
+					bindings.reset(new CInstanceBindings(*table.bindings));
+				bindings->Remove(pair.first);
 			}
 		}
+
+		table.instances = std::make_shared<const CVisibilitySnapshot::InstanceMap>(std::move(edited));
+		if (bindings)
+			table.bindings = std::shared_ptr<const CInstanceBindings>(std::move(bindings));
+	}
+
+	/// Apply changes to the tries of instances through one editor per
+	/// instance (created in editors). Returns the number of changes that
+	/// altered a trie. instances itself is not modified.
+	static int EditTries(
+		const CVisibilitySnapshot::InstanceMap& instances,
+		const CComponentStateChange* changes,
+		size_t count,
+		EditorMap& editors)
+	{
+		int changed = 0;
+		for (size_t i = 0; i < count; i++)
+		{
+			const CComponentStateChange& change = changes[i];
+			auto eit = editors.find(change.instanceId);
+			if (eit == editors.end())
+				eit = editors.emplace(change.instanceId, CVisibilityTrieEditor(FindRoot(instances, change.instanceId))).first;
+			if (eit->second.Set(change.path, change.state))
+				changed++;
+		}
+		return changed;
+	}
+
+	/// Append definitionIds to the change log under a new epoch. Lock must be held.
+	void LogDefinitionChanges(const std::vector<ON_UUID>& definitionIds)
+	{
+		m_definitionEpoch++;
+
+		std::shared_ptr<CDefinitionChangeLog> log = m_definitionLog
+			? std::make_shared<CDefinitionChangeLog>(*m_definitionLog)
+			: std::make_shared<CDefinitionChangeLog>();
+		for (const ON_UUID& id : definitionIds)
+			log->entries.push_back({ m_definitionEpoch, id });
+
+		if (log->entries.size() > CDefinitionChangeLog::MAX_ENTRIES)
+		{
+			const size_t drop = log->entries.size() - CDefinitionChangeLog::MAX_ENTRIES;
+			log->floor = log->entries[drop - 1].epoch;
+			log->entries.erase(log->entries.begin(), log->entries.begin() + drop);
+		}
+		m_definitionLog = log;
+	}
+
+	/// Writable bindings for the next publication (copied once per publish).
+	/// Lock must be held.
+	CInstanceBindings& EditBindings()
+	{
+		if (!m_bindingsEdit)
+			m_bindingsEdit.reset(new CInstanceBindings(*m_bindings));
+		return *m_bindingsEdit;
+	}
+
+	/// Publish the current state as a new immutable snapshot.
+	/// Shares the instance map (and its tries) with the store; the map was
+	/// copied by EditInstances if this publication changed it.
+	/// Must be called while lock is held.
+	void Publish()
+	{
+		std::shared_ptr<CVisibilitySnapshot> snap = std::make_shared<CVisibilitySnapshot>();
+		if (m_instancesEdit)
+			m_instances = std::shared_ptr<const CVisibilitySnapshot::InstanceMap>(std::move(m_instancesEdit));
+		snap->m_instances = m_instances;
+		snap->m_rules = m_rules;
+		const uint64_t generation = m_generation.load(std::memory_order_relaxed) + 1;
+		snap->m_generation = generation;
+		snap->m_definitionEpoch = m_definitionEpoch;
+		snap->m_definitionLog = m_definitionLog;
+		if (m_bindingsEdit)
+			m_bindings = std::shared_ptr<const CInstanceBindings>(std::move(m_bindingsEdit));
+		snap->m_bindings = m_bindings;
+		std::atomic_store_explicit(&m_published,
+			std::shared_ptr<const CVisibilitySnapshot>(std::move(snap)), std::memory_order_release);
+		m_generation.store(generation, std::memory_order_release);
+		m_publishedBytes.fetch_add(sizeof(CVisibilitySnapshot), std::memory_order_relaxed);
 	}
 
 	mutable CRITICAL_SECTION m_cs;
 
-	/// instance UUID -> (component path -> state)
-	std::unordered_map<ON_UUID,
-		std::unordered_map<std::string, ComponentState>,
-		ON_UUID_Hash, ON_UUID_Equal> m_data;
+	/// instance UUID -> root of a non-empty, copy-on-write state trie, as
+	/// last published, and its pending copy while a mutation changes it (both
+	/// guarded by m_cs). Nodes are never modified in place once published.
+	std::shared_ptr<const CVisibilitySnapshot::InstanceMap> m_instances;
+	std::unique_ptr<CVisibilitySnapshot::InstanceMap> m_instancesEdit;
+
+	/// definition UUID -> root of a non-empty rule trie, shared with the
+	/// published snapshot (guarded by m_cs)
+	std::shared_ptr<const CVisibilitySnapshot::RuleMap> m_rules;
+
+	/// Most recently published snapshot. Replaced only under m_cs, always
+	/// through std::atomic_store/atomic_load so readers need no lock.
+	std::shared_ptr<const CVisibilitySnapshot> m_published;
+
+	/// Generation of m_published, readable without the lock
+	std::atomic<uint64_t> m_generation{ 0 };
+
+	/// Running total for GetPublishedBytes (map entries plus bucket/node overhead)
+	std::atomic<uint64_t> m_publishedBytes{ 0 };
+
+	/// States of deleted instances, kept for undo (guarded by m_cs)
+	DetachedMap m_detached;
+
+	/// m_detached size from which PruneDetachedDue is true (guarded by m_cs)
+	size_t m_detachedPruneAt = DETACHED_PRUNE_MIN;
+
+	/// Incremented by NotifyDefinitionsChanged (guarded by m_cs)
+	uint64_t m_definitionEpoch = 0;
+
+	/// Published with every snapshot (guarded by m_cs)
+	std::shared_ptr<const CDefinitionChangeLog> m_definitionLog;
+
+	/// Last published bindings, and their pending copy while a mutation
+	/// changes them (both guarded by m_cs)
+	std::shared_ptr<const CInstanceBindings> m_bindings;
+	std::unique_ptr<CInstanceBindings> m_bindingsEdit;
 
-	/// instance UUID -> set of parent prefixes for O(1) HasHiddenDescendants
-	std::unordered_map<ON_UUID,
-		std::unordered_set<std::string>,
-		ON_UUID_Hash, ON_UUID_Equal> m_prefixes;
+	/// Saved state tables by name (guarded by m_cs)
+	std::unordered_map<std::wstring, CStateTable> m_tables;
 };
@@ -0,0 +1,344 @@
+// VisibilityPersistence.cpp : Binary (and legacy text) visibility state persistence
+
+#include "stdafx.h"
+#include "VisibilityPersistence.h"
+#include "Constants.h"
+#include <algorithm>
+#include <cstring>
+#include <cwchar>
+#include <string>
+
+static const uint8_t FORMAT_MAGIC[4] = { 'R', 'A', 'O', 'V' };
+static const uint8_t FORMAT_VERSION = 2;   // 2 = definition rules after the instances
+
+static const char BASE64_CHARS[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// --- Primitive encoding ---
+
+static void WriteVarint(std::vector<uint8_t>& out, uint64_t value)
+{
+	while (value >= 0x80)
+	{
+		out.push_back(static_cast<uint8_t>(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back(static_cast<uint8_t>(value));
+}
+
+static bool ReadVarint(const uint8_t*& p, const uint8_t* end, uint64_t& value)
+{
+	value = 0;
+	for (int shift = 0; shift < 64; shift += 7)
+	{
+		if (p == end)
+			return false;
+		const uint8_t byte = *p++;
+		value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0)
+			return true;
+	}
+	return false;
+}
+
+static void WriteUuid(std::vector<uint8_t>& out, const ON_UUID& id)
+{
+	for (int i = 0; i < 4; i++)
+		out.push_back(static_cast<uint8_t>(id.Data1 >> (8 * i)));
+	for (int i = 0; i < 2; i++)
+		out.push_back(static_cast<uint8_t>(id.Data2 >> (8 * i)));
+	for (int i = 0; i < 2; i++)
+		out.push_back(static_cast<uint8_t>(id.Data3 >> (8 * i)));
+	out.insert(out.end(), id.Data4, id.Data4 + 8);
+}
+
+static bool ReadUuid(const uint8_t*& p, const uint8_t* end, ON_UUID& id)
+{
+	if (end - p < 16)
+		return false;
+	id.Data1 = static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8)
+		| (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+	id.Data2 = static_cast<uint16_t>(p[4] | (p[5] << 8));
+	id.Data3 = static_cast<uint16_t>(p[6] | (p[7] << 8));
+	std::memcpy(id.Data4, p + 8, 8);
+	p += 16;
+	return true;
+}
+
+static void AppendBase64(const std::vector<uint8_t>& in, std::string& out)
+{
+	out.reserve(out.size() + (in.size() + 2) / 3 * 4);
+	size_t i = 0;
+	for (; i + 3 <= in.size(); i += 3)
+	{
+		const uint32_t v = (in[i] << 16) | (in[i + 1] << 8) | in[i + 2];
+		out += BASE64_CHARS[(v >> 18) & 0x3f];
+		out += BASE64_CHARS[(v >> 12) & 0x3f];
+		out += BASE64_CHARS[(v >> 6) & 0x3f];
+		out += BASE64_CHARS[v & 0x3f];
+	}
+	if (i < in.size())
+	{
+		const bool two = i + 1 < in.size();
+		const uint32_t v = (in[i] << 16) | (two ? in[i + 1] << 8 : 0);
+		out += BASE64_CHARS[(v >> 18) & 0x3f];
+		out += BASE64_CHARS[(v >> 12) & 0x3f];
+		out += two ? BASE64_CHARS[(v >> 6) & 0x3f] : '=';
+		out += '=';
+	}
+}
+
+static int Base64Value(wchar_t c)
+{
+	if (c >= L'A' && c <= L'Z') return c - L'A';
+	if (c >= L'a' && c <= L'z') return c - L'a' + 26;
+	if (c >= L'0' && c <= L'9') return c - L'0' + 52;
+	if (c == L'+') return 62;
+	if (c == L'/') return 63;
+	return -1;
+}
+
+static bool DecodeBase64(const wchar_t* text, size_t length, std::vector<uint8_t>& out)
+{
+	out.clear();
+	out.reserve(length / 4 * 3);
+
+	uint32_t bits = 0;
+	int bitCount = 0;
+	for (size_t i = 0; i < length; i++)
+	{
+		if (text[i] == L'=')
+			break;
+		const int value = Base64Value(text[i]);
+		if (value < 0)
+			return false;
+		bits = (bits << 6) | static_cast<uint32_t>(value);
+		bitCount += 6;
+		if (bitCount >= 8)
+		{
+			bitCount -= 8;
+			out.push_back(static_cast<uint8_t>(bits >> bitCount));
+		}
+	}
+	return true;
+}
+
+// --- Binary chunk ---
+
+/// Append the UUID, entry count and prefix-shared entries of one trie
+static void WriteTrie(std::vector<uint8_t>& out, const ON_UUID& id, const CVisibilityTrieNode& root)
+{
+	WriteUuid(out, id);
+	WriteVarint(out, root.Count());
+
+	CComponentPath previous;
+	root.ForEach([&out, &previous](const CComponentPath& path, ComponentState state)
+	{
+		int shared = 0;
+		while (shared < previous.Depth() && shared < path.Depth() && previous.At(shared) == path.At(shared))
+			shared++;
+
+		WriteVarint(out, static_cast<uint64_t>(shared));
+		WriteVarint(out, static_cast<uint64_t>(path.Depth() - shared));
+		for (int level = shared; level < path.Depth(); level++)
+			WriteVarint(out, static_cast<uint64_t>(path.At(level)));
+		out.push_back(static_cast<uint8_t>(state));
+
+		previous = path;
+	});
+}
+
+/// Read one section of tries written by WriteTrie, accepting states up to
+/// maxState. Returns false if it is malformed.
+static bool ReadTries(const uint8_t*& p, const uint8_t* end, uint8_t maxState, CVisibilitySnapshot::InstanceMap& out)
+{
+	uint64_t trieCount = 0;
+	if (!ReadVarint(p, end, trieCount) || trieCount > static_cast<uint64_t>(end - p) / 17)
+		return false;
+	out.reserve(out.size() + static_cast<size_t>(trieCount));
+
+	const CVisibilityTrieNode::Ptr empty;
+	for (uint64_t n = 0; n < trieCount; n++)
+	{
+		ON_UUID id;
+		uint64_t entryCount = 0;
+		if (!ReadUuid(p, end, id) || !ReadVarint(p, end, entryCount)
+			|| entryCount > static_cast<uint64_t>(end - p) / 3)
+			return false;
+
+		CVisibilityTrieEditor editor(empty);
+		CComponentPath path;
+		for (uint64_t e = 0; e < entryCount; e++)
+		{
+			uint64_t shared = 0;
+			uint64_t added = 0;
+			if (!ReadVarint(p, end, shared) || !ReadVarint(p, end, added)
+				|| shared > static_cast<uint64_t>(path.Depth()) || added > CComponentPath::MAX_DEPTH)
+				return false;
+
+			path = path.Prefix(static_cast<int>(shared));
+			for (uint64_t level = 0; level < added; level++)
+			{
+				uint64_t index = 0;
+				if (!ReadVarint(p, end, index)
+					|| index > static_cast<uint64_t>(CComponentPath::MAX_CHILD_INDEX)
+					|| !path.Push(static_cast<int>(index)))
+					return false;
+			}
+
+			if (p == end || *p > maxState || path.IsEmpty())
+				return false;
+			editor.Set(path, static_cast<ComponentState>(*p++));
+		}
+
+		CVisibilityTrieNode::Ptr root = editor.Commit();
+		if (root)
+			out[id] = root;
+	}
+	return true;
+}
+
+void EncodeVisibilityState(const CVisibilitySnapshot& snapshot, std::vector<uint8_t>& out)
+{
+	out.insert(out.end(), FORMAT_MAGIC, FORMAT_MAGIC + 4);
+	out.push_back(FORMAT_VERSION);
+
+	WriteVarint(out, snapshot.Instances().size());
+	for (const auto& pair : snapshot.Instances())
+		WriteTrie(out, pair.first, *pair.second);
+
+	WriteVarint(out, snapshot.Rules().size());
+	for (const auto& pair : snapshot.Rules())
+		WriteTrie(out, pair.first, *pair.second);
+}
+
+bool DecodeVisibilityState(
+	const uint8_t* data,
+	size_t size,
+	CVisibilitySnapshot::InstanceMap& out,
+	CVisibilitySnapshot::RuleMap& outRules)
+{
+	out.clear();
+	outRules.clear();
+	if (!data || size < 5 || std::memcmp(data, FORMAT_MAGIC, 4) != 0 || data[4] < 1 || data[4] > FORMAT_VERSION)
+		return false;
+
+	const uint8_t version = data[4];
+	const uint8_t* p = data + 5;
+	const uint8_t* end = data + size;
+
+	// Instance tries may hold CS_SHOWN overrides from version 2 on; rules never do
+	if (!ReadTries(p, end, version >= 2 ? CS_SHOWN : CS_TRANSPARENT, out)
+		|| (version >= 2 && !ReadTries(p, end, CS_TRANSPARENT, outRules)))
+	{
+		out.clear();
+		outRules.clear();
+		return false;
+	}
+	return true;
+}
+
+// --- Legacy text format: <uuid>|<path>:<state>|<path>:<state>\n per instance ---
+
+static void ParseTextVisibilityState(const ON_wString& data, CVisibilitySnapshot::InstanceMap& out)
+{
+	ON_String utf8(data);
+	const char* p = utf8.Array();
+	const char* end = p + utf8.Length();
+
+	while (p < end)
+	{
+		const char* lineEnd = std::find(p, end, '\n');
+		const char* firstPipe = std::find(p, lineEnd, '|');
+
+		char uuidBuf[64];
+		const size_t uuidLength = static_cast<size_t>(firstPipe - p);
+		if (firstPipe != lineEnd && uuidLength < sizeof(uuidBuf))
+		{
+			std::memcpy(uuidBuf, p, uuidLength);
+			uuidBuf[uuidLength] = 0;
+			const ON_UUID instanceId = ON_UuidFromString(uuidBuf);
+
+			if (!ON_UuidIsNil(instanceId))
+			{
+				auto existing = out.find(instanceId);
+				CVisibilityTrieEditor editor(existing != out.end() ? existing->second : CVisibilityTrieNode::Ptr());
+
+				const char* entry = firstPipe + 1;
+				while (entry < lineEnd)
+				{
+					const char* entryEnd = std::find(entry, lineEnd, '|');
+					const char* colon = std::find(entry, entryEnd, ':');
+
+					CComponentPath path;
+					if (colon != entryEnd && colon + 1 < entryEnd && CComponentPath::Parse(entry, colon, path))
+					{
+						int state = 0;
+						const char* digit = colon + 1;
+						while (digit < entryEnd && *digit >= '0' && *digit <= '9' && state <= CS_TRANSPARENT)
+							state = state * 10 + (*digit++ - '0');
+
+						if (state >= CS_VISIBLE && state <= CS_TRANSPARENT)
+							editor.Set(path, static_cast<ComponentState>(state));
+					}
+					entry = entryEnd + 1;
+				}
+
+				CVisibilityTrieNode::Ptr root = editor.Commit();
+				if (root)
+					out[instanceId] = root;
+				else if (existing != out.end())
+					out.erase(existing);
+			}
+		}
+
+		p = lineEnd + 1;
+	}
+}
+
+// --- Document user string ---
+
+ON_wString SerializeVisibilityState(CVisibilityData& visData)
+{
+	std::shared_ptr<const CVisibilitySnapshot> snap = visData.AcquireSnapshot();
+	if (snap->Instances().empty() && snap->Rules().empty())
+		return ON_wString();
+
+	std::vector<uint8_t> chunk;
+	EncodeVisibilityState(*snap, chunk);
+
+	std::string text;
+	AppendBase64(chunk, text);
+
+	ON_wString result(RAO_DOC_BINARY_PREFIX);
+	result += ON_wString(text.c_str());
+	return result;
+}
+
+void DeserializeVisibilityState(const ON_wString& data, CVisibilityData& visData)
+{
+	if (data.IsEmpty())
+		return;
+
+	CVisibilitySnapshot::InstanceMap loaded;
+	CVisibilitySnapshot::RuleMap loadedRules;
+
+	const wchar_t* text = data.Array();
+	const size_t length = static_cast<size_t>(data.Length());
+	const size_t prefixLength = std::wcslen(RAO_DOC_BINARY_PREFIX);
+
+	if (length >= prefixLength && std::wcsncmp(text, RAO_DOC_BINARY_PREFIX, prefixLength) == 0)
+	{
+		// A malformed chunk or one from a newer format version loads nothing
+		std::vector<uint8_t> chunk;
+		if (!DecodeBase64(text + prefixLength, length - prefixLength, chunk)
+			|| !DecodeVisibilityState(chunk.data(), chunk.size(), loaded, loadedRules))
+			return;
+	}
+	else
+	{
+		ParseTextVisibilityState(data, loaded);
+	}
+
+	visData.LoadInstances(loaded, loadedRules);
+}
@@ -0,0 +1,44 @@
+// VisibilityPersistence.h : Document persistence format for visibility state
+//
+// State is stored under the document user string RAO_DOC_KEY. Current files
+// hold a versioned binary chunk, base64-encoded behind RAO_DOC_BINARY_PREFIX:
+//
+//   "RAOV" magic, u8 format version, varint instance count, then per instance:
+//     16-byte UUID (little-endian fields), varint entry count, then per entry:
+//       varint levels shared with the previous path of this instance,
+//       varint new levels, the new child indices as varints,
+//       u8 ComponentState
+//   then (version 2) varint definition count and, per definition with rules,
+//     its 16-byte UUID and entries in the same form
+//
+// Entries are written in trie order, so consecutive paths share long
+// prefixes. Older files hold the text form "<uuid>|<path>:<state>|...\n",
+// which is still read but no longer written.
+//
+// Loading builds each trie with one CVisibilityTrieEditor and installs all
+// instances and rules in CVisibilityData with a single publish. Version 1
+// chunks (no rules) are still read.
+
+#pragma once
+
+#include "VisibilityData.h"
+#include <cstdint>
+#include <vector>
+
+/// Serialize all visibility state for the document user string
+ON_wString SerializeVisibilityState(CVisibilityData& visData);
+
+/// Load visibility state from the document user string (binary or legacy text).
+/// Instances present in data replace their current state.
+void DeserializeVisibilityState(const ON_wString& data, CVisibilityData& visData);
+
+/// Append the binary chunk for a snapshot (without base64 wrapping)
+void EncodeVisibilityState(const CVisibilitySnapshot& snapshot, std::vector<uint8_t>& out);
+
+/// Decode a binary chunk into per-instance tries and definition rules.
+/// Returns false (and leaves both empty) if the chunk is malformed or from a newer version.
+bool DecodeVisibilityState(
+	const uint8_t* data,
+	size_t size,
+	CVisibilitySnapshot::InstanceMap& out,
+	CVisibilitySnapshot::RuleMap& outRules);
@@ -0,0 +1,361 @@
+// VisibilityTrie.h : Per-instance component state trie keyed by child index
+//
+// One node per (nested) definition level that contains non-visible components.
+// Each node holds a dense byte per child index: the child's ComponentState in
+// the low bits plus a flag telling whether the child has non-visible
+// descendants. Traversals can therefore walk the trie alongside the
+// definition tree with one array read per component and no hash lookups.
+//
+// The same tries hold definition-level rules (CVisibilityData). Instance
+// tries layered on top of them may use CS_SHOWN, which only exists there.
+//
+// Nodes are immutable once shared (published in a snapshot). Updates copy only
+// the nodes along the changed path and share everything else. Batches go
+// through CVisibilityTrieEditor, which copies each shared node at most once.
+
+#pragma once
+
+#include "ComponentPath.h"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+/// Component state enum — supports hide, suppress, and transparency
+enum ComponentState
+{
+	CS_VISIBLE     = 0,
+	CS_HIDDEN      = 1,   // Visual only — still in BOM, still in bbox
+	CS_SUPPRESSED  = 2,   // Structural — excluded from BOM, bbox, export
+	CS_TRANSPARENT = 3,   // Draw with alpha transparency
+	CS_SHOWN       = 4    // Instance override only: visible although a definition rule says otherwise
+};
+
+class CVisibilityTrieNode
+{
+	friend class CVisibilityTrieEditor;
+
+public:
+	typedef std::shared_ptr<const CVisibilityTrieNode> Ptr;
+
+	CVisibilityTrieNode() = default;
+
+	/// State of the direct child at childIndex (CS_VISIBLE if unset)
+	ComponentState StateAt(int childIndex) const
+	{
+		if (childIndex < 0 || childIndex >= static_cast<int>(m_entries.size()))
+			return CS_VISIBLE;
+		return static_cast<ComponentState>(m_entries[childIndex] & STATE_MASK);
+	}
+
+	/// True if the direct child at childIndex has non-visible descendants
+	bool HasHiddenDescendants(int childIndex) const
+	{
+		if (childIndex < 0 || childIndex >= static_cast<int>(m_entries.size()))
+			return false;
+		return (m_entries[childIndex] & DESCENDANTS_FLAG) != 0;
+	}
+
+	/// Subtree node of the direct child at childIndex, or nullptr if the child
+	/// has no non-visible descendants
+	const CVisibilityTrieNode* ChildAt(int childIndex) const
+	{
+		if (!HasHiddenDescendants(childIndex))
+			return nullptr;
+		auto it = FindChildSlot(childIndex);
+		return it != m_children.end() ? it->second.get() : nullptr;
+	}
+
+	/// Number of non-visible component paths in this subtree
+	uint32_t Count() const { return m_count; }
+
+	/// Structural hash of this subtree: equal tries have equal hashes,
+	/// regardless of which instance they belong to
+	uint64_t Hash() const { return m_hash; }
+
+	/// Structural equality (same states at the same paths)
+	static bool Equal(const CVisibilityTrieNode* a, const CVisibilityTrieNode* b)
+	{
+		if (a == b)
+			return true;
+		if (!a || !b || a->m_hash != b->m_hash || a->m_count != b->m_count)
+			return false;
+		if (a->m_entries != b->m_entries || a->m_children.size() != b->m_children.size())
+			return false;
+		for (size_t i = 0; i < a->m_children.size(); i++)
+		{
+			if (a->m_children[i].first != b->m_children[i].first
+				|| !Equal(a->m_children[i].second.get(), b->m_children[i].second.get()))
+				return false;
+		}
+		return true;
+	}
+
+	/// Look up the state at a full path below this node
+	static ComponentState Find(const CVisibilityTrieNode* root, const CComponentPath& path)
+	{
+		const CVisibilityTrieNode* node = FindParent(root, path);
+		return node ? node->StateAt(path.Leaf()) : CS_VISIBLE;
+	}
+
+	/// True if path itself or any path below it is non-visible
+	static bool HasNonVisibleAtOrBelow(const CVisibilityTrieNode* root, const CComponentPath& path)
+	{
+		const CVisibilityTrieNode* node = FindParent(root, path);
+		if (!node)
+			return false;
+		return node->StateAt(path.Leaf()) != CS_VISIBLE || node->HasHiddenDescendants(path.Leaf());
+	}
+
+	/// Return a trie equal to root with path set to state.
+	/// Shares all nodes off the changed path; returns nullptr if the result is empty.
+	static Ptr With(const Ptr& root, const CComponentPath& path, ComponentState state);
+
+	/// Layer instance overrides on a definition's rules: every path set in
+	/// overrides takes its state there (CS_SHOWN clears the rule's state).
+	/// Shares the rule nodes no override touches; nullptr if nothing is left.
+	static Ptr Overlay(const Ptr& rules, const CVisibilityTrieNode& overrides);
+
+	/// Visit every non-visible (path, state) pair in this subtree
+	template <typename Fn>
+	void ForEach(Fn&& fn) const
+	{
+		const CComponentPath prefix;
+		ForEachBelow(prefix, fn);
+	}
+
+private:
+	static const uint8_t STATE_MASK = 0x07;
+	static const uint8_t DESCENDANTS_FLAG = 0x80;
+
+	typedef std::vector<std::pair<uint32_t, Ptr>> ChildList;
+
+	static bool SlotLess(const std::pair<uint32_t, Ptr>& slot, uint32_t index)
+	{
+		return slot.first < index;
+	}
+
+	ChildList::const_iterator FindChildSlot(int childIndex) const
+	{
+		auto it = std::lower_bound(m_children.begin(), m_children.end(), static_cast<uint32_t>(childIndex), SlotLess);
+		if (it != m_children.end() && it->first != static_cast<uint32_t>(childIndex))
+			return m_children.end();
+		return it;
+	}
+
+	/// Node holding the leaf entry of path (i.e. the node for path's parent level)
+	static const CVisibilityTrieNode* FindParent(const CVisibilityTrieNode* root, const CComponentPath& path)
+	{
+		if (!root || path.IsEmpty())
+			return nullptr;
+		const CVisibilityTrieNode* node = root;
+		for (int level = 0; node && level < path.Depth() - 1; level++)
+			node = node->ChildAt(path.At(level));
+		return node;
+	}
+
+	void SetOwnState(int index, ComponentState state)
+	{
+		if (index >= static_cast<int>(m_entries.size()))
+		{
+			if (state == CS_VISIBLE)
+				return;
+			m_entries.resize(static_cast<size_t>(index) + 1, 0);
+		}
+
+		uint8_t& entry = m_entries[index];
+		const bool wasSet = (entry & STATE_MASK) != CS_VISIBLE;
+		entry = static_cast<uint8_t>((entry & ~STATE_MASK) | static_cast<uint8_t>(state));
+		const bool isSet = state != CS_VISIBLE;
+		if (wasSet && !isSet)
+			m_count--;
+		else if (!wasSet && isSet)
+			m_count++;
+	}
+
+	/// Store (or clear) the subtree slot for a child. Counts are maintained by the caller.
+	void SetChild(int index, const Ptr& child)
+	{
+		auto it = std::lower_bound(m_children.begin(), m_children.end(), static_cast<uint32_t>(index), SlotLess);
+		const bool exists = it != m_children.end() && it->first == static_cast<uint32_t>(index);
+
+		if (child)
+		{
+			if (exists)
+				it->second = child;
+			else
+				m_children.insert(it, std::make_pair(static_cast<uint32_t>(index), child));
+
+			if (index >= static_cast<int>(m_entries.size()))
+				m_entries.resize(static_cast<size_t>(index) + 1, 0);
+			m_entries[index] |= DESCENDANTS_FLAG;
+		}
+		else
+		{
+			if (exists)
+				m_children.erase(it);
+			if (index < static_cast<int>(m_entries.size()))
+				m_entries[index] &= static_cast<uint8_t>(~DESCENDANTS_FLAG);
+		}
+	}
+
+	/// Recompute m_hash from entries and (already hashed) children
+	void UpdateHash()
+	{
+		uint64_t hash = 0xcbf29ce484222325ULL;
+		for (size_t i = 0; i < m_entries.size(); i++)
+		{
+			if (m_entries[i] == 0)
+				continue;
+			hash = (hash ^ static_cast<uint64_t>(i)) * 0x100000001b3ULL;
+			hash = (hash ^ m_entries[i]) * 0x100000001b3ULL;
+		}
+		for (const auto& slot : m_children)
+		{
+			hash = (hash ^ slot.first) * 0x100000001b3ULL;
+			hash ^= slot.second->m_hash + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+		}
+		m_hash = hash;
+	}
+
+	/// Drop trailing all-visible entries so the dense array stays minimal
+	void Trim()
+	{
+		while (!m_entries.empty() && m_entries.back() == 0)
+			m_entries.pop_back();
+	}
+
+	template <typename Fn>
+	void ForEachBelow(const CComponentPath& prefix, Fn& fn) const
+	{
+		for (size_t i = 0; i < m_entries.size(); i++)
+		{
+			const ComponentState state = static_cast<ComponentState>(m_entries[i] & STATE_MASK);
+			if (state != CS_VISIBLE)
+				fn(prefix.Child(static_cast<int>(i)), state);
+		}
+		for (const auto& slot : m_children)
+			slot.second->ForEachBelow(prefix.Child(static_cast<int>(slot.first)), fn);
+	}
+
+	std::vector<uint8_t> m_entries;  ///< per child index: ComponentState | DESCENDANTS_FLAG
+	ChildList m_children;            ///< sorted by child index; only flagged children
+	uint32_t m_count = 0;            ///< non-visible paths in this subtree
+	uint64_t m_hash = 0;             ///< structural hash, fixed at commit time
+};
+
+
+/// Applies several updates to one trie. Each node shared with the original
+/// trie is copied at most once; nodes created by the editor are modified in
+/// place. The original trie is never touched.
+class CVisibilityTrieEditor
+{
+public:
+	explicit CVisibilityTrieEditor(const CVisibilityTrieNode::Ptr& root)
+		: m_original(root)
+	{
+	}
+
+	CVisibilityTrieEditor(const CVisibilityTrieEditor&) = delete;
+	CVisibilityTrieEditor& operator=(const CVisibilityTrieEditor&) = delete;
+	CVisibilityTrieEditor(CVisibilityTrieEditor&&) = default;
+
+	/// Set path to state. Returns true if the trie changed.
+	bool Set(const CComponentPath& path, ComponentState state)
+	{
+		if (path.IsEmpty())
+			return false;
+
+		const CVisibilityTrieNode* current = m_root ? m_root.get() : m_original.get();
+		if (CVisibilityTrieNode::Find(current, path) == state)
+			return false;
+
+		if (!m_root)
+			m_root = Own(m_original);
+		SetIn(*m_root, path, 0, state);
+		m_changed = true;
+		return true;
+	}
+
+	bool Changed() const { return m_changed; }
+
+	/// The edited trie (nullptr if empty). Unchanged editors return the original.
+	/// Rehashes the nodes this editor created; shared nodes keep their hash.
+	CVisibilityTrieNode::Ptr Commit()
+	{
+		if (!m_changed)
+			return m_original;
+		if (!m_root || m_root->m_count == 0)
+			return CVisibilityTrieNode::Ptr();
+		Rehash(*m_root);
+		return m_root;
+	}
+
+private:
+	typedef CVisibilityTrieNode Node;
+
+	/// Mutable node for p: p itself if created by this editor, otherwise a copy
+	std::shared_ptr<Node> Own(const Node::Ptr& p)
+	{
+		if (p && m_owned.count(p.get()))
+			return std::const_pointer_cast<Node>(p);
+
+		std::shared_ptr<Node> copy = p ? std::make_shared<Node>(*p) : std::make_shared<Node>();
+		m_owned.insert(copy.get());
+		return copy;
+	}
+
+	void SetIn(Node& node, const CComponentPath& path, int level, ComponentState state)
+	{
+		const int index = path.At(level);
+		if (level == path.Depth() - 1)
+		{
+			node.SetOwnState(index, state);
+		}
+		else
+		{
+			auto it = node.FindChildSlot(index);
+			std::shared_ptr<Node> child = Own(it != node.m_children.end() ? it->second : Node::Ptr());
+			const uint32_t before = child->m_count;
+			SetIn(*child, path, level + 1, state);
+			node.m_count = node.m_count - before + child->m_count;
+			node.SetChild(index, child->m_count > 0 ? Node::Ptr(child) : Node::Ptr());
+		}
+		node.Trim();
+	}
+
+	/// Post-order rehash of editor-owned nodes
+	void Rehash(Node& node)
+	{
+		for (const auto& slot : node.m_children)
+		{
+			if (m_owned.count(slot.second.get()))
+				Rehash(*std::const_pointer_cast<Node>(slot.second));
+		}
+		node.UpdateHash();
+	}
+
+	Node::Ptr m_original;
+	std::shared_ptr<Node> m_root;
+	std::unordered_set<const Node*> m_owned;
+	bool m_changed = false;
+};
+
+inline CVisibilityTrieNode::Ptr CVisibilityTrieNode::Overlay(const Ptr& rules, const CVisibilityTrieNode& overrides)
+{
+	CVisibilityTrieEditor editor(rules);
+	overrides.ForEach([&editor](const CComponentPath& path, ComponentState state)
+	{
+		editor.Set(path, state == CS_SHOWN ? CS_VISIBLE : state);
+	});
+	return editor.Commit();
+}
+
+inline CVisibilityTrieNode::Ptr CVisibilityTrieNode::With(const Ptr& root, const CComponentPath& path, ComponentState state)
+{
+	CVisibilityTrieEditor editor(root);
+	editor.Set(path, state);
+	return editor.Commit();
+}
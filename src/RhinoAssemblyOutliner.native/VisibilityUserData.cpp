@@ -123,8 +123,10 @@ void CComponentVisibilityData::SyncToVisData(const ON_UUID& instanceId, CVisibil
 {
 	// Clear existing and set from our stored paths
 	visData.ResetInstance(instanceId);
-	for (const auto& path : HiddenPaths)
+	for (const auto& text : HiddenPaths)
 	{
-		visData.SetComponentHidden(instanceId, path.c_str());
+		CComponentPath path;
+		if (CComponentPath::Parse(text.c_str(), path))
+			visData.SetComponentHidden(instanceId, path);
 	}
 }
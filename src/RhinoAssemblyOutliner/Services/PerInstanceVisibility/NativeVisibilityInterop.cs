@@ -1,6 +1,8 @@
 using System;
+using System.Collections.Generic;
 using System.IO;
 using System.Runtime.InteropServices;
+using System.Text;
 
 namespace RhinoAssemblyOutliner.Services.PerInstanceVisibility;
 
@@ -40,6 +42,10 @@ public static class NativeVisibilityInterop
         [MarshalAs(UnmanagedType.LPStr)] string componentPath
     );
 
+    /// <summary>
+    /// Number of hidden or suppressed components of an instance, including those hidden by
+    /// definition rules (since API v21).
+    /// </summary>
     [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
     public static extern int GetHiddenComponentCount(ref Guid instanceId);
 
@@ -49,6 +55,31 @@ public static class NativeVisibilityInterop
     [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
     public static extern void SetDebugLogging([MarshalAs(UnmanagedType.Bool)] bool enabled);
 
+    /// <summary>
+    /// Draw managed instances whose visible components span fewer than <paramref name="pixels"/>
+    /// on screen as a box proxy (API v13). 0 turns the proxy off.
+    /// </summary>
+    [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
+    public static extern void SetLodThreshold(double pixels);
+
+    /// <summary>
+    /// Current LOD proxy threshold in pixels (API v13), 0 if off.
+    /// </summary>
+    [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
+    public static extern double GetLodThreshold();
+
+    /// <summary>
+    /// Opt in to drawing managed instances with unchanged states from merged render meshes
+    /// in shaded modes (API v14). Meshes are merged on native worker threads; instances are drawn
+    /// per component until their merged mesh is published.
+    /// </summary>
+    [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
+    public static extern void SetMergedMeshes([MarshalAs(UnmanagedType.Bool)] bool enabled);
+
+    [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
+    [return: MarshalAs(UnmanagedType.Bool)]
+    public static extern bool GetMergedMeshes();
+
     [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
     public static extern int GetNativeVersion();
 
@@ -64,10 +95,69 @@ public static class NativeVisibilityInterop
         int maxCount
     );
 
+    /// <summary>
+    /// Get the managed instances that reference a block definition directly (API v10).
+    /// Answered from a native index, without scanning the document.
+    /// </summary>
+    /// <returns>Total count; <paramref name="buffer"/> is filled up to <paramref name="maxCount"/>.</returns>
+    [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
+    public static extern int GetManagedInstancesOfDefinition(
+        ref Guid definitionId,
+        [In, Out] Guid[]? buffer,
+        int maxCount
+    );
+
     [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
     [return: MarshalAs(UnmanagedType.Bool)]
     public static extern bool IsConduitEnabled();
 
+    /// <summary>
+    /// Conduit performance counters (API v8, ComponentsCulled since v11, InstancesProxied since v13, merged mesh counters since v14, redraw counters since v20). Mirrors RAO_CONDUIT_STATS in NativeApi.h;
+    /// fields are only ever appended. Timings are accumulated nanoseconds.
+    /// </summary>
+    [StructLayout(LayoutKind.Sequential)]
+    public struct ConduitStats
+    {
+        public int StructSize;
+        public int MaxNestingDepth;
+        public ulong Frames;
+        public ulong SnapshotRefreshes;
+        public ulong SnapshotNs;
+        public ulong DrawNs;
+        public ulong BBoxNs;
+        public ulong TransparentNs;
+        public ulong HighlightNs;
+        public ulong InstancesDrawn;
+        public ulong ComponentsDrawn;
+        public ulong ComponentsSkipped;
+        public ulong TransparentDrawn;
+        public ulong DrawListBuilds;
+        public ulong DrawListHits;
+        public ulong CachedDrawLists;
+        public ulong SnapshotBytesPublished;
+        public ulong ComponentsCulled;
+        public ulong InstancesProxied;
+        public ulong InstancesMerged;
+        public ulong MergedMeshBuilds;
+        public ulong RedrawsCoalesced;
+        public ulong ViewsRedrawn;
+        public ulong ViewsSkipped;
+    }
+
+    /// <summary>
+    /// Read the conduit performance counters (API v8).
+    /// <see cref="ConduitStats.StructSize"/> must be set to <c>Marshal.SizeOf&lt;ConduitStats&gt;()</c>.
+    /// </summary>
+    [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
+    [return: MarshalAs(UnmanagedType.Bool)]
+    public static extern bool GetConduitStats(ref ConduitStats stats);
+
+    /// <summary>
+    /// Zero the conduit performance counters (API v8).
+    /// </summary>
+    [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
+    public static extern void ResetConduitStats();
+
     /// <summary>
     /// Set the state of a component within a block instance.
     /// </summary>
@@ -83,7 +173,8 @@ int state
     );
 
     /// <summary>
-    /// Get the state of a component within a block instance.
+    /// Get the state a component within a block instance is drawn with: its own state,
+    /// else the rule of its definition (API v16).
     /// </summary>
     /// <returns>0=Visible, 1=Hidden, 2=Suppressed, 3=Transparent.</returns>
     [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
@@ -92,6 +183,328 @@ int state
         [MarshalAs(UnmanagedType.LPStr)] string path
     );
 
+    /// <summary>
+    /// Set the state of a component addressed by its child-index sequence (API v6).
+    /// Avoids formatting and parsing a dot-separated path string.
+    /// </summary>
+    /// <param name="instanceId">The block instance UUID.</param>
+    /// <param name="indices">Child indices, root first (e.g. {1, 0, 2} for "1.0.2").</param>
+    /// <param name="depth">Number of entries in <paramref name="indices"/>.</param>
+    /// <param name="state">0=Visible, 1=Hidden, 2=Suppressed, 3=Transparent.</param>
+    [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
+    [return: MarshalAs(UnmanagedType.Bool)]
+    public static extern bool SetComponentStateByIndices(
+        ref Guid instanceId,
+        [In] int[] indices,
+        int depth,
+        int state
+    );
+
+    /// <summary>
+    /// Set the states of many components in one native call (API v7).
+    /// Entry i sets <paramref name="paths"/>[i] of <paramref name="instanceIds"/>[i]
+    /// to <paramref name="states"/>[i]; the native side applies all entries under
+    /// one lock and redraws once.
+    /// </summary>
+    /// <returns>Number of valid entries applied.</returns>
+    [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
+    public static extern int SetComponentStatesBatch(
+        [In] Guid[] instanceIds,
+        [In, MarshalAs(UnmanagedType.LPArray, ArraySubType = UnmanagedType.LPStr)] string[] paths,
+        [In] int[] states,
+        int count
+    );
+
+    /// <summary>
+    /// Set component states in a named native state table without changing what is drawn (API v15).
+    /// The table is created if missing; entries as for <see cref="SetComponentStatesBatch"/>.
+    /// </summary>
+    /// <returns>Number of valid entries applied.</returns>
+    [DllImport(DllName, CallingConvention = CallingConvention.StdCall, CharSet = CharSet.Unicode)]
+    public static extern int SetStateTableStatesBatch(
+        string name,
+        [In] Guid[] instanceIds,
+        [In, MarshalAs(UnmanagedType.LPArray, ArraySubType = UnmanagedType.LPStr)] string[] paths,
+        [In] int[] states,
+        int count
+    );
+
+    /// <summary>
+    /// Save the current state of all instances as a named state table (API v15).
+    /// </summary>
+    /// <returns>Number of managed instances saved, or -1 on error.</returns>
+    [DllImport(DllName, CallingConvention = CallingConvention.StdCall, CharSet = CharSet.Unicode)]
+    public static extern int SaveStateTable(string name);
+
+    /// <summary>
+    /// Replace the state of all instances with a named state table and redraw once (API v15).
+    /// Switching is a native pointer swap, independent of assembly size; instances not in the
+    /// table become fully visible.
+    /// </summary>
+    [DllImport(DllName, CallingConvention = CallingConvention.StdCall, CharSet = CharSet.Unicode)]
+    [return: MarshalAs(UnmanagedType.Bool)]
+    public static extern bool ActivateStateTable(string name);
+
+    /// <summary>
+    /// Drop a named state table (API v15).
+    /// </summary>
+    [DllImport(DllName, CallingConvention = CallingConvention.StdCall, CharSet = CharSet.Unicode)]
+    [return: MarshalAs(UnmanagedType.Bool)]
+    public static extern bool DeleteStateTable(string name);
+
+    /// <summary>
+    /// Set the state of a component for every instance of a block definition (API v16).
+    /// Stored once per definition; states set on an instance override it, and setting
+    /// 0 on an instance shows a component the rule hides.
+    /// </summary>
+    /// <param name="definitionId">The block definition UUID.</param>
+    /// <param name="path">Dot-separated component path within the definition.</param>
+    /// <param name="state">0=Visible, 1=Hidden, 2=Suppressed, 3=Transparent.</param>
+    [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
+    [return: MarshalAs(UnmanagedType.Bool)]
+    public static extern bool SetDefinitionComponentState(
+        ref Guid definitionId,
+        [MarshalAs(UnmanagedType.LPStr)] string path,
+        int state
+    );
+
+    /// <summary>
+    /// Get the rule state of a component of a block definition (API v16).
+    /// </summary>
+    /// <returns>0=Visible, 1=Hidden, 2=Suppressed, 3=Transparent.</returns>
+    [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
+    public static extern int GetDefinitionComponentState(
+        ref Guid definitionId,
+        [MarshalAs(UnmanagedType.LPStr)] string path
+    );
+
+    /// <summary>
+    /// Drop all rules of a block definition; instance states are kept (API v16).
+    /// </summary>
+    [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
+    public static extern void ResetDefinitionVisibility(ref Guid definitionId);
+
+    /// <summary>
+    /// Component query (API v17). Mirrors RAO_COMPONENT_QUERY in NativeApi.h; fields are only
+    /// ever appended. A component matches if it meets every criterion that is set.
+    /// </summary>
+    [StructLayout(LayoutKind.Sequential, CharSet = CharSet.Unicode)]
+    public struct ComponentQuery
+    {
+        /// <summary>Must be <c>Marshal.SizeOf&lt;ComponentQuery&gt;()</c>.</summary>
+        public int StructSize;
+        /// <summary>Layer index of the component, -1 = any layer.</summary>
+        public int LayerIndex;
+        /// <summary>Rhino ObjectType bit mask, 0 = any type.</summary>
+        public uint ObjectTypes;
+        /// <summary>Object name pattern (* and ?, case-insensitive), null = any.</summary>
+        [MarshalAs(UnmanagedType.LPWStr)] public string? Name;
+        /// <summary>User text key the component must have, null = any.</summary>
+        [MarshalAs(UnmanagedType.LPWStr)] public string? UserKey;
+        /// <summary>Pattern for the value of UserKey, null = any value.</summary>
+        [MarshalAs(UnmanagedType.LPWStr)] public string? UserValue;
+    }
+
+    /// <summary>
+    /// Find the components of a block instance matching a query, at any nesting depth (API v17).
+    /// A matching nested block is reported whole, without its contents.
+    /// The buffer receives packed records, one per match: depth, index[0] .. index[depth - 1].
+    /// Pass null to query the required size.
+    /// </summary>
+    /// <returns>Number of ints required, or -1 on invalid arguments.</returns>
+    [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
+    public static extern int QueryComponents(
+        ref Guid instanceId,
+        ref ComponentQuery query,
+        [Out] int[]? buffer,
+        int capacity
+    );
+
+    /// <summary>
+    /// Set a state on every component matching a query in each of the instances,
+    /// with a single redraw (API v17). Matches are collected once per definition.
+    /// </summary>
+    /// <param name="state">0=Visible, 1=Hidden, 2=Suppressed, 3=Transparent.</param>
+    /// <returns>Number of component states set, or -1 on invalid arguments.</returns>
+    [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
+    public static extern int ApplyComponentQuery(
+        [In] Guid[] instanceIds,
+        int instanceCount,
+        ref ComponentQuery query,
+        int state
+    );
+
+    /// <summary>
+    /// Pick the nearest visible component of a block instance along a world line (API v18),
+    /// e.g. <c>RhinoViewport.GetFrustumLine</c> through the mouse point.
+    /// Hidden and suppressed components are never hit; curves, points and objects without
+    /// a render mesh are hit within tolerance of their bounding box.
+    /// </summary>
+    /// <param name="lineFrom">Line start (x, y, z), nearest to the camera.</param>
+    /// <param name="lineTo">Line end (x, y, z).</param>
+    /// <param name="tolerance">Pick tolerance in world units.</param>
+    /// <param name="instanceId">Receives the top-level block instance hit.</param>
+    /// <param name="pathBuffer">Receives the child indices of the component (33 is always enough).</param>
+    /// <param name="capacity">Length of pathBuffer.</param>
+    /// <returns>Path depth, 0 if nothing was hit, or -1 on invalid arguments.</returns>
+    [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
+    public static extern int PickComponent(
+        [In] double[] lineFrom,
+        [In] double[] lineTo,
+        double tolerance,
+        out Guid instanceId,
+        [Out] int[]? pathBuffer,
+        int capacity
+    );
+
+    /// <summary>
+    /// One node of the block instance hierarchy (API v19). Mirrors RAO_TREE_NODE in NativeApi.h.
+    /// Blittable: arrays of it are pinned and filled in place, without a marshaling copy.
+    /// </summary>
+    [StructLayout(LayoutKind.Sequential)]
+    public struct TreeNode
+    {
+        /// <summary>Index of the parent node in the same buffer, -1 = none.</summary>
+        public int Parent;
+        /// <summary>Instance definition table index of a block, -1 otherwise.</summary>
+        public int DefinitionIndex;
+        /// <summary>Child index within the parent's definition, -1 for a top-level instance.</summary>
+        public int ComponentIndex;
+        /// <summary>Component path length, 0 for a top-level instance.</summary>
+        public int Depth;
+        /// <summary>Id of the instance or definition object.</summary>
+        public Guid ObjectId;
+        /// <summary>Effective state in its top-level instance: 0=Visible, 1=Hidden, 2=Suppressed, 3=Transparent.</summary>
+        public int State;
+        /// <summary>Components of its definition, whether exported or not.</summary>
+        public int ChildCount;
+        /// <summary>Rhino ObjectType of the object.</summary>
+        public uint ObjectType;
+    }
+
+    /// <summary>
+    /// Export the block instance hierarchy of the active document in one call (API v19):
+    /// each top-level instance (sorted by id) followed by its components in depth-first
+    /// preorder, nested blocks down to maxDepth levels below it (-1 = all).
+    /// Nodes refer to their parent by index within the buffer.
+    /// Pass null to query the required size.
+    /// </summary>
+    /// <returns>Number of nodes required, or -1 on invalid arguments.</returns>
+    [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
+    public static extern int ExportInstanceTree(
+        [Out] TreeNode[]? buffer,
+        int capacity,
+        int maxDepth
+    );
+
+    /// <summary>
+    /// Export the components directly below one node for lazy expansion (API v19):
+    /// the definition components of the instance for depth 0, else those of the nested
+    /// block at the child-index path. Nodes have Parent -1.
+    /// Pass null to query the required size.
+    /// </summary>
+    /// <returns>Number of nodes required, or -1 if the path does not address a block.</returns>
+    [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
+    public static extern int ExportTreeChildren(
+        ref Guid instanceId,
+        [In] int[]? path,
+        int depth,
+        [Out] TreeNode[]? buffer,
+        int capacity
+    );
+
+    /// <summary>
+    /// Make the redraws pending for state changes of the active document now (API v20).
+    /// State changes are otherwise redrawn when Rhino goes idle, once per idle and only in
+    /// the views whose frustum shows a changed instance.
+    /// </summary>
+    [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
+    public static extern void FlushRedraws();
+
+    /// <summary>
+    /// Get the state of a component addressed by its child-index sequence (API v6).
+    /// </summary>
+    /// <returns>0=Visible, 1=Hidden, 2=Suppressed, 3=Transparent.</returns>
+    [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
+    public static extern int GetComponentStateByIndices(
+        ref Guid instanceId,
+        [In] int[] indices,
+        int depth
+    );
+
+    /// <summary>
+    /// Get every non-visible component state of an instance in one call (API v9).
+    /// These are the states it is drawn with, its own over its definition's rules (since v21).
+    /// The buffer receives packed records in path order:
+    /// depth, index[0] .. index[depth - 1], state.
+    /// </summary>
+    /// <returns>Number of ints required; the buffer is complete only if this is at most <paramref name="capacity"/>.</returns>
+    [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
+    public static extern int GetInstanceStates(
+        ref Guid instanceId,
+        [Out] int[]? buffer,
+        int capacity
+    );
+
+    /// <summary>
+    /// Multi-instance <see cref="GetInstanceStates"/> read from one native snapshot (API v9).
+    /// Per instance, in order: the record count followed by its records.
+    /// </summary>
+    /// <returns>Number of ints required, or -1 on invalid arguments.</returns>
+    [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
+    public static extern int GetMultiInstanceStates(
+        [In] Guid[] instanceIds,
+        int instanceCount,
+        [Out] int[]? buffer,
+        int capacity
+    );
+
+    /// <summary>
+    /// Get the rules of definitions read from one native snapshot (API v21).
+    /// Per definition, in order: the record count followed by its records, packed as
+    /// <see cref="GetInstanceStates"/>.
+    /// </summary>
+    /// <returns>Number of ints required, or -1 on invalid arguments.</returns>
+    [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
+    public static extern int GetMultiDefinitionStates(
+        [In] Guid[] definitionIds,
+        int definitionCount,
+        [Out] int[]? buffer,
+        int capacity
+    );
+
+    /// <summary>
+    /// Read all non-visible component states of an instance, definition rules included,
+    /// with one native query (two if the initial buffer is too small).
+    /// </summary>
+    /// <returns>Dot-separated component path -> state (1=Hidden, 2=Suppressed, 3=Transparent).</returns>
+    public static Dictionary<string, int> GetInstanceStateMap(Guid instanceId, int initialCapacity = 1024)
+    {
+        var buffer = new int[Math.Max(initialCapacity, 1)];
+        int required = GetInstanceStates(ref instanceId, buffer, buffer.Length);
+        while (required > buffer.Length)
+        {
+            buffer = new int[required];
+            required = GetInstanceStates(ref instanceId, buffer, buffer.Length);
+        }
+
+        var states = new Dictionary<string, int>();
+        var path = new StringBuilder();
+        int offset = 0;
+        while (offset < required)
+        {
+            int depth = buffer[offset++];
+            path.Clear();
+            for (int level = 0; level < depth; level++)
+            {
+                if (level > 0) path.Append('.');
+                path.Append(buffer[offset++]);
+            }
+            states[path.ToString()] = buffer[offset++];
+        }
+        return states;
+    }
+
     /// <summary>
     /// Check if the native DLL exists next to the plugin.
     /// </summary>
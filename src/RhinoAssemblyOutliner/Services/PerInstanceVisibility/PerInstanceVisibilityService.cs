@@ -16,6 +16,9 @@ namespace RhinoAssemblyOutliner.Services.PerInstanceVisibility;
 /// </summary>
 public class PerInstanceVisibilityService : IDisposable
 {
+    /// <summary>Native ComponentState value for CS_HIDDEN.</summary>
+    private const int HiddenState = 1;
+
     private readonly RhinoDoc _doc;
     private readonly bool _nativeAvailable;
     private bool _disposed;
@@ -74,11 +77,9 @@ public bool ToggleComponent(Guid instanceId, int componentIndex)
         var visData = GetOrCreateVisibilityData(instanceObj);
         bool newState = visData.ToggleComponentVisibility(componentIndex);
 
-        // Sync to native conduit
+        // Sync to native conduit; it redraws the views showing the instance
         string path = componentIndex.ToString();
         NativeVisibilityInterop.SetComponentVisibility(ref instanceId, path, newState);
-
-        _doc.Views.Redraw();
         return newState;
     }
 
@@ -95,11 +96,9 @@ public void SetComponentVisibility(Guid instanceId, int componentIndex, bool vis
         var visData = GetOrCreateVisibilityData(instanceObj);
         visData.SetComponentVisibility(componentIndex, visible);
 
-        // Sync to native conduit
+        // Sync to native conduit; it redraws the views showing the instance
         string path = componentIndex.ToString();
         NativeVisibilityInterop.SetComponentVisibility(ref instanceId, path, visible);
-
-        _doc.Views.Redraw();
     }
 
     /// <summary>
@@ -148,13 +147,11 @@ public void ShowAllComponents(Guid instanceId)
             visData.ShowAllComponents();
         }
 
-        // Reset in native conduit
+        // Reset in native conduit; it redraws the views showing the instance
         if (_nativeAvailable)
         {
             NativeVisibilityInterop.ResetComponentVisibility(ref instanceId);
         }
-
-        _doc.Views.Redraw();
     }
 
     /// <summary>
@@ -174,14 +171,17 @@ public void HideAllComponents(Guid instanceId)
         var defObjects = instanceDef.GetObjects();
         visData.HideAllComponents(defObjects.Length);
 
-        // Sync all to native conduit
+        // Sync all to native conduit in one batched call, which also redraws once
+        var instanceIds = new Guid[defObjects.Length];
+        var paths = new string[defObjects.Length];
+        var states = new int[defObjects.Length];
         for (int i = 0; i < defObjects.Length; i++)
         {
-            string path = i.ToString();
-            NativeVisibilityInterop.SetComponentVisibility(ref instanceId, path, false);
+            instanceIds[i] = instanceId;
+            paths[i] = i.ToString();
+            states[i] = HiddenState;
         }
-
-        _doc.Views.Redraw();
+        NativeVisibilityInterop.SetComponentStatesBatch(instanceIds, paths, states, paths.Length);
     }
 
     /// <summary>
@@ -226,6 +226,8 @@ public void RefreshAll()
         if (!_nativeAvailable) return;
 
         // Re-evaluate all instances with visibility data
+        var instanceIds = new List<Guid>();
+        var paths = new List<string>();
         foreach (var obj in _doc.Objects.GetObjectList(ObjectType.InstanceReference))
         {
             if (obj is InstanceObject instanceObj)
@@ -235,18 +237,21 @@ public void RefreshAll()
                 
                 if (visData != null && visData.HasHiddenComponents)
                 {
-                    // Sync hidden components to native
-                    var instanceId = instanceObj.Id;
+                    // Collect hidden components for one batched native sync
                     foreach (int idx in visData.HiddenComponents)
                     {
-                        string path = idx.ToString();
-                        NativeVisibilityInterop.SetComponentVisibility(ref instanceId, path, false);
+                        instanceIds.Add(instanceObj.Id);
+                        paths.Add(idx.ToString());
                     }
                 }
             }
         }
 
-        _doc.Views.Redraw();
+        if (paths.Count > 0)
+        {
+            var states = Enumerable.Repeat(HiddenState, paths.Count).ToArray();
+            NativeVisibilityInterop.SetComponentStatesBatch(instanceIds.ToArray(), paths.ToArray(), states, paths.Count);
+        }
     }
 
     #region Private Helpers